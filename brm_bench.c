@@ -0,0 +1,317 @@
+/**############################################################################
+ ** TITLE:		brm_bench
+ ** AUTHOR:		Magnus Overbo
+ ** ABOUT:		Micro- and macrobenchmarks of the attack core for the build
+ **						flags it was compiled with, printed as one JSON object.
+ **						Microbenchmarks time lfsr_iterate(), lfsrgen(),
+ **						lfsr_next(), genEncrypt(), genPrefixes() and both search
+ **						engines, arbp_search() and ctx_search(), over the degrees,
+ **						word lengths and error ratios below. Macrobenchmarks run
+ **						stage one and stage two end to end on fixed key pairs.
+ **
+ ** Usage:		./brm_bench [-t seconds] [-w workers] [-q]
+ **						-t is the least time spent per microbenchmark, -w the
+ **						workers of the macrobenchmarks and -q skips degree 20
+ **						and m = 1024 for a quick run.
+ **						make bench runs it for every build flag combination.
+ **#########################################################################**/
+
+//-----------------------------------------------------------------------------
+// INCLUDES
+//-----------------------------------------------------------------------------
+#include "evaluation/src/brm.c"		//Whole core, the benchmarks time its internals
+
+
+//-----------------------------------------------------------------------------
+// STRUCTs
+//-----------------------------------------------------------------------------
+struct INPUT {
+	int deg;			// Polynomial degree
+	int m;				// Search word length
+	int K;				// Rows of the error table
+	uint_least64_t pol;	// Feedback polynomial
+	mpz_t P;			// Polynomial as mpz
+	mpz_t CLK;			// Clocking output, m bits
+	mpz_t DES;			// Decimated output, 2m bits
+	mpz_t ZERO;			// Plaintext
+	mpz_t CIPHER;		// Ciphertext, the search word
+	mpz_t TEXT;			// Output of a wrong R2 state, the search text
+	mpz_t* B;			// Prefixes of the cipher
+	struct SEARCHCTX S;	// Search context
+};
+
+struct MACRO {
+	int deg;			// Polynomial degree
+	int m;				// Search word length
+	int k;				// Allowed errors
+	int R1;				// Fixed key pair
+	int R2;
+};
+
+
+//-----------------------------------------------------------------------------
+// GLOBAL VARIABLES
+//-----------------------------------------------------------------------------
+const int DEGS[] = { 11, 16, 20 };
+const int MS[] = { 10, 32, 128, 512, 1024 };
+const int RATIOS[] = { 10, 5, 3 };				//k = m / ratio
+
+const struct MACRO MACROS[] = {
+	{ 11, 30, 10, 1234, 99 },
+	{ 16, 60, 20, 1234, 99 },
+	{ 20, 40, 8, 1234, 99 },
+};
+
+double MINTIME = 0.05;							//Least seconds per microbenchmark
+int ROWS = 0;									//Rows printed in the current array
+volatile uint_least64_t SINK;					//Keeps results alive
+
+
+/*-----------------------------------------------------------------------------
+ * Run fn on the input in doubling batches until MINTIME has passed.
+ *	Returns the nanoseconds per call.
+-----------------------------------------------------------------------------*/
+static double bench_loop( void (*fn)( struct INPUT* ), struct INPUT* I ){
+	uint_least64_t reps = 1;
+	uint_least64_t calls = 0;
+	double begin = brm_clock();
+	double spent = 0;
+	while( spent < MINTIME ){
+		uint_least64_t r = 0;
+		while( r < reps ){
+			fn( I );
+			r++;
+		}
+		calls += reps;
+		reps *= 2;
+		spent = brm_clock() - begin;
+	}
+	return spent * 1e9 / calls;
+}
+
+static void run_lfsr_iterate( struct INPUT* I ){
+	struct LFSR lfsr;
+	lfsr.DEGREE = I->deg;
+	mpz_init_set( lfsr.POLYNOMIAL, I->P );
+	mpz_init_set_ui( lfsr.STATE, 99 );
+	int i = 0;
+	while( i < 2*I->m ){
+		SINK = lfsr_iterate( &lfsr );
+		i++;
+	}
+	mpz_clear( lfsr.POLYNOMIAL );
+	mpz_clear( lfsr.STATE );
+}
+
+static void run_lfsrgen( struct INPUT* I ){
+	lfsrgen( I->DES, I->deg, 2*I->m, I->P, 99, 0, NULL );
+}
+
+static void run_lfsr_next( struct INPUT* I ){
+	uint_least64_t state = 99;
+	uint_least64_t acc = 0;
+	int i = 0;
+	while( i < 2*I->m ){
+		int out;
+		state = lfsr_next( state, I->pol, I->deg, &out );
+		acc = (acc << 1) | out;
+		i++;
+	}
+	SINK = acc;
+}
+
+static void run_genEncrypt( struct INPUT* I ){
+	genEncrypt( I->CIPHER, I->CLK, I->DES, I->ZERO, I->m );
+}
+
+static void run_genPrefixes( struct INPUT* I ){
+	mpz_set_ui( I->B[0], 0 );
+	mpz_set_ui( I->B[1], 0 );
+	genPrefixes( I->B, I->CIPHER, I->m );
+}
+
+static void run_arbp_search( struct INPUT* I ){
+	int n = 2*I->m;
+	mpz_t* M = arbp_search( I->B, I->TEXT, I->K, I->m, n );
+	int i = 0;
+	while( i < n ){
+		mpz_clear( M[i] );
+		i++;
+	}
+	free( M );
+}
+
+static void run_ctx_search( struct INPUT* I ){
+	SINK = ctx_search( &I->S, I->B, 0 );
+}
+
+/*-----------------------------------------------------------------------------
+ * Inputs of the microbenchmarks: cipher of the key pair (1234, 99) and the
+ *	output of the wrong R2 state 4321 as search text
+-----------------------------------------------------------------------------*/
+static void input_init( struct INPUT* I, int deg, int m ){
+	I->deg = deg;
+	I->m = m;
+	I->K = 1;
+	brm_polynomial( deg, &I->pol );
+	mpz_init_set_ui( I->P, I->pol );
+	mpz_init( I->CLK );
+	mpz_init( I->DES );
+	mpz_init( I->ZERO );
+	mpz_init( I->CIPHER );
+	mpz_init( I->TEXT );
+	lfsrgen( I->CLK, deg, m, I->P, 1234, 0, NULL );
+	lfsrgen( I->DES, deg, 2*m, I->P, 99, 0, NULL );
+	genEncrypt( I->CIPHER, I->CLK, I->DES, I->ZERO, m );
+	I->B = genAlphabet( ALPHASIZE );
+	genPrefixes( I->B, I->CIPHER, m );
+	lfsrgen( I->TEXT, deg, 2*m, I->P, 4321, 0, NULL );
+}
+
+static void input_clear( struct INPUT* I ){
+	mpz_clear( I->P );		mpz_clear( I->CLK );	mpz_clear( I->DES );
+	mpz_clear( I->ZERO );	mpz_clear( I->CIPHER );	mpz_clear( I->TEXT );
+	mpz_clear( I->B[0] );	mpz_clear( I->B[1] );
+	free( I->B );
+}
+
+static void row_begin( void ){
+	printf( "%s\n\t\t{", ROWS ? "," : "" );
+	ROWS++;
+}
+
+/*-----------------------------------------------------------------------------
+ * One microbenchmark row, per bit of the n processed bits
+-----------------------------------------------------------------------------*/
+static void micro( const char* name, struct INPUT* I, int k, int n, void (*fn)( struct INPUT* ) ){
+	double ns = bench_loop( fn, I );
+	row_begin();
+	printf( "\"bench\": \"%s\", \"deg\": %d, \"m\": %d", name, I->deg, I->m );
+	if( k >= 0 ){
+		printf( ", \"k\": %d, \"states_per_s\": %.1f", k, 1e9 / ns );
+	}
+	printf( ", \"bits\": %d, \"ns_per_call\": %.1f, \"ns_per_bit\": %.3f}", n, ns, ns / n );
+	fflush( stdout );
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one and stage two of a fixed key pair
+-----------------------------------------------------------------------------*/
+static int macro( const struct MACRO* M, int workers ){
+	brm_plan* plan = brm_plan_create( M->deg, M->R1, M->R2, M->m );
+	if( plan == NULL ){
+		return 1;
+	}
+	struct brm_result res;
+	brm_plan_stage_one( plan, M->m, M->k, BRM_SWEEP_STATES, workers, &res );
+	double states = (double)(((uint_least64_t)1 << M->deg) - 1);
+	row_begin();
+	printf( "\"bench\": \"stage_one\", \"deg\": %d, \"m\": %d, \"k\": %d, \"R1\": %d, \"R2\": %d, "
+		"\"workers\": %d, \"seconds\": %.6f, \"states_per_s\": %.1f, \"candidates\": %llu, "
+		"\"candidates_per_s\": %.1f, \"found\": %d}", M->deg, M->m, M->k, M->R1, M->R2, workers,
+		res.runtime, states / res.runtime, (unsigned long long)res.candidates,
+		res.candidates / res.runtime, res.found );
+
+	int r1 = -1, r2 = -1;
+	double begin = brm_clock();
+	brm_plan_stage_two( plan, M->m, &res, workers, &r1, &r2 );
+	double spent = brm_clock() - begin;
+	row_begin();
+	printf( "\"bench\": \"stage_two\", \"deg\": %d, \"m\": %d, \"k\": %d, \"R1\": %d, \"R2\": %d, "
+		"\"workers\": %d, \"seconds\": %.6f, \"candidates\": %llu, \"candidates_per_s\": %.1f, "
+		"\"match_R1\": %d, \"match_R2\": %d, \"recovered\": %d}", M->deg, M->m, M->k, M->R1, M->R2,
+		workers, spent, (unsigned long long)res.candidates, res.candidates / spent, r1, r2,
+		r1 == M->R1 && r2 == M->R2 );
+	fflush( stdout );
+	brm_result_clear( &res );
+	brm_plan_destroy( plan );
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+//	MAIN FUNCTION
+//-----------------------------------------------------------------------------
+int main( int argc, char *argv[] ){
+	int workers = 1;
+	int maxdeg = 20;
+	int maxm = 1024;
+	int a = 1;
+	while( a < argc ){
+		if( strcmp(argv[a], "-t") == 0 && a+1 < argc ){
+			MINTIME = atof( argv[++a] );
+		}
+		else if( strcmp(argv[a], "-w") == 0 && a+1 < argc ){
+			workers = brm_workers( atoi(argv[++a]) );
+		}
+		else if( strcmp(argv[a], "-q") == 0 ){
+			maxdeg = 16;
+			maxm = 512;
+		}
+		else{
+			printf("Usage: ./brm_bench [-t seconds] [-w workers] [-q]\n");
+			return 1;
+		}
+		a++;
+	}
+
+	printf( "{\n\t\"engine\": \"%s\",\n\t\"insertions\": %s,\n\t\"isa\": \"%s\",\n\t\"min_seconds\": %g,\n\t\"micro\": [",
+	#if defined SHIFTOR
+		"shiftor",
+	#else
+		"shiftand",
+	#endif
+	#if defined INC_INSERT
+		"true",
+	#else
+		"false",
+	#endif
+		brm_isa(), MINTIME );
+
+	//-----------------------------------------------------------------------------
+	// Microbenchmarks
+	//-----------------------------------------------------------------------------
+	int d = 0;
+	while( d < (int)(sizeof(DEGS)/sizeof(DEGS[0])) && DEGS[d] <= maxdeg ){
+		int i = 0;
+		while( i < (int)(sizeof(MS)/sizeof(MS[0])) && MS[i] <= maxm ){
+			struct INPUT I;
+			int m = MS[i];
+			input_init( &I, DEGS[d], m );
+			micro( "lfsr_iterate", &I, -1, 2*m, run_lfsr_iterate );
+			micro( "lfsrgen", &I, -1, 2*m, run_lfsrgen );
+			micro( "lfsr_next", &I, -1, 2*m, run_lfsr_next );
+			micro( "genEncrypt", &I, -1, m, run_genEncrypt );
+			micro( "genPrefixes", &I, -1, m, run_genPrefixes );
+			int r = 0;
+			while( r < (int)(sizeof(RATIOS)/sizeof(RATIOS[0])) ){
+				int k = m / RATIOS[r];
+				I.K = k + 1;
+				micro( "arbp_search", &I, k, 2*m, run_arbp_search );
+				ctx_init( &I.S, m, 2*m, I.K );
+				mpz_set( I.S.TEXT, I.TEXT );
+				micro( "ctx_search", &I, k, 2*m, run_ctx_search );
+				ctx_clear( &I.S );
+				r++;
+			}
+			input_clear( &I );
+			i++;
+		}
+		d++;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Macrobenchmarks
+	//-----------------------------------------------------------------------------
+	printf( "\n\t],\n\t\"macro\": [" );
+	ROWS = 0;
+	int i = 0;
+	while( i < (int)(sizeof(MACROS)/sizeof(MACROS[0])) ){
+		if( MACROS[i].deg <= maxdeg ){
+			macro( &MACROS[i], workers );
+		}
+		i++;
+	}
+	printf( "\n\t]\n}\n" );
+	return 0;
+}
@@ -0,0 +1,242 @@
+/**############################################################################
+ ** TITLE:		brm_merge
+ ** AUTHOR:		Magnus Overbo
+ ** ABOUT:		Merges the shard files of a sharded stage one (./main --shard)
+ **						into one ranked candidate set and reports the parts of the
+ **						sweep no shard covered, or covered twice. The result does
+ **						not depend on the order of the files.
+ **
+ ** Usage:		./brm_merge [-o merged.brm] [-n top] <shard files>
+ **						Exit status 0 if the shards cover the whole sweep, 2 if
+ **						there are gaps and 1 on errors.
+ **#########################################################################**/
+
+//-----------------------------------------------------------------------------
+// INCLUDES
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "evaluation/src/brm.h"		//Shard files
+
+
+//-----------------------------------------------------------------------------
+// STRUCTs
+//-----------------------------------------------------------------------------
+struct ENTRY {
+	int state;		// R2 initial state
+	int score;		// Lowest number of errors
+};
+
+struct SPAN {
+	uint64_t from;	// First swept position
+	uint64_t to;	// One past the last
+};
+
+static int cmp_state( const void* a, const void* b ){
+	const struct ENTRY* x = a;
+	const struct ENTRY* y = b;
+	return (x->state > y->state) - (x->state < y->state);
+}
+
+static int cmp_span( const void* a, const void* b ){
+	const struct SPAN* x = a;
+	const struct SPAN* y = b;
+	if( x->from != y->from ){
+		return (x->from > y->from) - (x->from < y->from);
+	}
+	return (x->to > y->to) - (x->to < y->to);
+}
+
+static const char* read_error( int err ){
+	if( err == 1 )	return "could not open file";
+	if( err == 2 )	return "not a shard file of a known version";
+	return "truncated shard file";
+}
+
+
+//-----------------------------------------------------------------------------
+//	MAIN FUNCTION
+//-----------------------------------------------------------------------------
+int main( int argc, char *argv[] ){
+	char* out = NULL;
+	int top = 10;
+	int a = 1;
+	while( a < argc && argv[a][0] == '-' ){
+		if( strcmp(argv[a], "-o") == 0 && a+1 < argc ){
+			out = argv[++a];
+		}
+		else if( strcmp(argv[a], "-n") == 0 && a+1 < argc ){
+			top = atoi( argv[++a] );
+		}
+		else{
+			printf("Unknown option %s\n", argv[a]);
+			return 1;
+		}
+		a++;
+	}
+	if( a >= argc ){
+		printf("Usage: ./brm_merge [-o merged.brm] [-n top] <shard files>\n");
+		return 1;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Read every shard and check that they belong to the same attack
+	//-----------------------------------------------------------------------------
+	int files = argc - a;
+	struct brm_shard* sh = calloc( files, sizeof(struct brm_shard) );
+	uint64_t spans = 0;
+	uint64_t entries = 0;
+	int f = 0;
+	while( f < files ){
+		int err = brm_shard_read( &sh[f], argv[a+f] );
+		if( err ){
+			printf("%s: %s\n", argv[a+f], read_error(err));
+			return 1;
+		}
+		if( sh[f].deg != sh[0].deg || sh[f].m != sh[0].m || sh[f].k != sh[0].k ||
+				sh[f].R1 != sh[0].R1 || sh[f].R2 != sh[0].R2 || sh[f].mode != sh[0].mode ){
+			printf("%s: different attack than %s\n", argv[a+f], argv[a]);
+			return 1;
+		}
+		spans += sh[f].ranges;
+		entries += sh[f].entries;
+		f++;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Coverage: walk the swept ranges in order, anything skipped is a gap and
+	// anything swept twice an overlap. Covered ranges are coalesced.
+	//-----------------------------------------------------------------------------
+	struct SPAN* S = malloc( (spans ? spans : 1) * sizeof(struct SPAN) );
+	uint64_t s = 0;
+	f = 0;
+	while( f < files ){
+		int i = 0;
+		while( i < sh[f].ranges ){
+			S[s].from = sh[f].range[2*i];
+			S[s].to = sh[f].range[2*i+1];
+			s++;
+			i++;
+		}
+		f++;
+	}
+	qsort( S, spans, sizeof(struct SPAN), cmp_span );
+
+	uint64_t lo, hi;
+	brm_shard_range( sh[0].deg, sh[0].mode, 0, 1, &lo, &hi );
+	uint64_t* range = malloc( 2 * (spans+1) * sizeof(uint64_t) );
+	int ranges = 0;
+	uint64_t covered = 0;
+	uint64_t gaps = 0;
+	uint64_t cur = lo;
+	s = 0;
+	while( s < spans ){
+		if( S[s].from > cur ){
+			printf("Gap:     [%llu, %llu)\n", (unsigned long long)cur, (unsigned long long)S[s].from);
+			gaps++;
+		}
+		else if( S[s].from < cur && S[s].to > S[s].from ){
+			uint64_t end = S[s].to < cur ? S[s].to : cur;
+			printf("Overlap: [%llu, %llu)\n", (unsigned long long)S[s].from, (unsigned long long)end);
+		}
+		if( S[s].to > cur ){
+			uint64_t from = S[s].from > cur ? S[s].from : cur;
+			covered += S[s].to - from;
+			if( ranges > 0 && range[2*ranges-1] == from ){
+				range[2*ranges-1] = S[s].to;				//Extend the last covered range
+			}
+			else{
+				range[2*ranges] = from;
+				range[2*ranges+1] = S[s].to;
+				ranges++;
+			}
+			cur = S[s].to;
+		}
+		s++;
+	}
+	if( cur < hi ){
+		printf("Gap:     [%llu, %llu)\n", (unsigned long long)cur, (unsigned long long)hi);
+		gaps++;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Candidates: one entry per state, a state found by overlapping shards
+	// keeps its best score. Ranked by errors, then state.
+	//-----------------------------------------------------------------------------
+	struct ENTRY* E = malloc( (entries ? entries : 1) * sizeof(struct ENTRY) );
+	uint64_t u = 0;
+	f = 0;
+	while( f < files ){
+		uint64_t v = 0;
+		while( v < sh[f].entries ){
+			E[u].state = sh[f].states[v];
+			E[u].score = sh[f].scores[v];
+			u++;
+			v++;
+		}
+		f++;
+	}
+	qsort( E, entries, sizeof(struct ENTRY), cmp_state );
+	struct brm_shard M = sh[0];
+	M.ranges = ranges;
+	M.range = range;
+	M.entries = 0;
+	M.states = malloc( (entries ? entries : 1) * sizeof(int) );
+	M.scores = malloc( (entries ? entries : 1) * sizeof(int) );
+	u = 0;
+	while( u < entries ){
+		if( M.entries > 0 && M.states[M.entries-1] == E[u].state ){
+			if( E[u].score < M.scores[M.entries-1] ){
+				M.scores[M.entries-1] = E[u].score;
+			}
+		}
+		else{
+			M.states[M.entries] = E[u].state;
+			M.scores[M.entries] = E[u].score;
+			M.entries++;
+		}
+		u++;
+	}
+	brm_shard_rank( &M );
+
+	//-----------------------------------------------------------------------------
+	// Report
+	//-----------------------------------------------------------------------------
+	printf("Merged %d shards of deg %d, m %d, k %d (%s sweep)\n", files, M.deg, M.m, M.k,
+		M.mode == BRM_SWEEP_ARCS ? "arc" : "state");
+	printf("Covered %llu of %llu (%.2f%%), %llu gaps\n", (unsigned long long)covered,
+		(unsigned long long)(hi - lo), 100.0 * covered / (hi - lo), (unsigned long long)gaps);
+	printf("Candidates: %llu\n", (unsigned long long)M.entries);
+	u = 0;
+	while( u < M.entries && M.states[u] != M.R2 ){
+		u++;
+	}
+	if( u < M.entries ){
+		printf("Actual R2 state %d: rank %llu with %d errors\n", M.R2, (unsigned long long)u+1, M.scores[u]);
+	}
+	else{
+		printf("Actual R2 state %d: not a candidate\n", M.R2);
+	}
+	u = 0;
+	while( u < M.entries && u < (uint64_t)top ){
+		printf("%llu,%d,%d\n", (unsigned long long)u+1, M.states[u], M.scores[u]);
+		u++;
+	}
+
+	int ret = gaps ? 2 : 0;
+	if( out != NULL && brm_shard_write(&M, out) != 0 ){
+		printf("Could not write %s\n", out);
+		ret = 1;
+	}
+
+	free( M.states );	free( M.scores );
+	free( range );	free( S );	free( E );
+	f = 0;
+	while( f < files ){
+		brm_shard_clear( &sh[f] );
+		f++;
+	}
+	free( sh );
+	return ret;
+}
@@ -0,0 +1,185 @@
+/**############################################################################
+ ** TITLE:		brm_trace
+ ** AUTHOR:		Magnus Overbo
+ ** ABOUT:		Decodes a binary event trace written by a BRM_TRACE build
+ **						(brm_trace_start(), ./main -T). Prints the events of all
+ **						threads merged in time order as CSV, or with -c a summary
+ **						of the event counts and the search time per state.
+ **
+ ** Usage:		./brm_trace [-c] [-s state] [-e event] <trace file>
+ **						-s and -e keep only the events of one R2 state or of
+ **						one kind (start, end, saturated, match, candidate).
+ **#########################################################################**/
+
+//-----------------------------------------------------------------------------
+// INCLUDES
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "evaluation/src/brm.h"		//Event layout
+
+
+//-----------------------------------------------------------------------------
+// STRUCTs
+//-----------------------------------------------------------------------------
+struct EVENT {
+	struct brm_event e;	// Recorded event
+	uint32_t thread;	// Thread that recorded it
+};
+
+static const char* NAMES[] = { "", "start", "end", "saturated", "match", "candidate" };
+#define EVENTS	6
+
+static int cmp_time( const void* a, const void* b ){
+	const struct EVENT* x = a;
+	const struct EVENT* y = b;
+	if( x->e.time != y->e.time ){
+		return (x->e.time > y->e.time) - (x->e.time < y->e.time);
+	}
+	return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+
+//-----------------------------------------------------------------------------
+//	MAIN FUNCTION
+//-----------------------------------------------------------------------------
+int main( int argc, char *argv[] ){
+	int summary = 0;
+	long state = -1;
+	int type = 0;
+	int a = 1;
+	while( a < argc && argv[a][0] == '-' ){
+		if( strcmp(argv[a], "-c") == 0 ){
+			summary = 1;
+		}
+		else if( strcmp(argv[a], "-s") == 0 && a+1 < argc ){
+			state = atol( argv[++a] );
+		}
+		else if( strcmp(argv[a], "-e") == 0 && a+1 < argc ){
+			a++;
+			type = 1;
+			while( type < EVENTS && strcmp(argv[a], NAMES[type]) != 0 ){
+				type++;
+			}
+			if( type == EVENTS ){
+				printf("Unknown event %s\n", argv[a]);
+				return 1;
+			}
+		}
+		else{
+			printf("Unknown option %s\n", argv[a]);
+			return 1;
+		}
+		a++;
+	}
+	if( a+1 != argc ){
+		printf("Usage: ./brm_trace [-c] [-s state] [-e event] <trace file>\n");
+		return 1;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Header, then one chunk per ring: thread, events, dropped, events
+	//-----------------------------------------------------------------------------
+	FILE* fh = fopen( argv[a], "rb" );
+	if( fh == NULL ){
+		printf("%s: could not open file\n", argv[a]);
+		return 1;
+	}
+	char magic[8];
+	uint32_t head[2];
+	if( fread(magic, 1, 8, fh) != 8 || memcmp(magic, "BRMTRACE", 8) != 0 ||
+			fread(head, sizeof(uint32_t), 2, fh) != 2 || head[0] != 2 || head[1] != sizeof(struct brm_event) ){
+		printf("%s: not a trace file of a known version\n", argv[a]);
+		fclose( fh );
+		return 1;
+	}
+	struct EVENT* E = NULL;
+	uint64_t ct = 0;
+	uint64_t cap = 0;
+	uint64_t dropped = 0;
+	uint32_t threads = 0;
+	uint32_t chunk[2];
+	while( fread(chunk, sizeof(uint32_t), 2, fh) == 2 ){
+		uint64_t lost;
+		if( fread(&lost, sizeof(uint64_t), 1, fh) != 1 ){
+			break;
+		}
+		dropped += lost;
+		if( chunk[0] >= threads ){
+			threads = chunk[0] + 1;
+		}
+		if( ct + chunk[1] > cap ){
+			cap = 2 * (ct + chunk[1]);
+			E = realloc( E, cap * sizeof(struct EVENT) );
+		}
+		uint32_t i = 0;
+		while( i < chunk[1] && fread(&E[ct].e, sizeof(struct brm_event), 1, fh) == 1 ){
+			E[ct].thread = chunk[0];
+			ct++;
+			i++;
+		}
+		if( i < chunk[1] ){
+			printf("%s: truncated trace file\n", argv[a]);
+			break;
+		}
+	}
+	fclose( fh );
+	qsort( E, ct, sizeof(struct EVENT), cmp_time );
+
+	//-----------------------------------------------------------------------------
+	// Events or summary
+	//-----------------------------------------------------------------------------
+	uint64_t count[EVENTS] = { 0 };
+	uint64_t* start = calloc( threads ? threads : 1, sizeof(uint64_t) );
+	uint64_t searched = 0;
+	uint64_t busy = 0;
+	uint64_t slowest = 0;
+	uint32_t slow = 0;
+	if( !summary ){
+		printf("time_us,thread,event,state,pos,level\n");
+	}
+	uint64_t u = 0;
+	while( u < ct ){
+		struct brm_event* e = &E[u].e;
+		if( (state >= 0 && e->state != state) || (type && e->type != type) || e->type >= EVENTS ){
+			u++;
+			continue;
+		}
+		count[e->type]++;
+		if( e->type == BRM_EV_STATE_START ){
+			start[E[u].thread] = e->time + 1;
+		}
+		else if( e->type == BRM_EV_STATE_END && start[E[u].thread] ){		//Search time of a state, unless its start was dropped
+			uint64_t d = e->time + 1 - start[E[u].thread];
+			start[E[u].thread] = 0;
+			searched++;
+			busy += d;
+			if( d > slowest ){
+				slowest = d;
+				slow = e->state;
+			}
+		}
+		if( !summary ){
+			printf("%.3f,%u,%s,%u,%u,%u\n", e->time / 1e3, E[u].thread, NAMES[e->type], e->state,
+				e->pos, e->level);
+		}
+		u++;
+	}
+	if( summary ){
+		printf("Events: %llu from %u threads, %llu dropped by full rings\n", (unsigned long long)ct,
+			threads, (unsigned long long)dropped);
+		int t = 1;
+		while( t < EVENTS ){
+			printf("%-10s %llu\n", NAMES[t], (unsigned long long)count[t]);
+			t++;
+		}
+		if( searched ){
+			printf("Searched %llu states, %.3f us on average, slowest %u in %.3f us\n",
+				(unsigned long long)searched, busy / 1e3 / searched, slow, slowest / 1e3);
+		}
+	}
+	free( start );
+	free( E );
+	return 0;
+}
@@ -20,10 +20,25 @@
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>       //sqrt
 #include <string.h>     //strlen
 #include <stdint.h>     //64b Int
 #include <inttypes.h>   //64b int
 #include <gmp.h>        //arbitrary integer size
+#include <pthread.h>    //Pipeline workers
+#include <sched.h>      //sched_yield
+#include <unistd.h>     //sysconf
+#include <stdatomic.h>  //Lock-free candidate queue
+#include <fcntl.h>      //Result cache
+#include <dirent.h>
+#include <limits.h>     //PATH_MAX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined __linux__
+#include <linux/perf_event.h>	//Hardware counters
+#include <sys/syscall.h>
+#endif
+#include "brm.h"        //Public interface
 
 
 //-----------------------------------------------------------------------------
@@ -58,6 +73,169 @@ struct CANDIDATE {
 	mpz_t X;		// Undecimated output
 };
 
+struct ATTACK {
+	int deg;		// Polynomial degree
+	int m;			// Size of search word
+	int n;			// Size of search text (2m)
+	int slen;		// Rows in the error table (k + 1)
+	int CLKSTATE;	// Initial state of R1
+	int SSTATE;		// Initial state of R2
+	mpz_t pol;		// Feedback polynomial
+	mpz_t max;		// Number of LFSR states (2^deg)
+	mpz_t PLAINTEXT;	// Known plaintext
+	mpz_t CIPHER;	// Intercepted ciphertext
+	mpz_t* B;		// Prefix masks for the alphabet
+	const uint_least64_t* seq;	// Period sequence of the polynomial (NULL: generate per state)
+	const uint_least32_t* idx;	// Position of every state in seq
+	struct brm_plan* plan;	// Plan the attack belongs to (NULL: owns its variables)
+	struct brm_metrics* metrics;	// Metrics of the run (NULL: not measured)
+};
+
+struct POLY {
+	int deg;				// Polynomial degree
+	uint_least64_t pol;		// Feedback polynomial
+	uint_least64_t period;	// Length of the state cycle, 2^deg - 1
+	uint_least64_t* seq;	// Period sequence from state 1, continued by SEQPAD bits, then SEQPAD zeros
+	uint_least32_t* idx;	// Position of every state in seq, state 0 points at the zeros
+	int refs;				// Plans using the tables
+	struct POLY* next;		// Next cached polynomial
+};
+
+struct MASKS {
+	mpz_t CIPHER;			// Ciphertext of m bits
+	mpz_t* B;				// Prefix masks of the ciphertext
+};
+
+struct brm_plan {
+	struct POLY* P;			// Shared polynomial tables
+	int deg;				// Polynomial degree
+	int CLKSTATE;			// Initial state of R1
+	int SSTATE;				// Initial state of R2
+	int max_m;				// Longest search word of the plan
+	mpz_t pol;				// Feedback polynomial
+	mpz_t max;				// Number of LFSR states (2^deg)
+	mpz_t PLAINTEXT;		// Known plaintext
+	struct MASKS** M;		// Cipher and masks per m, built on first use
+	struct SEARCHCTX* idle;	// Search contexts not in use
+	struct brm_metrics metrics;	// Totals of every run on the plan
+	pthread_mutex_t lock;	// Guards M, idle and metrics
+};
+
+struct CSLOT {
+	atomic_size_t seq;		// Sequence number guarding the slot
+	struct CANDIDATE c;		// Candidate stored in the slot
+};
+
+struct CQUEUE {
+	struct CSLOT* slots;	// Ring of 2^x slots
+	size_t mask;			// Ring size - 1
+	atomic_size_t head;		// Next slot to dequeue
+	atomic_size_t tail;		// Next slot to enqueue
+};
+
+struct PIPELINE {
+	struct ATTACK* A;			// Attack shared by all workers
+	struct CQUEUE Q;			// Candidates waiting for stage two
+	atomic_uint_least64_t next;	// Next R2 state to search
+	atomic_int producers;		// Stage one workers still running
+	atomic_uint_least64_t best;	// Lowest matching (R2, R1) item
+	atomic_uint_least64_t ct;	// Candidates found by stage one
+};
+
+struct SEARCHCTX {
+	int m;			// Size of search word
+	int n;			// Size of search text
+	int K;			// Rows in the error table
+	int best;		// Lowest error level of the last search (m if none)
+	uint_least64_t bits;	// Text bits searched since the counters were reset
+	uint_least64_t exits;	// Searches ended before the end of their text
+	uint_least32_t state;	// R2 state of the text, for the trace
+	mpz_t TEXT;		// Current search text
+	mpz_t* R;		// Error table
+	mpz_t* R0;		// Initial error table
+	mpz_t tmp1, tmp2, tmp3, oldR;	// Row temporaries
+	struct SEARCHCTX* next;	// Next idle context of a plan
+};
+
+struct RANGE {
+	uint_least64_t from;	// First state of the range
+	uint_least64_t to;		// One past the last state
+};
+
+struct WSDEQUE {
+	struct RANGE* buf;		// Ranges owned by the worker
+	atomic_long top;		// Steal end
+	atomic_long bottom;		// Owner end
+};
+
+struct POOL {
+	int workers;			// Number of workers
+	struct WSDEQUE* D;		// One deque per worker
+	void (*fn)( void*, int, uint_least64_t, uint_least64_t );	// Range handler
+	void* arg;				// Handler argument
+};
+
+struct STAGEONE {
+	struct ATTACK* A;			// Attack shared by all workers
+	struct SEARCHCTX** S;		// Search context per worker
+	struct CANDIDATE** C;		// Candidate buffer per worker
+	uint_least64_t* ct;			// Candidates per worker
+	uint_least64_t* cap;		// Buffer capacity per worker
+	struct brm_metrics* W;		// Search CPU time and counters per worker
+};
+
+struct TIMER {
+	double wall;				// Wall clock at the start of a phase
+	double cpu;					// Thread CPU time at the start
+	uint64_t perf[BRM_PERF_EVENTS];	// Hardware counters at the start
+	uint32_t events;			// Counters that could be read
+	uint64_t allocs;			// GMP allocations of the thread at the start
+	uint64_t bytes;				// and their bytes
+	int64_t live;				// Live GMP bytes of the thread at the start
+	int64_t peak;				// Peak of an enclosing phase, restored at the stop
+};
+
+struct TRACERING {
+	struct brm_event* ev;		// Last TRACESIZE events of the thread
+	uint64_t count;				// Events recorded, the ring holds the last ones
+	uint32_t thread;			// Number of the thread in the trace
+	struct TRACERING* next;		// Next ring of a live thread
+};
+
+struct PERFTHREAD {
+	int fd[BRM_PERF_EVENTS];	// Counter per event of the thread, -1 if unavailable
+};
+
+struct STAGETWO {
+	struct ATTACK* A;			// Attack shared by all workers
+	uint_least64_t* X;			// Candidate outputs as bit arrays
+	uint_least64_t* T;			// Keystream the candidates must reproduce
+	int words;					// Words per candidate output
+	uint_least64_t max;			// Number of R1 states (2^deg)
+	uint_least64_t pol;			// Feedback polynomial
+	atomic_uint_least64_t best;	// Lowest matching (candidate, R1) item
+	atomic_uint_least64_t tried;	// (candidate, R1) items tested
+	struct brm_metrics* W;		// CPU time and counters per worker
+};
+
+struct CHECKPOINT {
+	int stage;					// 1: stage one, 2: stage two
+	int deg;					// Run the checkpoint belongs to
+	int m;
+	int k;
+	int R1;
+	int R2;
+	int mode;
+	uint64_t from;				// Part of the sweep, stage two: 0 and the number of candidates
+	uint64_t to;
+	uint64_t cursor;			// Everything before it is done
+	double runtime;				// Wall time of the runs so far
+	struct brm_metrics M;		// Metrics of the runs so far
+	uint64_t entries;			// Candidates so far, stage two: the key pair if found
+	int* states;
+	int* scores;
+};
+
 //-----------------------------------------------------------------------------
 // FUNCTION DECLARATIONs
 //-----------------------------------------------------------------------------
@@ -69,195 +247,569 @@ mpz_t* genError(int, int);  						   	//Gen init error table
 void genPrefixes( mpz_t*, mpz_t, int );				//Generate the prefixes
 void genEncrypt( mpz_t, mpz_t, mpz_t, mpz_t, int );	        //Encrypt the plaintext
 void mpz_lshift( mpz_t, int );					//Left shift bin seq by 1
-int match_R1( struct CANDIDATE*, struct CANDIDATE*, mpz_t*, mpz_t, mpz_t, mpz_t, int, int);			//Exact match for the output of genEncrypt
+int match_R1( struct ATTACK*, struct CANDIDATE*, uint_least64_t, int*, int* );	//Exact match for the output of genEncrypt
 char* pb( mpz_t, int, int );					//Print prepending zeros
+int attack_init( struct ATTACK*, int, int, int, int, int );	//Create target cipher and prefixes
+void attack_clear( struct ATTACK* );			//Free the attack
+int search_state( struct ATTACK*, uint_least64_t, struct SEARCHCTX* );	//Stage one test of one R2 state
+uint_least64_t stage_one( struct ATTACK*, struct CANDIDATE**, int* );	//Sequential stage one sweep
+uint_least64_t stage_one_parallel( struct ATTACK*, int, uint_least64_t, uint_least64_t, struct CANDIDATE**, int* );	//Multithreaded stage one sweep
+void ctx_init( struct SEARCHCTX*, int, int, int );	//Per-worker search context
+void ctx_clear( struct SEARCHCTX* );
+int ctx_search( struct SEARCHCTX*, mpz_t*, int );	//ARBP search on the context text
+void pool_run( int, uint_least64_t, uint_least64_t, uint_least64_t,
+	void (*)( void*, int, uint_least64_t, uint_least64_t ), void* );	//Work-stealing range pool
+int brm_workers( int );							//Default worker count
+uint_least64_t stage_one_arcs( struct ATTACK*, int, uint_least64_t, uint_least64_t, struct CANDIDATE**, int* );	//Stage one streaming over arcs
+int ctx_stream( struct SEARCHCTX*, mpz_t*, const uint_least64_t*, uint_least64_t, uint_least32_t* );	//ARBP search over a stream
+uint_least64_t lfsr_next( uint_least64_t, uint_least64_t, int, int* );	//Native LFSR step
+uint_least64_t lfsr_jump( uint_least64_t, uint_least64_t, int, uint_least64_t );	//Jump ahead
+void bits_window( mpz_t, const uint_least64_t*, uint_least64_t, int );	//Bit array window to mpz
+int match_candidate( struct ATTACK*, struct CANDIDATE*, atomic_uint_least64_t* );	//Stage two test of one candidate
+int stage_two_parallel( struct ATTACK*, int, struct CANDIDATE*, uint_least64_t, int*, int* );	//Stage two on a pool
+int cq_init( struct CQUEUE*, size_t );			//Bounded MPMC candidate queue
+int cq_push( struct CQUEUE*, struct CANDIDATE* );
+int cq_pop( struct CQUEUE*, struct CANDIDATE* );
+void cq_clear( struct CQUEUE* );
+struct SEARCHCTX* ctx_get( struct ATTACK* );	//Search context for the attack
+void ctx_put( struct ATTACK*, struct SEARCHCTX* );
+int brm_polynomial( int, uint_least64_t* );		//Feedback polynomial of a degree
+struct POLY* poly_get( int );					//Shared polynomial tables
+void poly_put( struct POLY* );
+int plan_attack( struct brm_plan*, int, int, struct ATTACK*, struct brm_metrics* );	//Attack view of a plan
+double brm_clock( void );						//Wall clock in seconds
+double brm_cpu( void );							//CPU time of the thread in seconds
+void timer_start( struct TIMER* );				//Phase timers
+void timer_stop( struct TIMER*, struct brm_metrics*, int );
+void metrics_add( struct brm_metrics*, const struct brm_metrics* );	//Add all phases and counters
+void metrics_workers( struct brm_metrics*, struct brm_metrics*, int );	//Merge per-worker metrics
+uint32_t perf_read( uint64_t* );				//Hardware counters of the thread
+void trace_event( int, uint_least32_t, uint_least64_t, int );	//Record an event of the thread
+
+//-----------------------------------------------------------------------------
+// TRACING
+// Event sites cost one relaxed load while no trace runs, and nothing at all
+// when built without BRM_TRACE.
+//-----------------------------------------------------------------------------
+#if defined BRM_TRACE
+static atomic_int TRACING = 0;					//A trace is being recorded
+#define TRACE_ON()		atomic_load_explicit( &TRACING, memory_order_relaxed )
+#define TRACE( type, state, pos, level )	do{ if( TRACE_ON() ) trace_event( type, state, pos, level ); }while( 0 )
+#else
+#define TRACE_ON()		0
+#define TRACE( type, state, pos, level )	do{ }while( 0 )
+#endif
+
+//-----------------------------------------------------------------------------
+// KERNELS
+// Hot loops on native words, compiled once per instruction set tier and
+// bound at load time to the best one the CPU has (see DISPATCH).
+//-----------------------------------------------------------------------------
+struct KERNELS {
+	const char* name;		// Tier, BRM_ISA names it
+	void (*window)( uint_least64_t*, const uint_least64_t*, int, int );	// Words of a bit window, see bits_window()
+	int (*decimate)( const uint_least64_t*, uint_least64_t, const uint_least64_t*, const uint_least64_t*, int );	// Stage two match on the period sequence
+	uint_least64_t (*and_count)( uint_least64_t*, const uint_least64_t*, uint_least64_t );	// acc &= win, bits left
+};
+static const struct KERNELS* KERNEL;			//Bound tier
+
+//-----------------------------------------------------------------------------
+// GMP ARENA
+// Counters of the GMP memory of the calling thread while brm_arena() is on,
+// read by the phase timers.
+//-----------------------------------------------------------------------------
+static _Thread_local uint64_t ARENAALLOCS = 0;	//Allocations and reallocations
+static _Thread_local uint64_t ARENABYTES = 0;	//Bytes asked for
+static _Thread_local int64_t ARENALIVE = 0;		//Allocated minus freed by the thread, may go negative
+static _Thread_local int64_t ARENAPEAK = 0;		//Highest ARENALIVE since the innermost timer started
+void ctx_account( struct SEARCHCTX*, struct brm_metrics* );	//Search counters into metrics
+void plan_account( struct brm_plan*, const struct brm_metrics* );	//Run into the plan totals
+int stage_one_run( struct brm_plan*, int, int, int, int, uint64_t, uint64_t, struct brm_result* );	//Uncached stage one
+int cache_get( struct brm_plan*, int, int, int, uint64_t, uint64_t, struct brm_result* );	//Result cache lookup
+void cache_put( struct brm_plan*, int, int, int, uint64_t, uint64_t, const struct brm_result* );
 
 //-----------------------------------------------------------------------------
 //	MAIN FUNCTION
 //-----------------------------------------------------------------------------
 int brm(int deg, int m, int slen, int CLKSTATE, int SSTATE){
-	// Variable initialization
-	int n;
-	int CSTATE;
-	char* FNAME;
-	mpz_t PLAINTEXT;
-	mpz_t max;
-	mpz_t pol;
-
 	//-----------------------------------------------------------------------------
 	// We start by creating the target cryptosystem and generating the ciphertext.
 	// After the ciphertext has been created we forget the initial variables. 
+	//
+	// One-shot wrapper of the plan interface; callers running many (m, k) on
+	// the same key pair should keep a plan instead.
+	//-----------------------------------------------------------------------------
+	brm_plan* plan = brm_plan_create(deg, CLKSTATE, SSTATE, m);
+	if( plan == NULL ){
+		printf("Invalid polynomial degree\n");
+		return -1;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Step ONE: Generate prefixes and run ARBP search and choose candidates for R2
+	// Candidates are written to file in the form:
+	// <initial state>, <R2 undeciamted output sequence of length n>
 	//-----------------------------------------------------------------------------
+	struct brm_result res;
+	brm_plan_stage_one(plan, m, slen, BRM_SWEEP_STATES, 1, &res);
 
-	double runtime = 0.0;
-	clock_t begin = clock();
-	slen = slen + 1 ;							//Allowed errors
-	n	= 2*m;										//Search text length 2m
+	char* FNAME = malloc(60*sizeof(char));				//Filename allocation
+	sprintf(FNAME, "./data/%d_%d_%d_%d_%d_candidates.log", deg, m, slen, CLKSTATE, SSTATE);
+	brm_plan_write(plan, m, &res, FNAME);
+	free( FNAME );
 
-	FNAME = malloc(60*sizeof(char));					//Filename allocation
-	sprintf(FNAME, "./data/%d_%d_%d_%d_%d_candidates.log", deg, m, slen-1, CLKSTATE, SSTATE);
-	
-	mpz_init( max );
-	mpz_setbit(max, deg);								//Set max val, eg 2048 in 2^11
-	
-	mpz_init( pol );
-	char* t = pb(pol,deg, 0);							//Char array for padding bits
-	
-	if( deg == 11 ){									//Set polynomial based on degree
-		mpz_set_ui(pol, 1209);							//2^11 irreducible polynomial
+	//-----------------------------------------------------------------------------
+	// Step TWO: For every candidate in C
+	// 1. Decimate its output and encrypt (add noise)
+	// 2. Compare the ciphertext against the target cipher.
+	//
+	// The pipelined mode (brm_plan_pipeline) overlaps step one and two.
+	//-----------------------------------------------------------------------------
+
+	int found = res.found;
+	brm_result_clear( &res );
+	brm_plan_destroy( plan );
+
+	if (found==1) { 											//Determine if the actual initial state was included in the chosen set
+		return 0;
 	} 
-	else if( deg == 16 ){								
-		mpz_set_ui(pol, 33262);							//2^16 irreducible polynomial
+	else {
+	 	return 1;
 	}
-	else{
-		printf("Invalid polynomial degree\n");
-		return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Create the target cryptosystem for an attack.
+ *	Generates R1 and R2 from their initial states, enciphers the plaintext and
+ *	builds the prefixes of the resulting ciphertext. Returns 1 if there is no
+ *	polynomial for the degree.
+-----------------------------------------------------------------------------*/
+int attack_init( struct ATTACK* A, int deg, int m, int k, int CLKSTATE, int SSTATE ){
+	A->deg = deg;
+	A->m = m;
+	A->n = 2*m;											//Search text length 2m
+	A->slen = k + 1;									//Allowed errors
+	A->CLKSTATE = CLKSTATE;
+	A->SSTATE = SSTATE;
+
+	A->seq = NULL;
+	A->idx = NULL;
+	A->plan = NULL;
+	A->metrics = NULL;
+
+	uint_least64_t p;
+	if( brm_polynomial(deg, &p) != 0 ){
+		return 1;
 	}
+	mpz_init( A->pol );
+	mpz_set_ui( A->pol, p );
+
+	mpz_init( A->max );
+	mpz_setbit(A->max, deg);							//Set max val, eg 2048 in 2^11
 
-	mpz_init(PLAINTEXT);	
-	mpz_set_ui(PLAINTEXT, 0);							//Default value is 0
+	mpz_init(A->PLAINTEXT);	
+	mpz_set_ui(A->PLAINTEXT, 0);						//Default value is 0
 
-	mpz_t*	B	= genAlphabet( ALPHASIZE );				//Generate alphabet
+	A->B = genAlphabet( ALPHASIZE );					//Generate alphabet
 
 	mpz_t LCLK;		mpz_init(LCLK);						//LFSR for dessimating
-	lfsrgen(LCLK, deg, m, pol, CLKSTATE, 0, NULL);		//Clocking LFSR
+	lfsrgen(LCLK, deg, m, A->pol, CLKSTATE, 0, NULL);	//Clocking LFSR
 
 	mpz_t LDES;		mpz_init(LDES);						//LFSR to be dessimated
-	lfsrgen(LDES, deg, n, pol, SSTATE, 0, NULL);		//Dessimated LFSR
+	lfsrgen(LDES, deg, A->n, A->pol, SSTATE, 0, NULL);	//Dessimated LFSR
 
-	mpz_t CIPHER;	mpz_init( CIPHER );					//Gen intercepted ciphertext
-	genEncrypt(	CIPHER, LCLK, LDES, PLAINTEXT, m);
+	mpz_init( A->CIPHER );								//Gen intercepted ciphertext
+	genEncrypt(	A->CIPHER, LCLK, LDES, A->PLAINTEXT, m);
 
 	mpz_clear( LCLK );									//Cleanup LFSRs
 	mpz_clear( LDES );
 
-	//-----------------------------------------------------------------------------
-	// At this point, the target (CIPHER) has been created. 
-	// The known-plaintext attack starts here.
-	// TODO; Separate this from main function to enable multithreading.
-	//
-	// Step ONE: Generate prefixes and run ARBP search and choose candidates for R2
-	// Candidates are stored in an array in memory in the form:
-	// <initial state>, <R2 undeciamted output sequence of length n>
-	//-----------------------------------------------------------------------------
+	genPrefixes(A->B, A->CIPHER, m);					//Generate prefixes for the alphabet
+	return 0;
+}
 
-	genPrefixes(B, CIPHER, m);							//Generate prefixes for the alphabet
+/*-----------------------------------------------------------------------------
+ * Free the variables of an attack
+-----------------------------------------------------------------------------*/
+void attack_clear( struct ATTACK* A ){
+	mpz_clear( A->pol );
+	mpz_clear( A->max );
+	mpz_clear( A->PLAINTEXT );
+	mpz_clear( A->CIPHER );
+	mpz_clear( A->B[0] );
+	mpz_clear( A->B[1] );
+	free( A->B );
+}
 
-	mpz_t tmp;		
-	mpz_init( tmp );									// Geneate tmp variable
+/*-----------------------------------------------------------------------------
+ * Stage one test of a single R2 initial state.
+ *	Generates the undecimated sequence into the context text and runs the
+ *	ARBP search on it. Returns 1 if any position matched within the allowed
+ *	errors; the search stops at the first such position.
+-----------------------------------------------------------------------------*/
+int search_state( struct ATTACK* A, uint_least64_t state, struct SEARCHCTX* S ){
+	if( A->seq != NULL ){								// Cut TEXT from the period sequence
+		bits_window( S->TEXT, A->seq, A->idx[state], A->n );
+	}
+	else{
+		lfsrgen( S->TEXT, A->deg, A->n, A->pol, state, 0, NULL );	// Generate undecimated bitseq TEXT for current initial state
+	}
+	S->state = state;
+	#if defined BRM_TRACE
+	uint_least64_t bits = S->bits;						//Bits searched before this state
+	#endif
+	TRACE( BRM_EV_STATE_START, state, 0, 0 );
+	int ret = ctx_search( S, A->B, 1 ) > 0;
+	TRACE( BRM_EV_STATE_END, state, S->bits - bits, ret );
+	return ret;
+}
 
-	mpz_t TEXT; 										// This variable stores the current search text
-	mpz_init(TEXT);
-	
-	uint_least64_t i = 1;								// initial state counter.
-	uint_least64_t ci = 0;								// Candidate indicator.
-	uint_least64_t ct = 0;								// Total candidate counter.
-	int found = 0;										// Indicator to show if the actual intial state was added to the set
+/*-----------------------------------------------------------------------------
+ * Sequential stage one.
+ *	Iterates through all initial states of R2 and stores the candidates in a
+ *	new array. Sets found if the actual initial state is among them and
+ *	returns the number of candidates.
+-----------------------------------------------------------------------------*/
+uint_least64_t stage_one( struct ATTACK* A, struct CANDIDATE** C, int* found ){
+	return stage_one_parallel( A, 1, 1, mpz_get_ui(A->max), C, found );
+}
 
-	struct CANDIDATE* C = malloc( mpz_get_ui(max) * sizeof(struct CANDIDATE) );
+/*-----------------------------------------------------------------------------
+ * Append a candidate to the buffer of worker w
+-----------------------------------------------------------------------------*/
+static void stage_one_add( struct STAGEONE* O, int w, uint_least64_t state, mpz_t X ){
+	if( O->ct[w] == O->cap[w] ){
+		O->cap[w] = O->cap[w] ? 2*O->cap[w] : 64;
+		O->C[w] = realloc( O->C[w], O->cap[w] * sizeof(struct CANDIDATE) );
+	}
+	O->C[w][O->ct[w]].istate = state;
+	mpz_init_set( O->C[w][O->ct[w]].X, X );
+	O->ct[w]++;
+	TRACE( BRM_EV_CANDIDATE, state, 0, 0 );
+}
 
-	FILE* fh = fopen(FNAME, "w");						// Open output file for writing
+/*-----------------------------------------------------------------------------
+ * Stage one handler for a range of R2 states.
+ *	Runs on worker w with its own search context and appends candidates to
+ *	its own buffer, so workers never share anything but the attack.
+-----------------------------------------------------------------------------*/
+static void stage_one_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct STAGEONE* O = arg;
+	struct TIMER T;
+	timer_start( &T );
+	uint_least64_t i = from;
+	while( i < to ){
+		if( search_state(O->A, i, O->S[w]) ){			//If matches exist, add state to the worker buffer
+			stage_one_add( O, w, i, O->S[w]->TEXT );
+		}
+		i++;											//Next initial state
+	}
+	timer_stop( &T, &O->W[w], BRM_PHASE_SEARCH );
+}
 
-	while( mpz_cmp_ui( max, i ) > 0 ){					// Iterate through all initial states of R2
-		CSTATE = i;										// Current state
-		mpz_set_ui( tmp, i);							// For binary display
+static int cmp_candidate( const void* a, const void* b ){
+	const struct CANDIDATE* x = a;
+	const struct CANDIDATE* y = b;
+	return (x->istate > y->istate) - (x->istate < y->istate);
+}
 
-		//lfsrgen( TEXT, deg, n, pol, i, 1, B );		// Generate undecimated bitseq TEXT for current initial state
-		lfsrgen( TEXT, deg, n, pol, i, 0, NULL );		// Generate undecimated bitseq TEXT for current initial state
+/*-----------------------------------------------------------------------------
+ * Create the per-worker search contexts and candidate buffers
+-----------------------------------------------------------------------------*/
+static void stage_one_begin( struct STAGEONE* O, struct ATTACK* A, int workers ){
+	O->A = A;
+	O->S = malloc( workers * sizeof(struct SEARCHCTX*) );
+	O->C = calloc( workers, sizeof(struct CANDIDATE*) );
+	O->ct = calloc( workers, sizeof(uint_least64_t) );
+	O->cap = calloc( workers, sizeof(uint_least64_t) );
+	O->W = calloc( workers, sizeof(struct brm_metrics) );
+	int w = 0;
+	while( w < workers ){
+		O->S[w] = ctx_get( A );
+		O->S[w]->bits = 0;
+		O->S[w]->exits = 0;
+		w++;
+	}
+}
 
-		mpz_t*	MATCH = arbp_search(B, TEXT, slen, m, n);			// Run the ARBP search on TEXT with slen errors allowed and return matches with CLD and position. 
-														// TODO; Pass TEXT variable instead of global var. For scalability.
-		int j = 0;
-		while(j < n){											//For each position
-			if( mpz_cmp_ui(MATCH[j], m) < 0 ){					//If match is less than m
-				// if( k > 0 && (k%15)==0 ){					//Decoration of stdout
-				// 	printf("\n\t");
-					
-				// }
-				// printf( "\t%d:", j); mpz_out_str(stdout, 10, MATCH[j] );
-				// fprintf( fh, " %d:", j);	mpz_out_str( fh, 10, MATCH[j] );
-				mpz_clear( MATCH[j] );
-				// k++;
-				ci++;											//increment counter for print
-			}
-			j++;												//Next position
-		}
-		if (ci > 0) {											//If matches exist, add state to Candidate matrix.
-			if ( CSTATE == SSTATE ) {							//Indicate that actual init state was added as candidate.
-				found = 1;	
-			}
-			C[ct].istate = CSTATE;
-			mpz_init(C[ct].X); mpz_set(C[ct].X, TEXT);
-			ct++;
-			ci = 0;
-		}
-		else {													//No CLD within error limit found.
-			C[ct].istate = 0;
+/*-----------------------------------------------------------------------------
+ * Merge the per-worker candidate buffers into one array ordered by state
+ *	and free the workers. Sets found if the actual initial state is among
+ *	the candidates and returns their number.
+-----------------------------------------------------------------------------*/
+static uint_least64_t stage_one_end( struct STAGEONE* O, int workers, struct CANDIDATE** C, int* found ){
+	struct TIMER T;
+	timer_start( &T );
+	uint_least64_t ct = 0;								// Total candidate counter.
+	int w = 0;
+	while( w < workers ){
+		ct += O->ct[w];
+		ctx_account( O->S[w], O->A->metrics );
+		w++;
+	}
+	metrics_workers( O->A->metrics, O->W, workers );
+	*C = malloc( (ct ? ct : 1) * sizeof(struct CANDIDATE) );
+	*found = 0;
+	uint_least64_t u = 0;
+	w = 0;
+	while( w < workers ){								//Merge the worker buffers
+		memcpy( *C + u, O->C[w], O->ct[w] * sizeof(struct CANDIDATE) );
+		u += O->ct[w];
+		free( O->C[w] );
+		ctx_put( O->A, O->S[w] );
+		w++;
+	}
+	qsort( *C, ct, sizeof(struct CANDIDATE), cmp_candidate );
+	u = 0;
+	while( u < ct ){
+		if( (*C)[u].istate == O->A->SSTATE ){			//Indicate that actual init state was added as candidate.
+			*found = 1;
 		}
+		u++;
+	}
+	free( O->S );	free( O->C );	free( O->ct );	free( O->cap );	free( O->W );
+	timer_stop( &T, O->A->metrics, BRM_PHASE_STORE );
+	return ct;
+}
 
-		i++;													//Next initial state
-		free(MATCH);
+/*-----------------------------------------------------------------------------
+ * Multithreaded stage one over the R2 states [from, to).
+ *	Splits the states over the work-stealing pool and merges the per worker
+ *	candidate buffers into one array ordered by state, the same result
+ *	stage_one() gives for [1, 2^deg). workers defaults to the number of cores.
+-----------------------------------------------------------------------------*/
+uint_least64_t stage_one_parallel( struct ATTACK* A, int workers, uint_least64_t from, uint_least64_t to,
+		struct CANDIDATE** C, int* found ){
+	struct STAGEONE O;
+	workers = brm_workers( workers );
+
+	stage_one_begin( &O, A, workers );
+	uint_least64_t chunk = to > from ? (to - from) / (16*workers) : 1;	//Enough chunks per worker to balance
+	if( chunk > 256 )	chunk = 256;
+	if( chunk < 1 )		chunk = 1;
+	double wall = brm_clock();
+	pool_run( workers, from, to, chunk, stage_one_range, &O );
+	if( A->metrics != NULL ){
+		A->metrics->wall[BRM_PHASE_SEARCH] += brm_clock() - wall;
+		A->metrics->states += to > from ? to - from : 0;
 	}
+	return stage_one_end( &O, workers, C, found );
+}
 
-	int u=0;
-	struct CANDIDATE* ptr = C;
-	struct CANDIDATE* endPtr = C + (sizeof(*C)/sizeof(struct CANDIDATE) * mpz_get_ui(max));
-	while ( ptr < endPtr ) { // Iterate through all candidates
-		if (ptr->istate == 0){
-			break;
+/*-----------------------------------------------------------------------------
+ * Stage one handler for an arc of the LFSR cycle.
+ *	from/to are offsets on the cycle counted from state 1. The arc is
+ *	generated as one stream, with n extra bits so the windows of the last
+ *	states are complete, and searched in a single pass.
+ *
+ *	Rows of the stream search are never reset, so they hold every match a
+ *	window search starting inside the stream would find and possibly more.
+ *	A state p is therefore rejected if the stream has no match in its
+ *	window [p, p+n), and accepted if there is one ending at or after
+ *	p+m+K-1, since no alignment with K-1 errors spans more than m+K-1 bits.
+ *	Only states whose matches all end earlier are searched on their own.
+-----------------------------------------------------------------------------*/
+static void stage_one_arc( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct STAGEONE* O = arg;
+	struct ATTACK* A = O->A;
+	struct SEARCHCTX* S = O->S[w];
+	struct TIMER T;
+	timer_start( &T );
+	int n = A->n;
+	uint_least64_t len = to - from;
+	uint_least64_t slen = len + n;						//Stream length with overlap
+	uint_least64_t pol = mpz_get_ui( A->pol );
+
+	uint_least64_t* bits = calloc( slen/64 + 2, sizeof(uint_least64_t) );
+	uint_least64_t* states = malloc( len * sizeof(uint_least64_t) );
+	uint_least64_t state = lfsr_jump( 1, pol, A->deg, from );	//Seed by advancing the initial state
+	uint_least64_t i = 0;
+	while( i < slen ){									//Generate the arc
+		if( i < len ){
+			states[i] = state;
 		}
-		fprintf(fh, "\n%i,", ptr->istate); mpz_out_str(fh, 2, ptr->X);
-		u++;
-		ptr++;
+		int b;
+		state = lfsr_next( state, pol, A->deg, &b );
+		if( b ){
+			bits[i >> 6] |= (uint_least64_t)1 << (i & 63);
+		}
+		i++;
 	}
-	fclose( fh );												//Close data file
 
-	clock_t end = clock();										//Stop runtime timer
-	runtime += (double)(end - begin) / CLOCKS_PER_SEC;
-	//printf("\nRuntime: %f seconds", runtime);	
-	//printf("\nFound %"PRIu64" candidates\n", ct);
-	
+	uint_least32_t* next = malloc( (slen+1) * sizeof(uint_least32_t) );
+	ctx_stream( S, A->B, bits, slen, next );			//Next match at or after each position
 
+	uint_least64_t safe = A->m + A->slen - 1;			//Longest alignment within K-1 errors
+	i = 0;
+	while( i < len ){
+		if( next[i] >= i + n ){							//No match in the window
+			i++;
+			continue;
+		}
+		bits_window( S->TEXT, bits, i, n );
+		S->state = states[i];
+		if( (safe >= (uint_least64_t)n || next[i+safe] >= i + n) && ctx_search(S, A->B, 1) == 0 ){
+			i++;										//Only early matches, and none within the window
+			continue;
+		}
+		stage_one_add( O, w, states[i], S->TEXT );
+		i++;
+	}
+	free( next );
+	free( states );
+	free( bits );
+	timer_stop( &T, &O->W[w], BRM_PHASE_SEARCH );
+}
 
-	//-----------------------------------------------------------------------------
-	// At this point we have created the set of candidates C.
-	// The candidates persist in memory and has been written to file.
-	//
-	// Step TWO: For every candidate in C
-	// 1. Decimate its output and encrypt (add noise)
-	// 2. Compare the ciphertext against the target cipher.
-	//
-	// TODO; The whole string doesn't need to be compared. The bits can be compared
-	// iteratively or in lesser blocks (e.g. 8 bits) to eliminate non-matches quicker
-	//-----------------------------------------------------------------------------
+/*-----------------------------------------------------------------------------
+ * Multithreaded stage one streaming over arcs of the LFSR cycle.
+ *	All R2 states lie on one cycle of length 2^deg - 1, so the cycle is cut
+ *	into contiguous arcs, a few per worker, each seeded by a jump ahead from
+ *	state 1. from/to select a part of the cycle by offset from state 1;
+ *	[0, 2^deg - 1) gives the same result as stage_one(). Needs a primitive
+ *	polynomial.
+-----------------------------------------------------------------------------*/
+uint_least64_t stage_one_arcs( struct ATTACK* A, int workers, uint_least64_t from, uint_least64_t to,
+		struct CANDIDATE** C, int* found ){
+	struct STAGEONE O;
+	workers = brm_workers( workers );
+	uint_least64_t len = to > from ? to - from : 0;
+
+	stage_one_begin( &O, A, workers );
+	uint_least64_t chunk = (len + 4*workers - 1) / (4*workers);	//Few long arcs per worker
+	if( chunk < 16 * (uint_least64_t)A->n )	chunk = 16 * A->n;	//Keep the overlap small
+	double wall = brm_clock();
+	pool_run( workers, from, to, chunk, stage_one_arc, &O );
+	if( A->metrics != NULL ){
+		A->metrics->wall[BRM_PHASE_SEARCH] += brm_clock() - wall;
+		A->metrics->states += len;
+	}
+	return stage_one_end( &O, workers, C, found );
+}
+
+/*-----------------------------------------------------------------------------
+ * Native LFSR step, same output and next state as lfsr_iterate() for
+ *	polynomials of degree below 64. The output bit is stored in out.
+-----------------------------------------------------------------------------*/
+uint_least64_t lfsr_next( uint_least64_t state, uint_least64_t pol, int deg, int* out ){
+	*out = (state >> (deg-1)) & 1;						//Output is the MSB
+	uint_least64_t fbck = __builtin_parityll( state & pol );	//XOR of the tapped bits
+	return ((state << 1) | fbck) & (((uint_least64_t)1 << deg) - 1);
+}
 
-	//match_R1(C, endPtr, &CIPHER, PLAINTEXT, max, m, deg);
+/*-----------------------------------------------------------------------------
+ * Apply a GF(2) matrix, given by the images of the unit vectors, to v
+-----------------------------------------------------------------------------*/
+static uint_least64_t gf2_apply( const uint_least64_t* M, int deg, uint_least64_t v ){
+	uint_least64_t r = 0;
+	int i = 0;
+	while( i < deg ){
+		if( (v >> i) & 1 ){
+			r ^= M[i];
+		}
+		i++;
+	}
+	return r;
+}
 
-	// printf("\n");
+/*-----------------------------------------------------------------------------
+ * Advance an LFSR state by steps iterations.
+ *	The step is linear over GF(2), so the state is multiplied with the
+ *	steps-th power of the step matrix, found by repeated squaring.
+-----------------------------------------------------------------------------*/
+uint_least64_t lfsr_jump( uint_least64_t state, uint_least64_t pol, int deg, uint_least64_t steps ){
+	uint_least64_t M[64], T[64];
+	int i = 0;
+	int b;
+	while( i < deg ){									//Step matrix
+		M[i] = lfsr_next( (uint_least64_t)1 << i, pol, deg, &b );
+		i++;
+	}
+	while( steps > 0 ){
+		if( steps & 1 ){
+			state = gf2_apply( M, deg, state );
+		}
+		i = 0;
+		while( i < deg ){								//Square the matrix
+			T[i] = gf2_apply( M, deg, M[i] );
+			i++;
+		}
+		memcpy( M, T, deg * sizeof(uint_least64_t) );
+		steps >>= 1;
+	}
+	return state;
+}
 
-	// mpz_clear( TEXT );											//Clear variables
-	// mpz_clear( PLAINTEXT );
-	// mpz_clear( CIPHER );
-	// mpz_clear( B[0] );
-	// mpz_clear( B[1] );
+/*-----------------------------------------------------------------------------
+ * Copy the n bits of a bit array starting at pos into rop
+-----------------------------------------------------------------------------*/
+void bits_window( mpz_t rop, const uint_least64_t* bits, uint_least64_t pos, int n ){
+	int words = (n + 63) / 64;
+	uint_least64_t W[words];
+	KERNEL->window( W, bits + (pos >> 6), pos & 63, words );
+	if( n & 63 ){
+		W[words-1] &= ((uint_least64_t)1 << (n & 63)) - 1;
+	}
+	mpz_import( rop, words, -1, sizeof(uint_least64_t), 0, 0, W );
+}
 
-	// free( B );	
-												//Free up memory
-	// end = clock();												//Stop runtime timer
-	// runtime += (double)(end - begin) / CLOCKS_PER_SEC;
-	// printf("\nRuntime: %f seconds\n", runtime);
+/*-----------------------------------------------------------------------------
+ * Worker count, the number of online cores unless requested otherwise
+-----------------------------------------------------------------------------*/
+int brm_workers( int workers ){
+	if( workers > 0 ){
+		return workers;
+	}
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	return cores > 0 ? (int)cores : 1;
+}
 
-	if (found==1) { 											//Determine if the actual initial state was included in the chosen set
-	 	//printf("The actual initial state (%i) is within the set\n", SSTATE);
-		return 0;
-	} 
-	else {
-	// 	printf("The actual initial state (%i) is NOT within the set\n", SSTATE);
-	 	return 1;
+/*-----------------------------------------------------------------------------
+ * Create a search context for m-length words, n-length texts and K rows.
+ *	The context keeps the text, the error table and all row temporaries so
+ *	that a worker can search state after state without allocating.
+-----------------------------------------------------------------------------*/
+void ctx_init( struct SEARCHCTX* S, int m, int n, int K ){
+	S->m = m;
+	S->n = n;
+	S->K = K;
+	S->best = m;
+	S->bits = 0;
+	S->exits = 0;
+	mpz_init2( S->TEXT, n );
+	S->R0 = genError( K, m );							//Gen error-table
+	S->R = malloc( K*sizeof(mpz_t) );
+	int k = 0;
+	while( k < K ){
+		mpz_init2( S->R[k], m+1 );
+		k++;
 	}
-	exit(0);
+	mpz_init2( S->tmp1, m+1 );
+	mpz_init2( S->tmp2, m+1 );
+	mpz_init2( S->tmp3, m+1 );
+	mpz_init2( S->oldR, m+1 );
+	S->next = NULL;
 }
 
+/*-----------------------------------------------------------------------------
+ * Free a search context
+-----------------------------------------------------------------------------*/
+void ctx_clear( struct SEARCHCTX* S ){
+	int k = 0;
+	while( k < S->K ){
+		mpz_clear( S->R[k] );
+		mpz_clear( S->R0[k] );
+		k++;
+	}
+	free( S->R );
+	free( S->R0 );
+	mpz_clear( S->TEXT );
+	mpz_clear( S->tmp1 );
+	mpz_clear( S->tmp2 );
+	mpz_clear( S->tmp3 );
+	mpz_clear( S->oldR );
+}
 
 /**############################################################################
  **
@@ -818,60 +1370,4344 @@ mpz_t* arbp_search(mpz_t* B, mpz_t TEXT, int K, int m, int n) {
 	//#endif
 }
 
-int match_R1( struct CANDIDATE* candidates, struct CANDIDATE* endCandidates, mpz_t* tgt_cipher, mpz_t PLAINTEXT, mpz_t max, mpz_t pol, int m, int deg) {
-	printf("Cracking...");
-	mpz_t LDES; mpz_init(LDES);
-	mpz_t LCLK;	mpz_init(LCLK);						//LFSR for dessimating
-	mpz_t CIPHER2;	mpz_init( CIPHER2 );			//Gen intercepted ciphertext
-	mpz_init(LDES);
-	mpz_init(LCLK);	
-	mpz_init(CIPHER2);
-
-	while ( candidates < endCandidates ) {
-		if (candidates->istate == 0){
-			break;
-		}
-		//printf("\n%i,", candidates->istate); mpz_out_str(stdout, 2, candidates->X); 
-
+/*-----------------------------------------------------------------------------
+ * Advance the error table of a search context by one text character Ti.
+ *	Same recurrences as arbp_search(), but the rows live in the context and
+ *	are shifted in place, so nothing is allocated per position or row.
+ *	Returns the lowest error level matching at this position, or -1.
+-----------------------------------------------------------------------------*/
+static int ctx_step( struct SEARCHCTX* S, mpz_t* B, int Ti ){
+	int m = S->m;
+	int K = S->K;
 
-		mpz_set(LDES, candidates->X);	// Get the current candidate
-		//x = mpz_get_ui(candidates->istate);
-		//lfsrgen(LDES, deg, n, pol, candidates->istate, 0, NULL);				//Clocking LFSR
+	mpz_set( S->oldR, S->R[0] );						//Init oldR to cur R[0] (R[i])
+	mpz_mul_2exp( S->tmp1, S->R[0], 1 );				//lshift
+	mpz_fdiv_r_2exp( S->tmp1, S->tmp1, m );
+	#if defined SHIFTOR
+		mpz_ior( S->R[0], S->tmp1, B[Ti] );				//OR with B[Ti]
+	#else
+		mpz_setbit( S->tmp1, 0 );						//OR with 1
+		mpz_and( S->R[0], S->tmp1, B[Ti] );				//AND with B[Ti]
+	#endif
 
-		int i = 0;
-		while (i<mpz_get_ui(max)) {
-			#if defined DEBUG
-				printf("Generating clocking LFSR (R1) output sequence: \n");
+	int i = 1;											//Calc matches with K allowed errors
+	while( i < K ){
+		#if defined SHIFTOR
+			mpz_mul_2exp( S->tmp2, S->oldR, 1 );		//tmp2 = oldR << 1, substitution
+			mpz_fdiv_r_2exp( S->tmp2, S->tmp2, m );
+			#if defined INC_INSERT						//Insertion
+				mpz_and( S->tmp2, S->oldR, S->tmp2 );
 			#endif
-	
-			lfsrgen(LCLK, deg, m, pol, i, 0, NULL);				//Clocking LFSR
-			
-			// Perhaps we should save the corresponding CIPHER output from the LDES so we save some time.
-
-			#if defined DEBUG
-				printf("Calculating the Decimated bitsequence and creating ciphertext:\n\n");
+			mpz_mul_2exp( S->tmp1, S->R[i], 1 );		//tmp1 = R[i]<<1
+			mpz_fdiv_r_2exp( S->tmp1, S->tmp1, m );
+			mpz_ior( S->tmp1, S->tmp1, B[Ti] );			//tmp1 = <tmp1> | B[Ti]
+			mpz_and( S->tmp1, S->tmp1, S->tmp2 );		//tmp1 = <tmp1> & <tmp2>
+		#else											// Shift-AND
+			mpz_ior( S->tmp2, S->oldR, S->R[i-1] );		//tmp2 = (oldR|newR)
+			mpz_mul_2exp( S->tmp2, S->tmp2, 1 );		//tmp2 = <tmp2> << 1
+			mpz_fdiv_r_2exp( S->tmp2, S->tmp2, m );
+			mpz_setbit( S->tmp2, 0 );
+			#if defined INC_INSERT						//Insertion
+				mpz_ior( S->tmp2, S->oldR, S->tmp2 );
 			#endif
+			mpz_mul_2exp( S->tmp1, S->R[i], 1 );		//tmp1 = R[i]<<1
+			mpz_fdiv_r_2exp( S->tmp1, S->tmp1, m );
+			mpz_and( S->tmp1, S->tmp1, B[Ti] );			//tmp1 = <tmp1> & B[Ti]
+			mpz_ior( S->tmp1, S->tmp1, S->tmp2 );		//tmp1 = <tmp1> | <tmp2>
+		#endif
+		mpz_swap( S->R[i], S->tmp1 );					//R[i] == R'[i]
+		mpz_swap( S->oldR, S->tmp1 );					//Store R[i] for next error
+		i++;											//Next error
+	}
 
-			genEncrypt(CIPHER2, LCLK, LDES, PLAINTEXT, m);
-			//printf("\n");
-			//mpz_out_str(stdout, 10, CIPHER2); printf(" "); mpz_out_str(stdout, 10, *tgt_cipher );
-			//mpz_out_str(stdout, 10, CIPHER2);
-			if ( mpz_get_ui( CIPHER2 ) == mpz_get_ui( *tgt_cipher ) ) {
-				printf("\nMatch found for R1 init state %i and R2 init state %i", i, candidates->istate);
-				return 0;
-			}
+	#if defined SHIFTOR
+	if( mpz_tstbit(S->R[K-1], m-1) != 0 ){				//Check if R-table has a match
+	#else
+	if( mpz_tstbit(S->R[K-1], m-1) != 1 ){
+	#endif
+		return -1;
+	}
+	int j = 0;
+	#if defined SHIFTOR
+	while( mpz_tstbit(S->R[j], m-1) != 0 ){				//Lowest row with MSB zero
+	#else
+	while( mpz_tstbit(S->R[j], m-1) != 1 ){				//Lowest row with MSB set
+	#endif
+		j++;
+	}
+	return j;
+}
 
-			i++;
+/*-----------------------------------------------------------------------------
+ * Reset the error table of a search context
+-----------------------------------------------------------------------------*/
+static void ctx_reset( struct SEARCHCTX* S ){
+	int k = 0;
+	while( k < S->K ){
+		mpz_set( S->R[k], S->R0[k] );
+		k++;
+	}
+	S->best = S->m;
+}
+
+/*-----------------------------------------------------------------------------
+ * Perform search on the context TEXT and PREFIX.
+ *	Returns the number of matching positions and sets S->best to the lowest
+ *	error level found. With first set the search ends at the first match.
+-----------------------------------------------------------------------------*/
+int ctx_search( struct SEARCHCTX* S, mpz_t* B, int first ){
+	int ct = 0;
+	#if defined BRM_TRACE
+	int tracing = TRACE_ON();							//Once per search
+	int full = 0;
+	#endif
+	ctx_reset( S );
+
+	int pos	= 0;										//Start search from char 1
+	while( pos < S->n ){								//Search entire TEXT
+		int j = ctx_step( S, B, mpz_tstbit(S->TEXT, pos) );
+		#if defined BRM_TRACE
+		if( tracing ){
+			#if defined SHIFTOR
+			int now = mpz_sgn( S->R[S->K-1] ) == 0;		//Top row all zeros
+			#else
+			int now = mpz_popcount( S->R[S->K-1] ) == (mp_bitcnt_t)S->m;	//Top row all ones
+			#endif
+			if( now && !full ){							//Every prefix alive, the row no longer filters
+				trace_event( BRM_EV_SATURATED, S->state, pos, S->K-1 );
+			}
+			full = now;
+			if( j >= 0 ){
+				trace_event( BRM_EV_MATCH, S->state, pos, j );
+			}
+		}
+		#endif
+		if( j >= 0 ){
+			if( j < S->best )	S->best = j;
+			ct++;
+			if( first ){
+				S->bits += pos + 1;
+				S->exits += pos + 1 < S->n;
+				return ct;
+			}
 		}
+		pos += 1;										//Next position in search text
+	}
+	S->bits += S->n;
+	return ct;
+}
 
+/*-----------------------------------------------------------------------------
+ * Perform search over a stream of len bits without resetting in between.
+ *	Fills next[i] with the first matching position at or after i (len if
+ *	there is none), next must hold len+1 entries. Returns the number of
+ *	matching positions.
+-----------------------------------------------------------------------------*/
+int ctx_stream( struct SEARCHCTX* S, mpz_t* B, const uint_least64_t* bits, uint_least64_t len, uint_least32_t* next ){
+	int ct = 0;
+	ctx_reset( S );
+
+	uint_least64_t pos = 0;
+	while( pos < len ){
+		int Ti = (bits[pos >> 6] >> (pos & 63)) & 1;
+		int j = ctx_step( S, B, Ti );
+		next[pos] = j >= 0 ? pos : len;
+		if( j >= 0 ){
+			if( j < S->best )	S->best = j;
+			ct++;
+		}
+		pos++;
+	}
+	next[len] = len;
+	S->bits += len;
+	while( pos > 0 ){									//Propagate the next match backwards
+		pos--;
+		if( next[pos] == len ){
+			next[pos] = next[pos+1];
+		}
+	}
+	return ct;
+}
 
+/*-----------------------------------------------------------------------------
+ * Chase-Lev deque operations on pre-filled range buffers.
+ *	The owner pops from the bottom, thieves take from the top. Nothing is
+ *	pushed once the workers run, so the buffers never grow.
+-----------------------------------------------------------------------------*/
+static int ws_pop( struct WSDEQUE* D, struct RANGE* r ){
+	long b = atomic_load_explicit( &D->bottom, memory_order_relaxed ) - 1;
+	atomic_store_explicit( &D->bottom, b, memory_order_relaxed );
+	atomic_thread_fence( memory_order_seq_cst );
+	long t = atomic_load_explicit( &D->top, memory_order_relaxed );
+	if( t > b ){										//Empty
+		atomic_store_explicit( &D->bottom, b+1, memory_order_relaxed );
+		return 1;
+	}
+	*r = D->buf[b];
+	if( t == b ){										//Last range, race the thieves
+		int won = atomic_compare_exchange_strong_explicit( &D->top, &t, t+1,
+					memory_order_seq_cst, memory_order_relaxed );
+		atomic_store_explicit( &D->bottom, b+1, memory_order_relaxed );
+		return won ? 0 : 1;
+	}
+	return 0;
+}
 
-		candidates++;
+static int ws_steal( struct WSDEQUE* D, struct RANGE* r ){
+	long t = atomic_load_explicit( &D->top, memory_order_acquire );
+	atomic_thread_fence( memory_order_seq_cst );
+	long b = atomic_load_explicit( &D->bottom, memory_order_acquire );
+	if( t >= b ){
+		return 1;										//Empty
+	}
+	*r = D->buf[t];
+	if( !atomic_compare_exchange_strong_explicit( &D->top, &t, t+1,
+			memory_order_seq_cst, memory_order_relaxed ) ){
+		return -1;										//Lost the race, retry
 	}
-	mpz_clear(LCLK);
-	mpz_clear(CIPHER2);
-	mpz_clear(LDES);
+	return 0;
+}
 
-	printf("\nNo match found... exiting.");
+struct POOLWORKER {
+	struct POOL* P;
+	int w;
+};
+
+static void* pool_worker( void* arg ){
+	struct POOLWORKER* W = arg;
+	struct POOL* P = W->P;
+	struct RANGE r;
+	unsigned int seed = W->w * 2654435761u + 1;
+
+	while( 1 ){
+		if( ws_pop(&P->D[W->w], &r) == 0 ){			//Own work first
+			P->fn( P->arg, W->w, r.from, r.to );
+			continue;
+		}
+		int busy = 0;									//Steal from a random victim onwards
+		int v = rand_r( &seed ) % P->workers;
+		int i = 0;
+		while( i < P->workers ){
+			int ret = ws_steal( &P->D[(v+i) % P->workers], &r );
+			if( ret == 0 ){
+				P->fn( P->arg, W->w, r.from, r.to );
+				busy = 1;
+				break;
+			}
+			if( ret < 0 ){
+				busy = 1;								//Contended, look again
+			}
+			i++;
+		}
+		if( !busy ){
+			break;										//Every deque is empty
+		}
+	}
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Run fn over the states [from, to) on a work-stealing pool.
+ *	The range is cut into chunks and dealt to the workers in contiguous
+ *	blocks. A worker that runs out steals chunks from the others, which
+ *	evens out states that terminate early. fn gets the worker index so it
+ *	can keep per-worker state. A single worker runs on the calling thread.
+-----------------------------------------------------------------------------*/
+void pool_run( int workers, uint_least64_t from, uint_least64_t to, uint_least64_t chunk,
+		void (*fn)( void*, int, uint_least64_t, uint_least64_t ), void* arg ){
+	struct POOL P;
+	if( to <= from ){
+		return;
+	}
+	uint_least64_t chunks = (to - from + chunk - 1) / chunk;
+	P.workers = workers;
+	P.fn = fn;
+	P.arg = arg;
+	P.D = malloc( workers * sizeof(struct WSDEQUE) );
+
+	uint_least64_t c = 0;
+	int w = 0;
+	while( w < workers ){								//Deal contiguous blocks of chunks
+		uint_least64_t first = chunks * w / workers;
+		uint_least64_t last = chunks * (w+1) / workers;
+		P.D[w].buf = malloc( (last - first + 1) * sizeof(struct RANGE) );
+		long b = 0;
+		c = last;
+		while( c > first ){								//Owner pops the lowest states first
+			c--;
+			P.D[w].buf[b].from = from + c*chunk;
+			P.D[w].buf[b].to = from + (c+1)*chunk < to ? from + (c+1)*chunk : to;
+			b++;
+		}
+		atomic_init( &P.D[w].top, 0 );
+		atomic_init( &P.D[w].bottom, b );
+		w++;
+	}
+
+	struct POOLWORKER* W = malloc( workers * sizeof(struct POOLWORKER) );
+	pthread_t* T = malloc( workers * sizeof(pthread_t) );
+	w = 0;
+	while( w < workers ){
+		W[w].P = &P;
+		W[w].w = w;
+		if( w > 0 ){
+			pthread_create( &T[w], NULL, pool_worker, &W[w] );
+		}
+		w++;
+	}
+	pool_worker( &W[0] );								//Calling thread is worker 0
+	w = 1;
+	while( w < workers ){
+		pthread_join( T[w], NULL );
+		w++;
+	}
+	w = 0;
+	while( w < workers ){
+		free( P.D[w].buf );
+		w++;
+	}
+	free( P.D );
+	free( W );
+	free( T );
+}
+
+/*-----------------------------------------------------------------------------
+ * Copy the lowest words*64 bits of op into a zeroed bit array
+-----------------------------------------------------------------------------*/
+static void bits_export( uint_least64_t* rop, int words, mpz_t op ){
+	size_t count = 0;
+	memset( rop, 0, words * sizeof(uint_least64_t) );
+	if( mpz_sizeinbase(op, 2) <= (size_t)words * 64 ){
+		mpz_export( rop, &count, -1, sizeof(uint_least64_t), 0, 0, op );
+	}
+	else{
+		mpz_t tmp;	mpz_init( tmp );
+		mpz_fdiv_r_2exp( tmp, op, words * 64 );
+		mpz_export( rop, &count, -1, sizeof(uint_least64_t), 0, 0, tmp );
+		mpz_clear( tmp );
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Target of stage two, the keystream bits CIPHER ^ PLAINTEXT
+-----------------------------------------------------------------------------*/
+static void stage_two_target( struct ATTACK* A, uint_least64_t* T ){
+	mpz_t KS;	mpz_init( KS );
+	mpz_xor( KS, A->CIPHER, A->PLAINTEXT );
+	bits_export( T, (A->m + 63) / 64, KS );
+	mpz_clear( KS );
+}
+
+/*-----------------------------------------------------------------------------
+ * Does decimating X with the R1 state r1 reproduce the keystream T?
+ *	Same walk as genEncrypt(), but on bit arrays and stopping at the first
+ *	bit that differs, which for a wrong R1 state is almost always one of the
+ *	first few. The clock bits come from the period sequence when the attack
+ *	has one (a dispatched kernel) and are generated as needed otherwise.
+-----------------------------------------------------------------------------*/
+static int encrypt_match( struct ATTACK* A, const uint_least64_t* X, const uint_least64_t* T,
+		uint_least64_t pol, uint_least64_t r1 ){
+	if( A->seq != NULL ){
+		return KERNEL->decimate( A->seq, A->idx[r1], X, T, A->m );
+	}
+	uint_least64_t state = r1;
+	int i = 0;
+	int j = 0;
+	while( i < A->m ){
+		int clk;
+		state = lfsr_next( state, pol, A->deg, &clk );
+		j += clk;										//Decimate by skipping a bit
+		if( (int)((X[j >> 6] >> (j & 63)) & 1) != (int)((T[i >> 6] >> (i & 63)) & 1) ){
+			return 0;
+		}
+		i++;
+		j++;
+	}
+	return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two test of a single candidate.
+ *	Decimates the candidate output with every R1 state and compares the
+ *	resulting ciphertext against the target cipher. Returns the lowest
+ *	matching R1 initial state, or -1 if there is none or best (an item
+ *	R2 << deg | R1, if given) drops below this candidate meanwhile.
+-----------------------------------------------------------------------------*/
+int match_candidate( struct ATTACK* A, struct CANDIDATE* C, atomic_uint_least64_t* best ){
+	int xw = (A->n + 63) / 64;
+	uint_least64_t X[xw];
+	uint_least64_t T[(A->m + 63) / 64];
+	uint_least64_t max = mpz_get_ui( A->max );
+	uint_least64_t pol = mpz_get_ui( A->pol );
+	bits_export( X, xw, C->X );
+	stage_two_target( A, T );
+
+	uint_least64_t item = C->istate << A->deg;
+	uint_least64_t i = 0;
+	while( i < max ){
+		if( best != NULL && (i & 63) == 0 && atomic_load_explicit(best, memory_order_relaxed) < item ){
+			break;										//A lower candidate already matched
+		}
+		if( encrypt_match(A, X, T, pol, i) ){
+			return i;
+		}
+		i++;
+	}
+	return -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two tile handler.
+ *	Work item t is R1 state t mod 2^deg of candidate t / 2^deg, so the items
+ *	are in the order the sequential attack tests them. best holds the lowest
+ *	item known to match; every worker polls it and drops the items above it.
+-----------------------------------------------------------------------------*/
+static void stage_two_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct STAGETWO* O = arg;
+	struct ATTACK* A = O->A;
+	struct TIMER T;
+	timer_start( &T );
+	uint_least64_t t = from;
+	while( t < to ){
+		if( (t & 63) == 0 && t > atomic_load_explicit(&O->best, memory_order_relaxed) ){
+			break;										//A lower item already matched
+		}
+		uint_least64_t u = t >> A->deg;
+		if( encrypt_match(A, O->X + u*O->words, O->T, O->pol, t & (O->max-1)) ){
+			uint_least64_t best = atomic_load( &O->best );
+			while( t < best && !atomic_compare_exchange_weak(&O->best, &best, t) ){
+			}
+			t++;
+			break;
+		}
+		t++;
+	}
+	atomic_fetch_add_explicit( &O->tried, t - from, memory_order_relaxed );
+	timer_stop( &T, &O->W[w], BRM_PHASE_STAGE_TWO );
+}
+
+/*-----------------------------------------------------------------------------
+ * Parallel stage two over a candidate set.
+ *	The (candidate, R1 state) pairs are cut into tiles and run on the
+ *	work-stealing pool. Returns 0 and sets r1/r2 for the same pair the
+ *	sequential attack finds first, 1 if no candidate reproduces the cipher.
+-----------------------------------------------------------------------------*/
+int stage_two_parallel( struct ATTACK* A, int workers, struct CANDIDATE* C, uint_least64_t ct, int* r1, int* r2 ){
+	struct STAGETWO O;
+	workers = brm_workers( workers );
+	O.A = A;
+	O.max = mpz_get_ui( A->max );
+	O.pol = mpz_get_ui( A->pol );
+	O.words = (A->n + 63) / 64;
+	O.X = malloc( (ct ? ct : 1) * O.words * sizeof(uint_least64_t) );
+	O.T = malloc( ((A->m + 63) / 64) * sizeof(uint_least64_t) );
+	stage_two_target( A, O.T );
+	uint_least64_t u = 0;
+	while( u < ct ){
+		bits_export( O.X + u*O.words, O.words, C[u].X );
+		u++;
+	}
+	atomic_init( &O.best, UINT_LEAST64_MAX );
+	atomic_init( &O.tried, 0 );
+	O.W = calloc( workers, sizeof(struct brm_metrics) );
+	double wall = brm_clock();
+
+	uint_least64_t total = ct * O.max;
+	uint_least64_t chunk = 1024;						//Tiles of a few microseconds
+	while( total / chunk > 4096 * (uint_least64_t)workers ){
+		chunk <<= 1;									//Bound the number of tiles
+	}
+	pool_run( workers, 0, total, chunk, stage_two_range, &O );
+
+	uint_least64_t best = atomic_load( &O.best );
+	metrics_workers( A->metrics, O.W, workers );
+	if( A->metrics != NULL ){
+		A->metrics->wall[BRM_PHASE_STAGE_TWO] += brm_clock() - wall;
+		A->metrics->r1_states += atomic_load( &O.tried );
+	}
+	free( O.W );
+	free( O.X );
+	free( O.T );
+	if( best == UINT_LEAST64_MAX ){
+		return 1;
+	}
+	*r1 = best & (O.max-1);
+	*r2 = C[best >> A->deg].istate;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two over a whole candidate set.
+ *	Returns 0 and sets r1/r2 for the first candidate that reproduces the
+ *	target cipher, 1 if no candidate does.
+-----------------------------------------------------------------------------*/
+int match_R1( struct ATTACK* A, struct CANDIDATE* C, uint_least64_t ct, int* r1, int* r2 ) {
+	printf("Cracking...");
+	if( stage_two_parallel(A, 1, C, ct, r1, r2) == 0 ){
+		printf("\nMatch found for R1 init state %i and R2 init state %i", *r1, *r2);
+		return 0;
+	}
+
+	printf("\nNo match found... exiting.");
+	return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Bounded lock-free MPMC queue of candidates.
+ *	Every slot carries a sequence number telling producers and consumers
+ *	whether it is free for the enqueue or dequeue at that position, so both
+ *	ends only need a single CAS. The size is rounded up to a power of two.
+-----------------------------------------------------------------------------*/
+int cq_init( struct CQUEUE* Q, size_t size ){
+	size_t s = 2;
+	while( s < size ){
+		s <<= 1;
+	}
+	Q->slots = malloc( s * sizeof(struct CSLOT) );
+	if( Q->slots == NULL ){
+		return 1;
+	}
+	Q->mask = s - 1;
+	size_t i = 0;
+	while( i < s ){
+		atomic_init( &Q->slots[i].seq, i );
+		i++;
+	}
+	atomic_init( &Q->head, 0 );
+	atomic_init( &Q->tail, 0 );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Enqueue a candidate. Ownership of C->X moves to the queue.
+ *	Returns 0 on success and 1 if the queue is full.
+-----------------------------------------------------------------------------*/
+int cq_push( struct CQUEUE* Q, struct CANDIDATE* C ){
+	struct CSLOT* slot;
+	size_t pos = atomic_load_explicit( &Q->tail, memory_order_relaxed );
+	while( 1 ){
+		slot = &Q->slots[pos & Q->mask];
+		size_t seq = atomic_load_explicit( &slot->seq, memory_order_acquire );
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if( dif == 0 ){									//Slot is free at this position
+			if( atomic_compare_exchange_weak_explicit( &Q->tail, &pos, pos+1,
+					memory_order_relaxed, memory_order_relaxed ) ){
+				break;
+			}
+		}
+		else if( dif < 0 ){								//Slot still holds an old entry
+			return 1;
+		}
+		else{
+			pos = atomic_load_explicit( &Q->tail, memory_order_relaxed );
+		}
+	}
+	slot->c = *C;
+	atomic_store_explicit( &slot->seq, pos+1, memory_order_release );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Dequeue a candidate. Ownership of C->X moves to the caller.
+ *	Returns 0 on success and 1 if the queue is empty.
+-----------------------------------------------------------------------------*/
+int cq_pop( struct CQUEUE* Q, struct CANDIDATE* C ){
+	struct CSLOT* slot;
+	size_t pos = atomic_load_explicit( &Q->head, memory_order_relaxed );
+	while( 1 ){
+		slot = &Q->slots[pos & Q->mask];
+		size_t seq = atomic_load_explicit( &slot->seq, memory_order_acquire );
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos+1);
+		if( dif == 0 ){									//Slot is filled at this position
+			if( atomic_compare_exchange_weak_explicit( &Q->head, &pos, pos+1,
+					memory_order_relaxed, memory_order_relaxed ) ){
+				break;
+			}
+		}
+		else if( dif < 0 ){								//Nothing enqueued yet
+			return 1;
+		}
+		else{
+			pos = atomic_load_explicit( &Q->head, memory_order_relaxed );
+		}
+	}
+	*C = slot->c;
+	atomic_store_explicit( &slot->seq, pos + Q->mask + 1, memory_order_release );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the queue and any candidates left in it
+-----------------------------------------------------------------------------*/
+void cq_clear( struct CQUEUE* Q ){
+	struct CANDIDATE c;
+	while( cq_pop(Q, &c) == 0 ){
+		mpz_clear( c.X );
+	}
+	free( Q->slots );
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one worker of the pipeline.
+ *	Takes R2 states off the shared counter and pushes every candidate to the
+ *	queue as soon as it is found. States above the lowest match so far can
+ *	not change the result and are not searched.
+-----------------------------------------------------------------------------*/
+static void* pipeline_stage_one( void* arg ){
+	struct PIPELINE* P = arg;
+	struct ATTACK* A = P->A;
+	uint_least64_t max = mpz_get_ui( A->max );
+	struct SEARCHCTX* S = ctx_get( A );
+
+	while( 1 ){
+		uint_least64_t i = atomic_fetch_add( &P->next, 1 );
+		if( i >= max || (i << A->deg) > atomic_load_explicit(&P->best, memory_order_relaxed) ){
+			break;										//All useful states handed out
+		}
+		if( !search_state(A, i, S) ){
+			continue;
+		}
+		struct CANDIDATE c;
+		c.istate = i;
+		mpz_init_set( c.X, S->TEXT );
+		atomic_fetch_add( &P->ct, 1 );
+		while( cq_push(&P->Q, &c) != 0 ){				//Queue full, wait for stage two
+			if( (i << A->deg) > atomic_load_explicit(&P->best, memory_order_relaxed) ){
+				mpz_clear( c.X );
+				break;
+			}
+			sched_yield();
+		}
+	}
+	ctx_put( A, S );
+	atomic_fetch_sub( &P->producers, 1 );
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two worker of the pipeline.
+ *	Tests candidates against all R1 states while stage one is still running.
+ *	Candidates arrive out of order, so a match only lowers best; candidates
+ *	above it are dropped and the lower ones still run to the end. That gives
+ *	the pair brm_plan_stage_two() returns.
+-----------------------------------------------------------------------------*/
+static void* pipeline_stage_two( void* arg ){
+	struct PIPELINE* P = arg;
+	struct CANDIDATE c;
+
+	while( 1 ){
+		if( cq_pop(&P->Q, &c) != 0 ){
+			if( atomic_load(&P->producers) != 0 ){		//Wait for stage one
+				sched_yield();
+				continue;
+			}
+			if( cq_pop(&P->Q, &c) != 0 ){
+				break;									//Stage one done and queue drained
+			}
+		}
+		uint_least64_t item = c.istate << P->A->deg;
+		int r1 = -1;
+		if( item < atomic_load_explicit(&P->best, memory_order_relaxed) ){
+			r1 = match_candidate( P->A, &c, &P->best );
+		}
+		if( r1 >= 0 ){
+			item += r1;
+			uint_least64_t best = atomic_load( &P->best );
+			while( item < best && !atomic_compare_exchange_weak(&P->best, &best, item) ){
+			}
+		}
+		mpz_clear( c.X );
+	}
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Pipelined attack on a plan.
+ *	Runs stage one and stage two concurrently, connected by the candidate
+ *	queue. Once a key pair reproduces the cipher only the candidates ranked
+ *	before it are still searched and tested, so the result is the same pair
+ *	the sequential attack finds first. workers1/workers2 default to the number of cores when zero. Returns 0 and
+ *	sets R1/R2 if a key pair was recovered, 1 if not and -1 if m is too long
+ *	for the plan.
+-----------------------------------------------------------------------------*/
+int brm_plan_pipeline( brm_plan* plan, int m, int k, int workers1, int workers2, int* R1, int* R2 ){
+	struct ATTACK A;
+	struct PIPELINE P;
+
+	if( plan_attack(plan, m, k, &A, NULL) != 0 ){
+		return -1;
+	}
+	workers1 = brm_workers( workers1 );
+	workers2 = brm_workers( workers2 );
+
+	P.A = &A;
+	cq_init( &P.Q, 1024 );
+	atomic_init( &P.next, 1 );							//State 0 is never searched
+	atomic_init( &P.producers, workers1 );
+	atomic_init( &P.best, UINT_LEAST64_MAX );
+	atomic_init( &P.ct, 0 );
+
+	pthread_t* T = malloc( (workers1+workers2) * sizeof(pthread_t) );
+	int i = 0;
+	while( i < workers1 + workers2 ){
+		pthread_create( &T[i], NULL, i < workers1 ? pipeline_stage_one : pipeline_stage_two, &P );
+		i++;
+	}
+	i = 0;
+	while( i < workers1 + workers2 ){
+		pthread_join( T[i], NULL );
+		i++;
+	}
+	free( T );
+
+	cq_clear( &P.Q );
+	uint_least64_t best = atomic_load( &P.best );
+	if( best == UINT_LEAST64_MAX ){
+		*R1 = -1;
+		*R2 = -1;
+		return 1;
+	}
+	uint_least64_t max = mpz_get_ui( A.max );
+	*R1 = best & (max-1);
+	*R2 = best >> A.deg;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * One-shot pipelined attack, returns -1 on invalid degree
+-----------------------------------------------------------------------------*/
+int brm_pipeline( int deg, int m, int slen, int CLKSTATE, int SSTATE,
+					int workers1, int workers2, int* R1, int* R2 ){
+	brm_plan* plan = brm_plan_create( deg, CLKSTATE, SSTATE, m );
+	if( plan == NULL ){
+		printf("Invalid polynomial degree\n");
+		return -1;
+	}
+	int ret = brm_plan_pipeline( plan, m, slen, workers1, workers2, R1, R2 );
+	brm_plan_destroy( plan );
+	return ret;
+}
+
+/**############################################################################
+ **
+ **	PLANS
+ **
+ **#########################################################################**/
+static struct POLY* POLYS = NULL;						//Cached polynomial tables
+static pthread_mutex_t POLYLOCK = PTHREAD_MUTEX_INITIALIZER;
+
+#define SEQPAD	4096									//Longest window cut from seq
+#define SEQDEG	24										//Largest degree with tables
+
+/*-----------------------------------------------------------------------------
+ * Feedback polynomial of a degree. Returns 1 if there is none.
+-----------------------------------------------------------------------------*/
+int brm_polynomial( int deg, uint_least64_t* pol ){
+	if( deg == 11 ){									//Set polynomial based on degree
+		*pol = 1209;									//2^11 irreducible polynomial
+	}
+	else if( deg == 16 ){
+		*pol = 33262;									//2^16 irreducible polynomial
+	}
+	else if( deg == 20 ){
+		*pol = 589824;									//x^20 + x^17 + 1, period 2^20 - 1
+	}
+	else{
+		return 1;
+	}
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Wall clock in seconds
+-----------------------------------------------------------------------------*/
+double brm_clock( void ){
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*-----------------------------------------------------------------------------
+ * CPU time of the calling thread in seconds
+-----------------------------------------------------------------------------*/
+double brm_cpu( void ){
+	struct timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*-----------------------------------------------------------------------------
+ * Tables of a polynomial, shared by every plan of the same degree.
+ *	The period sequence is generated once from state 1 and continued for
+ *	SEQPAD bits, so the output of any state is a window of it starting at
+ *	the position of the state. Degrees above SEQDEG get no tables and the
+ *	attacks generate the sequence per state instead.
+-----------------------------------------------------------------------------*/
+struct POLY* poly_get( int deg ){
+	uint_least64_t pol;
+	if( brm_polynomial(deg, &pol) != 0 ){
+		return NULL;
+	}
+	pthread_mutex_lock( &POLYLOCK );
+	struct POLY* P = POLYS;
+	while( P != NULL && P->deg != deg ){
+		P = P->next;
+	}
+	if( P == NULL ){
+		P = calloc( 1, sizeof(struct POLY) );
+		P->deg = deg;
+		P->pol = pol;
+		P->period = ((uint_least64_t)1 << deg) - 1;
+		if( deg <= SEQDEG ){
+			uint_least64_t len = P->period + 2*SEQPAD;	//Sequence, continuation and zeros
+			P->seq = calloc( len/64 + 2, sizeof(uint_least64_t) );
+			P->idx = malloc( (P->period+1) * sizeof(uint_least32_t) );
+			P->idx[0] = P->period + SEQPAD;				//State 0 only outputs zeros
+			uint_least64_t state = 1;
+			uint_least64_t i = 0;
+			while( i < P->period + SEQPAD ){
+				int b;
+				if( i < P->period ){
+					P->idx[state] = i;
+				}
+				state = lfsr_next( state, pol, deg, &b );
+				if( b ){
+					P->seq[i >> 6] |= (uint_least64_t)1 << (i & 63);
+				}
+				i++;
+			}
+		}
+		P->next = POLYS;
+		POLYS = P;
+	}
+	P->refs++;
+	pthread_mutex_unlock( &POLYLOCK );
+	return P;
+}
+
+/*-----------------------------------------------------------------------------
+ * Release the tables of a polynomial. They stay cached for later plans.
+-----------------------------------------------------------------------------*/
+void poly_put( struct POLY* P ){
+	pthread_mutex_lock( &POLYLOCK );
+	P->refs--;
+	pthread_mutex_unlock( &POLYLOCK );
+}
+
+/*-----------------------------------------------------------------------------
+ * Create a plan for the cipher of R1/R2 on the polynomial of degree deg,
+ *	for search words of up to max_m bits. The ciphertext is generated once
+ *	for max_m; shorter words use its prefix. Returns NULL on invalid degree.
+-----------------------------------------------------------------------------*/
+brm_plan* brm_plan_create( int deg, int CLKSTATE, int SSTATE, int max_m ){
+	if( max_m < 1 ){									//Before taking a reference to the tables
+		return NULL;
+	}
+	struct TIMER T;
+	timer_start( &T );
+	struct POLY* P = poly_get( deg );
+	if( P == NULL ){
+		return NULL;
+	}
+	brm_plan* plan = calloc( 1, sizeof(brm_plan) );
+	timer_stop( &T, &plan->metrics, BRM_PHASE_SEQUENCE );	//Tables, if this plan built them
+	plan->P = P;
+	plan->deg = deg;
+	plan->CLKSTATE = CLKSTATE;
+	plan->SSTATE = SSTATE;
+	plan->max_m = max_m;
+	mpz_init_set_ui( plan->pol, P->pol );
+	mpz_init( plan->max );
+	mpz_setbit( plan->max, deg );						//Set max val, eg 2048 in 2^11
+	mpz_init_set_ui( plan->PLAINTEXT, 0 );				//Default value is 0
+	plan->M = calloc( max_m+1, sizeof(struct MASKS*) );
+	plan->idle = NULL;
+	pthread_mutex_init( &plan->lock, NULL );
+	return plan;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free a plan, its masks and its idle search contexts
+-----------------------------------------------------------------------------*/
+void brm_plan_destroy( brm_plan* plan ){
+	int m = 0;
+	while( m <= plan->max_m ){
+		if( plan->M[m] != NULL ){
+			mpz_clear( plan->M[m]->CIPHER );
+			mpz_clear( plan->M[m]->B[0] );
+			mpz_clear( plan->M[m]->B[1] );
+			free( plan->M[m]->B );
+			free( plan->M[m] );
+		}
+		m++;
+	}
+	free( plan->M );
+	while( plan->idle != NULL ){
+		struct SEARCHCTX* S = plan->idle;
+		plan->idle = S->next;
+		ctx_clear( S );
+		free( S );
+	}
+	mpz_clear( plan->pol );
+	mpz_clear( plan->max );
+	mpz_clear( plan->PLAINTEXT );
+	pthread_mutex_destroy( &plan->lock );
+	poly_put( plan->P );
+	free( plan );
+}
+
+/*-----------------------------------------------------------------------------
+ * Ciphertext and prefixes for m-bit words, built on first use.
+ *	R1 and R2 output only the m and 2m bits this m needs, so every m gets
+ *	exactly the cipher a one-shot attack would generate.
+-----------------------------------------------------------------------------*/
+static struct MASKS* plan_masks( brm_plan* plan, int m, struct brm_metrics* run ){
+	pthread_mutex_lock( &plan->lock );
+	if( plan->M[m] == NULL ){
+		struct brm_metrics built;
+		struct TIMER T;
+		memset( &built, 0, sizeof(built) );
+		timer_start( &T );
+		struct MASKS* M = malloc( sizeof(struct MASKS) );
+		mpz_t LCLK;		mpz_init(LCLK);					//LFSR for dessimating
+		mpz_t LDES;		mpz_init(LDES);					//LFSR to be dessimated
+		if( plan->P->seq != NULL && 2*m <= SEQPAD ){
+			bits_window( LCLK, plan->P->seq, plan->P->idx[plan->CLKSTATE], m );
+			bits_window( LDES, plan->P->seq, plan->P->idx[plan->SSTATE], 2*m );
+		}
+		else{
+			lfsrgen(LCLK, plan->deg, m, plan->pol, plan->CLKSTATE, 0, NULL);
+			lfsrgen(LDES, plan->deg, 2*m, plan->pol, plan->SSTATE, 0, NULL);
+		}
+		timer_stop( &T, &built, BRM_PHASE_SEQUENCE );
+		timer_start( &T );
+		mpz_init( M->CIPHER );							//Gen intercepted ciphertext
+		genEncrypt( M->CIPHER, LCLK, LDES, plan->PLAINTEXT, m );
+		mpz_clear( LCLK );
+		mpz_clear( LDES );
+		M->B = genAlphabet( ALPHASIZE );				//Generate alphabet
+		genPrefixes( M->B, M->CIPHER, m );				//Generate prefixes for the alphabet
+		timer_stop( &T, &built, BRM_PHASE_PREFIX );
+		plan->M[m] = M;
+		metrics_add( run != NULL ? run : &plan->metrics, &built );	//Plan totals get it with the run
+	}
+	struct MASKS* M = plan->M[m];
+	pthread_mutex_unlock( &plan->lock );
+	return M;
+}
+
+/*-----------------------------------------------------------------------------
+ * Fill A with an attack for (m, k) on the plan.
+ *	The variables are shared with the plan and must not be modified or
+ *	cleared; there is no attack_clear() for such an attack. The phases and
+ *	counters of the attack go to metrics unless it is NULL. Returns 1 if
+ *	m is out of range for the plan.
+-----------------------------------------------------------------------------*/
+int plan_attack( brm_plan* plan, int m, int k, struct ATTACK* A, struct brm_metrics* metrics ){
+	if( m < 1 || m > plan->max_m || k < 0 ){
+		return 1;
+	}
+	struct MASKS* M = plan_masks( plan, m, metrics );
+	A->deg = plan->deg;
+	A->m = m;
+	A->n = 2*m;											//Search text length 2m
+	A->slen = k + 1;									//Allowed errors
+	A->CLKSTATE = plan->CLKSTATE;
+	A->SSTATE = plan->SSTATE;
+	*A->pol = *plan->pol;								//Read-only views
+	*A->max = *plan->max;
+	*A->PLAINTEXT = *plan->PLAINTEXT;
+	*A->CIPHER = *M->CIPHER;
+	A->B = M->B;
+	A->seq = 2*m <= SEQPAD ? plan->P->seq : NULL;		//Longer windows are generated
+	A->idx = plan->P->idx;
+	A->plan = plan;
+	A->metrics = metrics;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Search context for an attack, reused from its plan when possible
+-----------------------------------------------------------------------------*/
+struct SEARCHCTX* ctx_get( struct ATTACK* A ){
+	struct SEARCHCTX* S = NULL;
+	if( A->plan != NULL ){
+		pthread_mutex_lock( &A->plan->lock );
+		struct SEARCHCTX** p = &A->plan->idle;
+		while( *p != NULL ){
+			if( (*p)->m == A->m && (*p)->n == A->n && (*p)->K == A->slen ){
+				S = *p;
+				*p = S->next;
+				break;
+			}
+			p = &(*p)->next;
+		}
+		pthread_mutex_unlock( &A->plan->lock );
+	}
+	if( S == NULL ){
+		S = malloc( sizeof(struct SEARCHCTX) );
+		ctx_init( S, A->m, A->n, A->slen );
+	}
+	return S;
+}
+
+/*-----------------------------------------------------------------------------
+ * Hand a search context back to the plan of the attack, or free it
+-----------------------------------------------------------------------------*/
+void ctx_put( struct ATTACK* A, struct SEARCHCTX* S ){
+	if( A->plan != NULL ){
+		pthread_mutex_lock( &A->plan->lock );
+		S->next = A->plan->idle;
+		A->plan->idle = S;
+		pthread_mutex_unlock( &A->plan->lock );
+		return;
+	}
+	ctx_clear( S );
+	free( S );
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one for (m, k) on a plan.
+ *	mode is BRM_SWEEP_STATES or BRM_SWEEP_ARCS, workers defaults to the
+ *	number of cores when zero. Fills res with the candidate states, which
+ *	must be freed with brm_result_clear(). Returns 0, or -1 if m is out of
+ *	range for the plan.
+-----------------------------------------------------------------------------*/
+int brm_plan_stage_one( brm_plan* plan, int m, int k, int mode, int workers, struct brm_result* res ){
+	uint64_t from, to;
+	brm_shard_range( plan->deg, mode, 0, 1, &from, &to );
+	return brm_plan_stage_one_range( plan, m, k, mode, workers, from, to, res );
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one for (m, k) on the part [from, to) of the sweep.
+ *	The range is in R2 states for BRM_SWEEP_STATES and in offsets on the
+ *	LFSR cycle from state 1 for BRM_SWEEP_ARCS, see brm_shard_range().
+ *	Every candidate is scored with the lowest number of errors of any match
+ *	in its text. The phases and counters of the run are in res->metrics and
+ *	added to the plan totals. With a result cache open (brm_cache_open())
+ *	the cache is consulted first and the result stored after a search.
+ *	Returns 0, or -1 if m or the range is out of bounds.
+-----------------------------------------------------------------------------*/
+int brm_plan_stage_one_range( brm_plan* plan, int m, int k, int mode, int workers,
+		uint64_t from, uint64_t to, struct brm_result* res ){
+	if( cache_get(plan, m, k, mode, from, to, res) == 0 ){
+		return 0;
+	}
+	int ret = stage_one_run( plan, m, k, mode, workers, from, to, res );
+	if( ret == 0 ){
+		cache_put( plan, m, k, mode, from, to, res );
+	}
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one on [from, to) as brm_plan_stage_one_range(), the cache aside
+-----------------------------------------------------------------------------*/
+int stage_one_run( brm_plan* plan, int m, int k, int mode, int workers,
+		uint64_t from, uint64_t to, struct brm_result* res ){
+	struct ATTACK A;
+	struct CANDIDATE* C;
+	uint64_t lo, hi;
+	memset( res, 0, sizeof(struct brm_result) );
+	brm_shard_range( plan->deg, mode, 0, 1, &lo, &hi );
+	if( from < lo || to > hi || from > to || plan_attack(plan, m, k, &A, &res->metrics) != 0 ){
+		return -1;
+	}
+	double begin = brm_clock();
+	uint_least64_t ct;
+	if( mode == BRM_SWEEP_ARCS ){
+		ct = stage_one_arcs( &A, workers, from, to, &C, &res->found );
+	}
+	else{
+		ct = stage_one_parallel( &A, workers, from, to, &C, &res->found );
+	}
+	struct TIMER T;
+	timer_start( &T );
+	res->candidates = ct;
+	res->states = malloc( (ct ? ct : 1) * sizeof(int) );
+	res->scores = malloc( (ct ? ct : 1) * sizeof(int) );
+	struct SEARCHCTX* S = ctx_get( &A );
+	S->bits = 0;
+	S->exits = 0;
+	uint_least64_t u = 0;
+	while( u < ct ){
+		res->states[u] = C[u].istate;
+		mpz_set( S->TEXT, C[u].X );
+		ctx_search( S, A.B, 0 );						//Full search for the best match
+		res->scores[u] = S->best;
+		mpz_clear( C[u].X );
+		u++;
+	}
+	ctx_account( S, &res->metrics );
+	ctx_put( &A, S );
+	free( C );
+	timer_stop( &T, &res->metrics, BRM_PHASE_STORE );
+	res->metrics.candidates = ct;
+	res->runtime = brm_clock() - begin;
+	plan_account( plan, &res->metrics );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two for ct candidate states on m-bit words, metrics into run
+-----------------------------------------------------------------------------*/
+static int plan_stage_two( brm_plan* plan, int m, const int* states, uint_least64_t ct, int workers,
+		int* R1, int* R2, struct brm_metrics* run ){
+	struct ATTACK A;
+	if( plan_attack(plan, m, 0, &A, run) != 0 ){
+		return -1;
+	}
+	struct TIMER T;
+	timer_start( &T );
+	struct CANDIDATE* C = malloc( (ct ? ct : 1) * sizeof(struct CANDIDATE) );
+	uint_least64_t u = 0;
+	while( u < ct ){
+		C[u].istate = states[u];
+		mpz_init( C[u].X );
+		if( A.seq != NULL ){
+			bits_window( C[u].X, A.seq, A.idx[states[u]], A.n );
+		}
+		else{
+			lfsrgen( C[u].X, A.deg, A.n, A.pol, states[u], 0, NULL );
+		}
+		u++;
+	}
+	timer_stop( &T, run, BRM_PHASE_SEQUENCE );			//Outputs of the candidates
+	int ret = stage_two_parallel( &A, workers, C, ct, R1, R2 );
+	u = 0;
+	while( u < ct ){
+		mpz_clear( C[u].X );
+		u++;
+	}
+	free( C );
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two for the candidates of a stage one result on m-bit words.
+ *	workers defaults to the number of cores when zero. Returns 0 and sets
+ *	R1/R2 if a key pair reproduces the cipher, 1 if none does and -1 if m is
+ *	out of range for the plan. Its metrics go to the plan totals.
+-----------------------------------------------------------------------------*/
+int brm_plan_stage_two( brm_plan* plan, int m, const struct brm_result* res, int workers, int* R1, int* R2 ){
+	struct brm_metrics run;
+	memset( &run, 0, sizeof(run) );
+	int ret = plan_stage_two( plan, m, res->states, res->candidates, workers, R1, R2, &run );
+	if( ret >= 0 ){
+		plan_account( plan, &run );
+	}
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Write the candidates of a stage one result to a log file in the form
+ *	<initial state>,<R2 undecimated output sequence of length 2m>
+ *	Returns 1 if the file could not be opened.
+-----------------------------------------------------------------------------*/
+int brm_plan_write( brm_plan* plan, int m, const struct brm_result* res, const char* path ){
+	struct brm_metrics run;
+	struct TIMER T;
+	memset( &run, 0, sizeof(run) );
+	timer_start( &T );
+	FILE* fh = fopen(path, "w");						// Open output file for writing
+	if( fh == NULL ){
+		return 1;
+	}
+	mpz_t X;	mpz_init( X );
+	uint_least64_t u = 0;
+	while ( u < res->candidates ) { 					// Iterate through all candidates
+		if( plan->P->seq != NULL && 2*m <= SEQPAD ){
+			bits_window( X, plan->P->seq, plan->P->idx[res->states[u]], 2*m );
+		}
+		else{
+			lfsrgen( X, plan->deg, 2*m, plan->pol, res->states[u], 0, NULL );
+		}
+		fprintf(fh, "\n%i,", res->states[u]); mpz_out_str(fh, 2, X);
+		u++;
+	}
+	mpz_clear( X );
+	fclose( fh );										//Close data file
+	timer_stop( &T, &run, BRM_PHASE_OUTPUT );
+	plan_account( plan, &run );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the candidate states of a result
+-----------------------------------------------------------------------------*/
+void brm_result_clear( struct brm_result* res ){
+	free( res->states );
+	free( res->scores );
+	res->states = NULL;
+	res->scores = NULL;
+	res->candidates = 0;
+}
+
+/**############################################################################
+ **
+ **	TRACE
+ **
+ **#########################################################################**/
+#if defined BRM_TRACE
+#define TRACESIZE	65536								//Events kept per thread
+static const char TRACEMAGIC[8] = { 'B','R','M','T','R','A','C','E' };
+#define TRACEVERSION	2
+
+static pthread_mutex_t TRACELOCK = PTHREAD_MUTEX_INITIALIZER;	//Guards the file and the rings
+static FILE* TRACEFILE = NULL;						//Trace being recorded
+static struct TRACERING* RINGS = NULL;				//Rings of the live threads
+static uint32_t THREADS = 0;						//Threads seen by the trace
+static double TRACEBEGIN = 0;						//Wall clock at brm_trace_start()
+static _Thread_local struct TRACERING* RING = NULL;	//Ring of the calling thread
+static pthread_key_t TRACEKEY;
+static pthread_once_t TRACEONCE = PTHREAD_ONCE_INIT;
+
+/*-----------------------------------------------------------------------------
+ * Write the events of a ring as one chunk, oldest first, and empty it:
+ *	u32 thread, u32 events, u64 dropped, then the events. Holds TRACELOCK.
+-----------------------------------------------------------------------------*/
+static void trace_flush( struct TRACERING* R ){
+	if( TRACEFILE == NULL || R->count == 0 ){
+		R->count = 0;
+		return;
+	}
+	uint64_t kept = R->count < TRACESIZE ? R->count : TRACESIZE;
+	uint64_t dropped = R->count - kept;
+	uint32_t head[2] = { R->thread, (uint32_t)kept };
+	fwrite( head, sizeof(uint32_t), 2, TRACEFILE );
+	fwrite( &dropped, sizeof(uint64_t), 1, TRACEFILE );
+	uint64_t first = R->count % TRACESIZE;				//Oldest event once the ring wrapped
+	if( R->count > TRACESIZE ){
+		fwrite( R->ev + first, sizeof(struct brm_event), TRACESIZE - first, TRACEFILE );
+		fwrite( R->ev, sizeof(struct brm_event), first, TRACEFILE );
+	}
+	else{
+		fwrite( R->ev, sizeof(struct brm_event), kept, TRACEFILE );
+	}
+	R->count = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * A thread with a ring exits: keep its events and free the ring
+-----------------------------------------------------------------------------*/
+static void trace_exit( void* arg ){
+	struct TRACERING* R = arg;
+	pthread_mutex_lock( &TRACELOCK );
+	trace_flush( R );
+	struct TRACERING** p = &RINGS;
+	while( *p != R ){
+		p = &(*p)->next;
+	}
+	*p = R->next;
+	pthread_mutex_unlock( &TRACELOCK );
+	free( R->ev );
+	free( R );
+}
+
+static void trace_key( void ){
+	pthread_key_create( &TRACEKEY, trace_exit );
+}
+
+/*-----------------------------------------------------------------------------
+ * Record an event in the ring of the calling thread, overwriting the
+ *	oldest once it is full
+-----------------------------------------------------------------------------*/
+void trace_event( int type, uint_least32_t state, uint_least64_t pos, int level ){
+	struct TRACERING* R = RING;
+	if( R == NULL ){									//First event of the thread
+		pthread_once( &TRACEONCE, trace_key );
+		R = malloc( sizeof(struct TRACERING) );
+		R->ev = malloc( TRACESIZE * sizeof(struct brm_event) );
+		R->count = 0;
+		pthread_mutex_lock( &TRACELOCK );
+		R->thread = THREADS++;
+		R->next = RINGS;
+		RINGS = R;
+		pthread_mutex_unlock( &TRACELOCK );
+		pthread_setspecific( TRACEKEY, R );
+		RING = R;
+	}
+	struct brm_event* e = &R->ev[R->count % TRACESIZE];
+	e->time = (uint64_t)((brm_clock() - TRACEBEGIN) * 1e9);
+	e->state = state;
+	e->pos = pos;
+	e->type = type;
+	e->level = level;
+	R->count++;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Start recording a binary trace to path. Every thread keeps its last
+ *	events in a ring of its own, written when the thread exits and at
+ *	brm_trace_stop(). Returns 1 if the library was built without BRM_TRACE,
+ *	a trace is already running or the file could not be opened.
+-----------------------------------------------------------------------------*/
+int brm_trace_start( const char* path ){
+	#if defined BRM_TRACE
+	pthread_mutex_lock( &TRACELOCK );
+	if( TRACEFILE != NULL ){
+		pthread_mutex_unlock( &TRACELOCK );
+		return 1;
+	}
+	TRACEFILE = fopen( path, "wb" );
+	if( TRACEFILE == NULL ){
+		pthread_mutex_unlock( &TRACELOCK );
+		return 1;
+	}
+	uint32_t head[2] = { TRACEVERSION, sizeof(struct brm_event) };
+	fwrite( TRACEMAGIC, 1, sizeof(TRACEMAGIC), TRACEFILE );
+	fwrite( head, sizeof(uint32_t), 2, TRACEFILE );
+	struct TRACERING* R = RINGS;
+	while( R != NULL ){									//Drop events of an earlier trace
+		R->count = 0;
+		R = R->next;
+	}
+	TRACEBEGIN = brm_clock();
+	atomic_store( &TRACING, 1 );
+	pthread_mutex_unlock( &TRACELOCK );
+	return 0;
+	#else
+	(void)path;
+	return 1;
+	#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Stop the trace and write the rings of the live threads. Call it while no
+ *	attack is running. Returns 1 if no trace was running.
+-----------------------------------------------------------------------------*/
+int brm_trace_stop( void ){
+	#if defined BRM_TRACE
+	atomic_store( &TRACING, 0 );
+	pthread_mutex_lock( &TRACELOCK );
+	if( TRACEFILE == NULL ){
+		pthread_mutex_unlock( &TRACELOCK );
+		return 1;
+	}
+	struct TRACERING* R = RINGS;
+	while( R != NULL ){
+		trace_flush( R );
+		R = R->next;
+	}
+	fclose( TRACEFILE );
+	TRACEFILE = NULL;
+	pthread_mutex_unlock( &TRACELOCK );
+	return 0;
+	#else
+	return 1;
+	#endif
+}
+
+/**############################################################################
+ **
+ **	METRICS
+ **
+ **#########################################################################**/
+static const char* PHASENAMES[BRM_PHASES] = {
+	"sequence", "prefix", "search", "store", "stage_two", "output"
+};
+
+static const char* PERFNAMES[BRM_PERF_EVENTS] = {
+	"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+static atomic_int PROFILE = 0;						//Hardware counters enabled
+static pthread_key_t PERFKEY;						//PERFTHREAD of the thread
+static pthread_once_t PERFONCE = PTHREAD_ONCE_INIT;
+
+#if defined __linux__
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} PERFEVENTS[BRM_PERF_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },	//Last level cache
+};
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Close the counters of a thread when it exits
+-----------------------------------------------------------------------------*/
+static void perf_close( void* arg ){
+	struct PERFTHREAD* P = arg;
+	int e = 0;
+	while( e < BRM_PERF_EVENTS ){
+		if( P->fd[e] >= 0 ){
+			close( P->fd[e] );
+		}
+		e++;
+	}
+	free( P );
+}
+
+static void perf_key( void ){
+	pthread_key_create( &PERFKEY, perf_close );
+}
+
+/*-----------------------------------------------------------------------------
+ * Counters of the calling thread, opened on first use. Each event is opened
+ *	on its own, user space only, so a kernel or hypervisor that refuses
+ *	some of them (perf_event_paranoid, containers, VMs) only loses those.
+-----------------------------------------------------------------------------*/
+static struct PERFTHREAD* perf_thread( void ){
+	pthread_once( &PERFONCE, perf_key );
+	struct PERFTHREAD* P = pthread_getspecific( PERFKEY );
+	if( P != NULL ){
+		return P;
+	}
+	P = malloc( sizeof(struct PERFTHREAD) );
+	int e = 0;
+	while( e < BRM_PERF_EVENTS ){
+		P->fd[e] = -1;
+		#if defined __linux__
+		struct perf_event_attr attr;
+		memset( &attr, 0, sizeof(attr) );
+		attr.size = sizeof(attr);
+		attr.type = PERFEVENTS[e].type;
+		attr.config = PERFEVENTS[e].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		P->fd[e] = syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );	//This thread, any CPU
+		#endif
+		e++;
+	}
+	pthread_setspecific( PERFKEY, P );
+	return P;
+}
+
+/*-----------------------------------------------------------------------------
+ * Read the counters of the calling thread into v while profiling, scaled
+ *	up when the kernel multiplexed them. Returns the bitmask of the events
+ *	read, 0 when profiling is off or no counter is available.
+-----------------------------------------------------------------------------*/
+uint32_t perf_read( uint64_t* v ){
+	if( !atomic_load_explicit(&PROFILE, memory_order_relaxed) ){
+		return 0;
+	}
+	struct PERFTHREAD* P = perf_thread();
+	uint32_t events = 0;
+	int e = 0;
+	while( e < BRM_PERF_EVENTS ){
+		uint64_t r[3];									//Value, time enabled, time running
+		v[e] = 0;
+		if( P->fd[e] >= 0 && read(P->fd[e], r, sizeof(r)) == sizeof(r) ){
+			v[e] = r[2] && r[2] < r[1] ? (uint64_t)((double)r[0] * r[1] / r[2]) : r[0];
+			events |= 1u << e;
+		}
+		e++;
+	}
+	return events;
+}
+
+/*-----------------------------------------------------------------------------
+ * Turn the hardware counters per phase on or off for every later run.
+ *	Returns the bitmask of BRM_PERF_* events the calling thread can count;
+ *	with 0 profiling stays off and the metrics carry no counters.
+-----------------------------------------------------------------------------*/
+int brm_profile( int on ){
+	if( !on ){
+		atomic_store( &PROFILE, 0 );
+		return 0;
+	}
+	uint64_t v[BRM_PERF_EVENTS];
+	atomic_store( &PROFILE, 1 );
+	uint32_t events = perf_read( v );
+	if( events == 0 ){
+		atomic_store( &PROFILE, 0 );
+	}
+	return events;
+}
+
+/*-----------------------------------------------------------------------------
+ * Start timing a phase on the calling thread
+-----------------------------------------------------------------------------*/
+void timer_start( struct TIMER* T ){
+	T->allocs = ARENAALLOCS;
+	T->bytes = ARENABYTES;
+	T->live = ARENALIVE;
+	T->peak = ARENAPEAK;
+	ARENAPEAK = ARENALIVE;
+	T->events = perf_read( T->perf );
+	T->wall = brm_clock();
+	T->cpu = brm_cpu();
+}
+
+/*-----------------------------------------------------------------------------
+ * Add the wall and CPU time since timer_start() to a phase of M, if any,
+ *	with the counters and the GMP memory of the thread
+-----------------------------------------------------------------------------*/
+void timer_stop( struct TIMER* T, struct brm_metrics* M, int phase ){
+	if( M != NULL ){
+		M->wall[phase] += brm_clock() - T->wall;
+		M->cpu[phase] += brm_cpu() - T->cpu;
+		if( T->events ){
+			uint64_t v[BRM_PERF_EVENTS];
+			uint32_t events = perf_read( v ) & T->events;
+			int e = 0;
+			while( e < BRM_PERF_EVENTS ){
+				if( events & (1u << e) ){
+					M->perf[phase][e] += v[e] - T->perf[e];
+				}
+				e++;
+			}
+			M->perf_events |= events;
+		}
+		M->gmp_allocs[phase] += ARENAALLOCS - T->allocs;
+		M->gmp_bytes[phase] += ARENABYTES - T->bytes;
+		if( ARENAPEAK - T->live > (int64_t)M->gmp_peak[phase] ){
+			M->gmp_peak[phase] = ARENAPEAK - T->live;
+		}
+	}
+	if( T->peak > ARENAPEAK ){							//Enclosing phase keeps its own peak
+		ARENAPEAK = T->peak;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Add every phase and counter of from to M
+-----------------------------------------------------------------------------*/
+void metrics_add( struct brm_metrics* M, const struct brm_metrics* from ){
+	int p = 0;
+	while( p < BRM_PHASES ){
+		M->wall[p] += from->wall[p];
+		M->cpu[p] += from->cpu[p];
+		int e = 0;
+		while( e < BRM_PERF_EVENTS ){
+			M->perf[p][e] += from->perf[p][e];
+			e++;
+		}
+		M->gmp_allocs[p] += from->gmp_allocs[p];
+		M->gmp_bytes[p] += from->gmp_bytes[p];
+		if( from->gmp_peak[p] > M->gmp_peak[p] ){		//Highest of a single thread
+			M->gmp_peak[p] = from->gmp_peak[p];
+		}
+		p++;
+	}
+	M->perf_events |= from->perf_events;
+	M->states += from->states;
+	M->bits += from->bits;
+	M->rows += from->rows;
+	M->exits += from->exits;
+	M->candidates += from->candidates;
+	M->r1_states += from->r1_states;
+	M->cached += from->cached;
+}
+
+/*-----------------------------------------------------------------------------
+ * Add the metrics of the workers of a pool to M, if any. The workers
+ *	overlap, so only their CPU time and counters count; the caller measures
+ *	the wall time of the phase.
+-----------------------------------------------------------------------------*/
+void metrics_workers( struct brm_metrics* M, struct brm_metrics* W, int workers ){
+	int w = 0;
+	while( M != NULL && w < workers ){
+		memset( W[w].wall, 0, sizeof(W[w].wall) );
+		metrics_add( M, &W[w] );
+		w++;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Add the search counters of a context to M. Every searched bit updates
+ *	all K rows of the error table.
+-----------------------------------------------------------------------------*/
+void ctx_account( struct SEARCHCTX* S, struct brm_metrics* M ){
+	if( M != NULL ){
+		M->bits += S->bits;
+		M->rows += S->bits * S->K;
+		M->exits += S->exits;
+	}
+	S->bits = 0;
+	S->exits = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Add the metrics of a run to the totals of its plan
+-----------------------------------------------------------------------------*/
+void plan_account( brm_plan* plan, const struct brm_metrics* run ){
+	pthread_mutex_lock( &plan->lock );
+	metrics_add( &plan->metrics, run );
+	pthread_mutex_unlock( &plan->lock );
+}
+
+/*-----------------------------------------------------------------------------
+ * Totals of every stage one, stage two and candidate log run on the plan so
+ *	far, with the tables and masks it built
+-----------------------------------------------------------------------------*/
+void brm_plan_metrics( brm_plan* plan, struct brm_metrics* M ){
+	pthread_mutex_lock( &plan->lock );
+	*M = plan->metrics;
+	pthread_mutex_unlock( &plan->lock );
+}
+
+/*-----------------------------------------------------------------------------
+ * Append the metrics as one JSON line, named run, to the file at path.
+ *	Returns 1 if the file could not be opened.
+-----------------------------------------------------------------------------*/
+int brm_metrics_write( const char* path, const char* run, const struct brm_metrics* M ){
+	FILE* fh = fopen( path, "a" );
+	if( fh == NULL ){
+		return 1;
+	}
+	fprintf( fh, "{\"run\": \"%s\", \"phases\": {", run );
+	int p = 0;
+	while( p < BRM_PHASES ){
+		fprintf( fh, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", p ? ", " : "", PHASENAMES[p],
+			M->wall[p], M->cpu[p] );
+		p++;
+	}
+	fprintf( fh, "}, \"states\": %llu, \"bits\": %llu, \"rows\": %llu, \"exits\": %llu, "
+		"\"candidates\": %llu, \"r1_states\": %llu, \"cached\": %llu, \"isa\": \"%s\"", (unsigned long long)M->states,
+		(unsigned long long)M->bits, (unsigned long long)M->rows, (unsigned long long)M->exits,
+		(unsigned long long)M->candidates, (unsigned long long)M->r1_states, (unsigned long long)M->cached,
+		brm_isa() );
+	if( M->perf_events ){								//Profiled run
+		fprintf( fh, ", \"perf\": {" );
+		int first = 1;
+		p = 0;
+		while( p < BRM_PHASES ){
+			const uint64_t* v = M->perf[p];
+			if( v[BRM_PERF_CYCLES] == 0 && v[BRM_PERF_INSTRUCTIONS] == 0 ){
+				p++;
+				continue;
+			}
+			fprintf( fh, "%s\"%s\": {", first ? "" : ", ", PHASENAMES[p] );
+			int e = 0;
+			while( e < BRM_PERF_EVENTS ){
+				if( M->perf_events & (1u << e) ){
+					fprintf( fh, "\"%s\": %llu, ", PERFNAMES[e], (unsigned long long)v[e] );
+				}
+				e++;
+			}
+			double ipc = v[BRM_PERF_CYCLES] ? (double)v[BRM_PERF_INSTRUCTIONS] / v[BRM_PERF_CYCLES] : 0;
+			fprintf( fh, "\"ipc\": %.3f", ipc );
+			if( (p == BRM_PHASE_SEARCH || p == BRM_PHASE_STORE) && M->bits ){	//Per searched text bit
+				e = BRM_PERF_BRANCH_MISSES;
+				while( e < BRM_PERF_EVENTS ){
+					if( M->perf_events & (1u << e) ){
+						fprintf( fh, ", \"%s_per_bit\": %.4f", PERFNAMES[e], (double)v[e] / M->bits );
+					}
+					e++;
+				}
+			}
+			fprintf( fh, "}" );
+			first = 0;
+			p++;
+		}
+		fprintf( fh, "}" );
+	}
+	int first = 1;
+	p = 0;
+	while( p < BRM_PHASES ){								//GMP memory, with brm_arena()
+		if( M->gmp_allocs[p] ){
+			fprintf( fh, "%s\"%s\": {\"allocs\": %llu, \"bytes\": %llu, \"peak\": %llu}", first ? ", \"gmp\": {" : ", ",
+				PHASENAMES[p], (unsigned long long)M->gmp_allocs[p], (unsigned long long)M->gmp_bytes[p],
+				(unsigned long long)M->gmp_peak[p] );
+			first = 0;
+		}
+		p++;
+	}
+	if( !first ){
+		fprintf( fh, "}" );
+	}
+	fprintf( fh, "}\n" );
+	fclose( fh );
+	return 0;
+}
+
+/**############################################################################
+ **
+ **	SHARDS
+ **
+ **#########################################################################**/
+static const char SHARDMAGIC[8] = { 'B','R','M','S','H','A','R','D' };
+#define SHARDVERSION	1
+
+/*-----------------------------------------------------------------------------
+ * Part i of N of the stage one sweep of a degree, as [from, to).
+ *	BRM_SWEEP_STATES sweeps the R2 states [1, 2^deg), BRM_SWEEP_ARCS the
+ *	offsets [0, 2^deg - 1) on the cycle from state 1. The parts are
+ *	contiguous, disjoint and differ in size by at most one.
+-----------------------------------------------------------------------------*/
+void brm_shard_range( int deg, int mode, int i, int N, uint64_t* from, uint64_t* to ){
+	uint64_t lo = mode == BRM_SWEEP_ARCS ? 0 : 1;
+	uint64_t len = ((uint64_t)1 << deg) - 1;
+	*from = lo + len * i / N;
+	*to = lo + len * (i+1) / N;
+}
+
+static void put32( unsigned char* p, uint32_t v ){
+	int i = 0;
+	while( i < 4 ){
+		p[i] = v >> (8*i);
+		i++;
+	}
+}
+
+static void put64( unsigned char* p, uint64_t v ){
+	put32( p, (uint32_t)v );
+	put32( p+4, (uint32_t)(v >> 32) );
+}
+
+static uint32_t get32( const unsigned char* p ){
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64( const unsigned char* p ){
+	return get32( p ) | (uint64_t)get32( p+4 ) << 32;
+}
+
+/*-----------------------------------------------------------------------------
+ * Write a shard file. All fields are little endian:
+ *	magic "BRMSHARD", u32 version, u32 deg, m, k, R1, R2, mode,
+ *	u32 ranges, u64 entries, ranges x (u64 from, u64 to),
+ *	entries x (u32 state, u32 score)
+ *	Returns 1 if the file could not be written.
+-----------------------------------------------------------------------------*/
+int brm_shard_write( const struct brm_shard* sh, const char* path ){
+	FILE* fh = fopen( path, "wb" );
+	if( fh == NULL ){
+		return 1;
+	}
+	unsigned char h[48];
+	memcpy( h, SHARDMAGIC, 8 );
+	put32( h+8, SHARDVERSION );
+	put32( h+12, sh->deg );
+	put32( h+16, sh->m );
+	put32( h+20, sh->k );
+	put32( h+24, sh->R1 );
+	put32( h+28, sh->R2 );
+	put32( h+32, sh->mode );
+	put32( h+36, sh->ranges );
+	put64( h+40, sh->entries );
+	int err = fwrite( h, sizeof(h), 1, fh ) != 1;
+
+	unsigned char r[16];
+	int i = 0;
+	while( !err && i < sh->ranges ){
+		put64( r, sh->range[2*i] );
+		put64( r+8, sh->range[2*i+1] );
+		err = fwrite( r, sizeof(r), 1, fh ) != 1;
+		i++;
+	}
+	uint64_t u = 0;
+	while( !err && u < sh->entries ){
+		put32( r, sh->states[u] );
+		put32( r+4, sh->scores[u] );
+		err = fwrite( r, 8, 1, fh ) != 1;
+		u++;
+	}
+	if( fclose(fh) != 0 ){
+		err = 1;
+	}
+	return err;
+}
+
+/*-----------------------------------------------------------------------------
+ * Read a shard file into sh, to be freed with brm_shard_clear().
+ *	Returns 1 if the file could not be opened, 2 if it is not a shard file
+ *	of a known version and 3 if it is truncated.
+-----------------------------------------------------------------------------*/
+int brm_shard_read( struct brm_shard* sh, const char* path ){
+	memset( sh, 0, sizeof(struct brm_shard) );
+	FILE* fh = fopen( path, "rb" );
+	if( fh == NULL ){
+		return 1;
+	}
+	unsigned char h[48];
+	if( fread(h, sizeof(h), 1, fh) != 1 || memcmp(h, SHARDMAGIC, 8) != 0 || get32(h+8) != SHARDVERSION ){
+		fclose( fh );
+		return 2;
+	}
+	sh->deg = get32( h+12 );
+	sh->m = get32( h+16 );
+	sh->k = get32( h+20 );
+	sh->R1 = get32( h+24 );
+	sh->R2 = get32( h+28 );
+	sh->mode = get32( h+32 );
+	uint32_t ranges = get32( h+36 );
+	sh->entries = get64( h+40 );
+	struct stat st;
+	if( sh->deg < 1 || sh->deg > 32 || sh->entries >> sh->deg || ranges == 0 || ranges > INT_MAX ||
+			fstat(fileno(fh), &st) != 0 || (uint64_t)st.st_size < sizeof(h) + 16*(uint64_t)ranges + 8*sh->entries ){
+		sh->entries = 0;
+		fclose( fh );
+		return 2;										//Corrupt header, or the file is too short for it
+	}
+	sh->ranges = ranges;
+
+	sh->range = malloc( (sh->ranges ? 2*sh->ranges : 1) * sizeof(uint64_t) );
+	sh->states = malloc( (sh->entries ? sh->entries : 1) * sizeof(int) );
+	sh->scores = malloc( (sh->entries ? sh->entries : 1) * sizeof(int) );
+	unsigned char r[16];
+	int err = 0;
+	int i = 0;
+	while( !err && i < sh->ranges ){
+		err = fread( r, sizeof(r), 1, fh ) != 1;
+		sh->range[2*i] = get64( r );
+		sh->range[2*i+1] = get64( r+8 );
+		i++;
+	}
+	uint64_t u = 0;
+	while( !err && u < sh->entries ){
+		err = fread( r, 8, 1, fh ) != 1;
+		sh->states[u] = get32( r );
+		sh->scores[u] = get32( r+4 );
+		u++;
+	}
+	fclose( fh );
+	if( err ){
+		brm_shard_clear( sh );
+		return 3;
+	}
+	return 0;
+}
+
+struct RANKED {
+	int state;
+	int score;
+};
+
+static int cmp_ranked( const void* a, const void* b ){
+	const struct RANKED* x = a;
+	const struct RANKED* y = b;
+	if( x->score != y->score ){
+		return (x->score > y->score) - (x->score < y->score);
+	}
+	return (x->state > y->state) - (x->state < y->state);
+}
+
+static int cmp_ranked_state( const void* a, const void* b ){
+	const struct RANKED* x = a;
+	const struct RANKED* y = b;
+	return (x->state > y->state) - (x->state < y->state);
+}
+
+/*-----------------------------------------------------------------------------
+ * Order the entries of a shard best first: fewest errors, then lowest state
+-----------------------------------------------------------------------------*/
+void brm_shard_rank( struct brm_shard* sh ){
+	struct RANKED* E = malloc( (sh->entries ? sh->entries : 1) * sizeof(struct RANKED) );
+	uint64_t u = 0;
+	while( u < sh->entries ){
+		E[u].state = sh->states[u];
+		E[u].score = sh->scores[u];
+		u++;
+	}
+	qsort( E, sh->entries, sizeof(struct RANKED), cmp_ranked );
+	u = 0;
+	while( u < sh->entries ){
+		sh->states[u] = E[u].state;
+		sh->scores[u] = E[u].score;
+		u++;
+	}
+	free( E );
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the ranges and entries of a shard
+-----------------------------------------------------------------------------*/
+void brm_shard_clear( struct brm_shard* sh ){
+	free( sh->range );
+	free( sh->states );
+	free( sh->scores );
+	sh->range = NULL;
+	sh->states = NULL;
+	sh->scores = NULL;
+	sh->ranges = 0;
+	sh->entries = 0;
+}
+
+/**############################################################################
+ **
+ **	CHECKPOINTS
+ **
+ **#########################################################################**/
+static const char CHECKMAGIC[8] = { 'B','R','M','C','H','E','C','K' };
+#define CHECKVERSION	3
+#define METRICWORDS		(1 + 2*BRM_PHASES + BRM_PHASES*BRM_PERF_EVENTS + 8 + 3*BRM_PHASES)	//Runtime and metrics
+#define CHECKHEAD		(72 + 8*METRICWORDS)
+
+/*-----------------------------------------------------------------------------
+ * Runtime and metrics as METRICWORDS words, doubles as their bits. Stored
+ *	into w, or loaded from it with load set.
+-----------------------------------------------------------------------------*/
+static void metrics_words( struct brm_metrics* M, double* runtime, uint64_t* w, int load ){
+	double* d[1 + 2*BRM_PHASES];
+	uint64_t* v[BRM_PHASES*BRM_PERF_EVENTS + 7 + 3*BRM_PHASES];
+	uint64_t events = M->perf_events;
+	int i = 0;
+	d[0] = runtime;
+	while( i < BRM_PHASES ){
+		d[1+i] = &M->wall[i];
+		d[1+BRM_PHASES+i] = &M->cpu[i];
+		int e = 0;
+		while( e < BRM_PERF_EVENTS ){
+			v[i*BRM_PERF_EVENTS + e] = &M->perf[i][e];
+			e++;
+		}
+		i++;
+	}
+	v[BRM_PHASES*BRM_PERF_EVENTS] = &M->states;
+	v[BRM_PHASES*BRM_PERF_EVENTS+1] = &M->bits;
+	v[BRM_PHASES*BRM_PERF_EVENTS+2] = &M->rows;
+	v[BRM_PHASES*BRM_PERF_EVENTS+3] = &M->exits;
+	v[BRM_PHASES*BRM_PERF_EVENTS+4] = &M->candidates;
+	v[BRM_PHASES*BRM_PERF_EVENTS+5] = &M->r1_states;
+	v[BRM_PHASES*BRM_PERF_EVENTS+6] = &M->cached;
+	i = 0;
+	while( i < BRM_PHASES ){
+		v[BRM_PHASES*BRM_PERF_EVENTS + 7 + 3*i] = &M->gmp_allocs[i];
+		v[BRM_PHASES*BRM_PERF_EVENTS + 8 + 3*i] = &M->gmp_bytes[i];
+		v[BRM_PHASES*BRM_PERF_EVENTS + 9 + 3*i] = &M->gmp_peak[i];
+		i++;
+	}
+	i = 0;
+	while( i < 1 + 2*BRM_PHASES ){
+		if( load )	memcpy( d[i], &w[i], sizeof(double) );
+		else		memcpy( &w[i], d[i], sizeof(double) );
+		i++;
+	}
+	int j = 0;
+	while( j < BRM_PHASES*BRM_PERF_EVENTS + 7 + 3*BRM_PHASES ){
+		if( load )	*v[j] = w[i+j];
+		else		w[i+j] = *v[j];
+		j++;
+	}
+	if( load )	M->perf_events = w[i+j];
+	else		w[i+j] = events;
+}
+
+/*-----------------------------------------------------------------------------
+ * Write a checkpoint atomically: the data goes to <path>.tmp, is synced and
+ *	renamed over path, so a crash leaves either the old or the new one. All
+ *	fields are little endian:
+ *	magic "BRMCHECK", u32 version, u32 stage, deg, m, k, R1, R2, mode,
+ *	u64 from, to, cursor, entries, u64 runtime and metrics words,
+ *	entries x (u32 state, u32 score)
+ *	Returns 1 if the file could not be written.
+-----------------------------------------------------------------------------*/
+static int checkpoint_write( struct CHECKPOINT* c, const char* path ){
+	char* tmp = malloc( strlen(path) + 5 );
+	sprintf( tmp, "%s.tmp", path );
+	FILE* fh = fopen( tmp, "wb" );
+	if( fh == NULL ){
+		free( tmp );
+		return 1;
+	}
+	unsigned char h[CHECKHEAD];
+	uint64_t w[METRICWORDS];
+	memcpy( h, CHECKMAGIC, 8 );
+	put32( h+8, CHECKVERSION );
+	put32( h+12, c->stage );
+	put32( h+16, c->deg );
+	put32( h+20, c->m );
+	put32( h+24, c->k );
+	put32( h+28, c->R1 );
+	put32( h+32, c->R2 );
+	put32( h+36, c->mode );
+	put64( h+40, c->from );
+	put64( h+48, c->to );
+	put64( h+56, c->cursor );
+	put64( h+64, c->entries );
+	metrics_words( &c->M, &c->runtime, w, 0 );
+	int i = 0;
+	while( i < METRICWORDS ){
+		put64( h+72 + 8*i, w[i] );
+		i++;
+	}
+	int err = fwrite( h, sizeof(h), 1, fh ) != 1;
+	unsigned char r[8];
+	uint64_t u = 0;
+	while( !err && u < c->entries ){
+		put32( r, c->states[u] );
+		put32( r+4, c->scores[u] );
+		err = fwrite( r, 8, 1, fh ) != 1;
+		u++;
+	}
+	if( fflush(fh) != 0 || fsync(fileno(fh)) != 0 ){
+		err = 1;
+	}
+	if( fclose(fh) != 0 ){
+		err = 1;
+	}
+	if( err || rename(tmp, path) != 0 ){
+		unlink( tmp );
+		err = 1;
+	}
+	free( tmp );
+	return err;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the entries of a checkpoint
+-----------------------------------------------------------------------------*/
+static void checkpoint_clear( struct CHECKPOINT* c ){
+	free( c->states );
+	free( c->scores );
+	c->states = NULL;
+	c->scores = NULL;
+	c->entries = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Read a checkpoint, to be freed with checkpoint_clear().
+ *	Returns 1 if the file could not be opened, 2 if it is not a checkpoint
+ *	of a known version and 3 if it is truncated.
+-----------------------------------------------------------------------------*/
+static int checkpoint_read( struct CHECKPOINT* c, const char* path ){
+	memset( c, 0, sizeof(struct CHECKPOINT) );
+	FILE* fh = fopen( path, "rb" );
+	if( fh == NULL ){
+		return 1;
+	}
+	unsigned char h[CHECKHEAD];
+	uint64_t w[METRICWORDS];
+	if( fread(h, sizeof(h), 1, fh) != 1 || memcmp(h, CHECKMAGIC, 8) != 0 || get32(h+8) != CHECKVERSION ){
+		fclose( fh );
+		return 2;
+	}
+	c->stage = get32( h+12 );
+	c->deg = get32( h+16 );
+	c->m = get32( h+20 );
+	c->k = get32( h+24 );
+	c->R1 = get32( h+28 );
+	c->R2 = get32( h+32 );
+	c->mode = get32( h+36 );
+	c->from = get64( h+40 );
+	c->to = get64( h+48 );
+	c->cursor = get64( h+56 );
+	c->entries = get64( h+64 );
+	if( c->deg < 1 || c->deg > 32 || c->entries >> c->deg || c->cursor < c->from || c->cursor > c->to ){
+		fclose( fh );
+		return 2;										//Corrupt header
+	}
+	int i = 0;
+	while( i < METRICWORDS ){
+		w[i] = get64( h+72 + 8*i );
+		i++;
+	}
+	metrics_words( &c->M, &c->runtime, w, 1 );
+
+	c->states = malloc( (c->entries ? c->entries : 1) * sizeof(int) );
+	c->scores = malloc( (c->entries ? c->entries : 1) * sizeof(int) );
+	unsigned char r[8];
+	int err = 0;
+	uint64_t u = 0;
+	while( !err && u < c->entries ){
+		err = fread( r, 8, 1, fh ) != 1;
+		c->states[u] = get32( r );
+		c->scores[u] = get32( r+4 );
+		u++;
+	}
+	fclose( fh );
+	if( err ){
+		checkpoint_clear( c );
+		return 3;
+	}
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Continue from the checkpoint at path if it belongs to the same run as c.
+ *	Returns 0 if c now holds the checkpoint, 1 if there is none and -1 if
+ *	the file belongs to another run or cannot be read.
+-----------------------------------------------------------------------------*/
+static int checkpoint_resume( struct CHECKPOINT* c, const char* path ){
+	struct CHECKPOINT r;
+	int err = checkpoint_read( &r, path );
+	if( err == 1 ){
+		return 1;
+	}
+	if( err != 0 ){
+		return -1;
+	}
+	if( r.stage != c->stage || r.deg != c->deg || r.m != c->m || r.k != c->k || r.R1 != c->R1 ||
+			r.R2 != c->R2 || r.mode != c->mode || r.from != c->from || r.to != c->to ){
+		checkpoint_clear( &r );
+		return -1;
+	}
+	*c = r;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Length of the next segment: doubled or halved so that a segment, and so
+ *	the time between checkpoints, takes about every seconds
+-----------------------------------------------------------------------------*/
+static uint64_t checkpoint_segment( uint64_t seg, double took, double every, uint64_t min, uint64_t max ){
+	if( took < every / 2 && seg < max ){
+		return 2 * seg;
+	}
+	if( took > 2 * every && seg > min ){
+		return seg / 2;
+	}
+	return seg;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one for (m, k) on the part [from, to) of the sweep, checkpointed.
+ *	The sweep runs in segments; after each one the cursor, the candidates
+ *	found so far and the metrics are written atomically to path. With
+ *	resume set an existing checkpoint of the same run is continued from its
+ *	cursor, a finished one just returns its result; without it any old
+ *	checkpoint is replaced. The result is the same as brm_plan_stage_one_range()
+ *	with the metrics and runtime of the earlier runs included; the result
+ *	cache is consulted for the whole range, not per segment. Returns 0,
+ *	1 if a checkpoint could not be written (the result is still complete),
+ *	or -1 if m or the range is out of bounds or path holds a checkpoint of
+ *	another run.
+-----------------------------------------------------------------------------*/
+int brm_plan_stage_one_checkpoint( brm_plan* plan, int m, int k, int mode, int workers, uint64_t from,
+		uint64_t to, const char* path, double every, int resume, struct brm_result* res ){
+	struct CHECKPOINT c;
+	uint64_t lo, hi;
+	memset( res, 0, sizeof(struct brm_result) );
+	memset( &c, 0, sizeof(c) );
+	brm_shard_range( plan->deg, mode, 0, 1, &lo, &hi );
+	if( from < lo || to > hi || from > to || m < 1 || m > plan->max_m || k < 0 ){
+		return -1;
+	}
+	if( cache_get(plan, m, k, mode, from, to, res) == 0 ){
+		return 0;
+	}
+	c.stage = 1;
+	c.deg = plan->deg;	c.m = m;	c.k = k;
+	c.R1 = plan->CLKSTATE;	c.R2 = plan->SSTATE;	c.mode = mode;
+	c.from = from;	c.to = to;	c.cursor = from;
+	if( resume ){
+		int err = checkpoint_resume( &c, path );
+		if( err < 0 ){
+			return -1;
+		}
+		if( err == 0 ){
+			plan_account( plan, &c.M );					//Earlier runs into the plan totals
+		}
+	}
+	uint64_t cap = c.entries ? c.entries : 1024;
+	c.states = realloc( c.states, cap * sizeof(int) );
+	c.scores = realloc( c.scores, cap * sizeof(int) );
+
+	int ret = 0;
+	uint64_t seg = 4096 * (uint64_t)brm_workers( workers );
+	while( c.cursor < to ){
+		double begin = brm_clock();
+		uint64_t end = to - c.cursor > seg ? c.cursor + seg : to;
+		struct brm_result part;
+		if( stage_one_run(plan, m, k, mode, workers, c.cursor, end, &part) != 0 ){
+			checkpoint_clear( &c );
+			return -1;
+		}
+		if( c.entries + part.candidates > cap ){
+			cap = 2 * (c.entries + part.candidates);
+			c.states = realloc( c.states, cap * sizeof(int) );
+			c.scores = realloc( c.scores, cap * sizeof(int) );
+		}
+		memcpy( c.states + c.entries, part.states, part.candidates * sizeof(int) );
+		memcpy( c.scores + c.entries, part.scores, part.candidates * sizeof(int) );
+		c.entries += part.candidates;
+		metrics_add( &c.M, &part.metrics );
+		brm_result_clear( &part );
+		c.cursor = end;
+		c.runtime += brm_clock() - begin;
+		if( checkpoint_write(&c, path) != 0 ){
+			ret = 1;
+		}
+		seg = checkpoint_segment( seg, brm_clock() - begin, every, 1024, to - from );
+	}
+
+	struct RANKED* E = malloc( (c.entries ? c.entries : 1) * sizeof(struct RANKED) );
+	uint64_t u = 0;
+	while( u < c.entries ){
+		E[u].state = c.states[u];
+		E[u].score = c.scores[u];
+		u++;
+	}
+	qsort( E, c.entries, sizeof(struct RANKED), cmp_ranked_state );	//Arc segments are not in state order
+	u = 0;
+	while( u < c.entries ){
+		c.states[u] = E[u].state;
+		c.scores[u] = E[u].score;
+		res->found |= E[u].state == plan->SSTATE;
+		u++;
+	}
+	free( E );
+	res->candidates = c.entries;
+	res->states = c.states;
+	res->scores = c.scores;
+	res->runtime = c.runtime;
+	res->metrics = c.M;
+	cache_put( plan, m, k, mode, from, to, res );
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage two for the candidates of a stage one result, checkpointed.
+ *	The candidates are tested in batches in their order, so the key pair
+ *	found is the one brm_plan_stage_two() finds. The cursor after each
+ *	batch and the metrics are written atomically to path, a key pair found
+ *	as the only entry (R2 state, R1 state). resume as for
+ *	brm_plan_stage_one_checkpoint(). Returns 0 and sets R1/R2 if a key pair
+ *	reproduces the cipher, 1 if none does, plus 2 if a checkpoint could not
+ *	be written (so 2: found, 3: not found), and -1 on invalid arguments or a
+ *	checkpoint of another run.
+-----------------------------------------------------------------------------*/
+int brm_plan_stage_two_checkpoint( brm_plan* plan, int m, const struct brm_result* res, int workers,
+		const char* path, double every, int resume, int* R1, int* R2 ){
+	struct CHECKPOINT c;
+	memset( &c, 0, sizeof(c) );
+	if( m < 1 || m > plan->max_m ){
+		return -1;
+	}
+	c.stage = 2;
+	c.deg = plan->deg;	c.m = m;
+	c.R1 = plan->CLKSTATE;	c.R2 = plan->SSTATE;
+	c.from = 0;	c.to = res->candidates;	c.cursor = 0;
+	if( resume ){
+		int err = checkpoint_resume( &c, path );
+		if( err < 0 ){
+			return -1;
+		}
+		if( err == 0 ){
+			plan_account( plan, &c.M );
+		}
+	}
+	int ret = c.entries ? 0 : 1;
+	if( c.entries ){									//Found before
+		*R2 = c.states[0];
+		*R1 = c.scores[0];
+	}
+	int failed = 0;
+	uint64_t seg = 4 * (uint64_t)brm_workers( workers );
+	while( ret == 1 && c.cursor < c.to ){
+		double begin = brm_clock();
+		uint64_t end = c.to - c.cursor > seg ? c.cursor + seg : c.to;
+		struct brm_metrics run;
+		memset( &run, 0, sizeof(run) );
+		ret = plan_stage_two( plan, m, res->states + c.cursor, end - c.cursor, workers, R1, R2, &run );
+		if( ret < 0 ){
+			checkpoint_clear( &c );
+			return -1;
+		}
+		plan_account( plan, &run );
+		metrics_add( &c.M, &run );
+		c.cursor = end;
+		if( ret == 0 ){
+			c.states = malloc( sizeof(int) );
+			c.scores = malloc( sizeof(int) );
+			c.states[0] = *R2;
+			c.scores[0] = *R1;
+			c.entries = 1;
+		}
+		c.runtime += brm_clock() - begin;
+		failed |= checkpoint_write( &c, path );
+		seg = checkpoint_segment( seg, brm_clock() - begin, every, 1, c.to );
+	}
+	checkpoint_clear( &c );
+	return ret + (failed ? 2 : 0);
+}
+
+/**############################################################################
+ **
+ **	RESULT CACHE
+ **	Stage one results on disk, one file per run named after the hash of its
+ **	key: the polynomial, the cipher bits, m, k, the sweep and the engine
+ **	variant. Lookups map the file and compare the whole key, so a hash
+ **	collision is a miss. The modification time of a file is its last use;
+ **	the least recently used files go once the cache outgrows its cap.
+ **
+ **#########################################################################**/
+static const char CACHEMAGIC[8] = { 'B','R','M','C','A','C','H','E' };
+#define CACHEVERSION	2								//Bump when the results of a search change
+#define CACHEHEAD		(24 + 8*METRICWORDS)
+
+static pthread_mutex_t CACHELOCK = PTHREAD_MUTEX_INITIALIZER;	//Guards the settings and CACHEBYTES
+static char* CACHEDIR = NULL;							//Cache directory, NULL while closed
+static uint64_t CACHECAP = 0;							//Size cap in bytes
+static uint64_t CACHEBYTES = 0;							//Size of the cache as far as known
+
+struct CACHEFILE {
+	char name[24];				// <16 hex digits>.brc
+	double used;				// Last use, seconds since the epoch
+	uint64_t size;				// Bytes
+};
+
+static int cmp_cachefile( const void* a, const void* b ){
+	const struct CACHEFILE* x = a;
+	const struct CACHEFILE* y = b;
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/*-----------------------------------------------------------------------------
+ * Size of the cache directory. With cap set the least recently used files
+ *	are removed until the rest fit within cap. Holds CACHELOCK.
+-----------------------------------------------------------------------------*/
+static uint64_t cache_scan( uint64_t cap ){
+	DIR* d = opendir( CACHEDIR );
+	if( d == NULL ){
+		return 0;
+	}
+	struct CACHEFILE* F = NULL;
+	size_t ct = 0;
+	size_t size = 0;
+	uint64_t total = 0;
+	char path[PATH_MAX];
+	struct dirent* e;
+	while( (e = readdir(d)) != NULL ){
+		size_t len = strlen( e->d_name );
+		struct stat st;
+		if( len != 20 || strcmp(e->d_name + 16, ".brc") != 0 ){
+			continue;
+		}
+		snprintf( path, sizeof(path), "%s/%s", CACHEDIR, e->d_name );
+		if( stat(path, &st) != 0 ){
+			continue;									//Evicted by another process
+		}
+		if( ct == size ){
+			size = size ? 2*size : 256;
+			F = realloc( F, size * sizeof(struct CACHEFILE) );
+		}
+		strcpy( F[ct].name, e->d_name );
+		F[ct].used = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+		F[ct].size = st.st_size;
+		total += st.st_size;
+		ct++;
+	}
+	closedir( d );
+	if( cap && total > cap ){
+		qsort( F, ct, sizeof(struct CACHEFILE), cmp_cachefile );
+		size_t i = 0;
+		while( i < ct && total > cap ){
+			snprintf( path, sizeof(path), "%s/%s", CACHEDIR, F[i].name );
+			if( unlink(path) == 0 ){
+				total -= F[i].size;
+			}
+			i++;
+		}
+	}
+	free( F );
+	return total;
+}
+
+/*-----------------------------------------------------------------------------
+ * Use dir as the result cache of stage one, of at most cap bytes (0: no
+ *	cap). The directory is created if needed. A NULL dir closes the cache.
+ *	Returns 1 if the directory cannot be used.
+-----------------------------------------------------------------------------*/
+int brm_cache_open( const char* dir, uint64_t cap ){
+	pthread_mutex_lock( &CACHELOCK );
+	free( CACHEDIR );
+	CACHEDIR = NULL;
+	if( dir == NULL ){
+		pthread_mutex_unlock( &CACHELOCK );
+		return 0;
+	}
+	struct stat st;
+	if( mkdir(dir, 0777) != 0 && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) ){
+		pthread_mutex_unlock( &CACHELOCK );
+		return 1;
+	}
+	CACHEDIR = strdup( dir );
+	CACHECAP = cap;
+	CACHEBYTES = cache_scan( cap );
+	pthread_mutex_unlock( &CACHELOCK );
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Key of a stage one run, freed by the caller, and its file in path.
+ *	u32 version, variant, deg, m, k, mode, u64 polynomial, from, to, then
+ *	the cipher bits. Returns NULL if the cache is closed or the run is out
+ *	of bounds.
+-----------------------------------------------------------------------------*/
+static unsigned char* cache_key( brm_plan* plan, int m, int k, int mode, uint64_t from, uint64_t to,
+		size_t* len, char* path ){
+	uint64_t lo, hi;
+	brm_shard_range( plan->deg, mode, 0, 1, &lo, &hi );
+	if( m < 1 || m > plan->max_m || k < 0 || from < lo || to > hi || from > to ){
+		return NULL;
+	}
+	pthread_mutex_lock( &CACHELOCK );
+	if( CACHEDIR == NULL ){
+		pthread_mutex_unlock( &CACHELOCK );
+		return NULL;
+	}
+	snprintf( path, PATH_MAX, "%s/", CACHEDIR );
+	pthread_mutex_unlock( &CACHELOCK );
+
+	uint32_t variant = 0;
+	#if defined SHIFTOR
+	variant |= 1;
+	#endif
+	#if defined INC_INSERT
+	variant |= 2;
+	#endif
+	struct MASKS* M = plan_masks( plan, m, NULL );
+	int words = (m + 63) / 64;
+	*len = 48 + 8*words;
+	unsigned char* key = calloc( *len, 1 );
+	put32( key, CACHEVERSION );
+	put32( key+4, variant );
+	put32( key+8, plan->deg );
+	put32( key+12, m );
+	put32( key+16, k );
+	put32( key+20, mode );
+	put64( key+24, mpz_get_ui(plan->pol) );
+	put64( key+32, from );
+	put64( key+40, to );
+	uint_least64_t C[words];
+	bits_export( C, words, M->CIPHER );
+	int i = 0;
+	while( i < words ){
+		put64( key+48 + 8*i, C[i] );
+		i++;
+	}
+	uint64_t h = 14695981039346656037ULL;				//FNV-1a
+	size_t u = 0;
+	while( u < *len ){
+		h = (h ^ key[u]) * 1099511628211ULL;
+		u++;
+	}
+	snprintf( path + strlen(path), PATH_MAX - strlen(path), "%016llx.brc", (unsigned long long)h );
+	return key;
+}
+
+/*-----------------------------------------------------------------------------
+ * Look up a stage one run in the cache. A hit fills res with the stored
+ *	candidates, runtime and metrics, sets res->metrics.cached and marks the
+ *	file as used; the plan totals only count the hit. Returns 0 on a hit,
+ *	1 otherwise.
+-----------------------------------------------------------------------------*/
+int cache_get( brm_plan* plan, int m, int k, int mode, uint64_t from, uint64_t to, struct brm_result* res ){
+	char path[PATH_MAX];
+	size_t len;
+	memset( res, 0, sizeof(struct brm_result) );
+	unsigned char* key = cache_key( plan, m, k, mode, from, to, &len, path );
+	if( key == NULL ){
+		return 1;
+	}
+	int fd = open( path, O_RDONLY );
+	struct stat st;
+	if( fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size < CACHEHEAD + len ){
+		if( fd >= 0 )	close( fd );
+		free( key );
+		return 1;
+	}
+	unsigned char* p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if( p == MAP_FAILED ){
+		close( fd );
+		free( key );
+		return 1;
+	}
+	uint64_t entries = get64( p+16 );
+	int hit = memcmp( p, CACHEMAGIC, 8 ) == 0 && get32( p+8 ) == CACHEVERSION && get32( p+12 ) == len &&
+		entries <= (uint64_t)st.st_size / 8 && (uint64_t)st.st_size == CACHEHEAD + len + 8*entries &&
+		memcmp( p + CACHEHEAD, key, len ) == 0;
+	free( key );
+	if( hit ){
+		uint64_t w[METRICWORDS];
+		int i = 0;
+		while( i < METRICWORDS ){
+			w[i] = get64( p+24 + 8*i );
+			i++;
+		}
+		metrics_words( &res->metrics, &res->runtime, w, 1 );
+		res->candidates = entries;
+		res->states = malloc( (entries ? entries : 1) * sizeof(int) );
+		res->scores = malloc( (entries ? entries : 1) * sizeof(int) );
+		const unsigned char* r = p + CACHEHEAD + len;
+		uint64_t u = 0;
+		while( u < entries ){
+			res->states[u] = get32( r + 8*u );
+			res->scores[u] = get32( r + 8*u + 4 );
+			res->found |= res->states[u] == plan->SSTATE;
+			u++;
+		}
+		res->metrics.cached = 1;
+		futimens( fd, NULL );							//Most recently used
+		struct brm_metrics hits;
+		memset( &hits, 0, sizeof(hits) );
+		hits.cached = 1;
+		plan_account( plan, &hits );
+	}
+	munmap( p, st.st_size );
+	close( fd );
+	return !hit;
+}
+
+/*-----------------------------------------------------------------------------
+ * Store a stage one result in the cache, written to a temporary file and
+ *	renamed so readers never see a partial one. Evicts the least recently
+ *	used results once the cache is over its cap.
+-----------------------------------------------------------------------------*/
+void cache_put( brm_plan* plan, int m, int k, int mode, uint64_t from, uint64_t to, const struct brm_result* res ){
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 32];
+	size_t len;
+	unsigned char* key = cache_key( plan, m, k, mode, from, to, &len, path );
+	if( key == NULL ){
+		return;
+	}
+	snprintf( tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid() );
+	FILE* fh = fopen( tmp, "wb" );
+	if( fh == NULL ){
+		free( key );
+		return;
+	}
+	unsigned char h[CACHEHEAD];
+	uint64_t w[METRICWORDS];
+	struct brm_metrics M = res->metrics;
+	double runtime = res->runtime;
+	M.cached = 0;
+	memcpy( h, CACHEMAGIC, 8 );
+	put32( h+8, CACHEVERSION );
+	put32( h+12, len );
+	put64( h+16, res->candidates );
+	metrics_words( &M, &runtime, w, 0 );
+	int i = 0;
+	while( i < METRICWORDS ){
+		put64( h+24 + 8*i, w[i] );
+		i++;
+	}
+	int err = fwrite( h, sizeof(h), 1, fh ) != 1 || fwrite( key, len, 1, fh ) != 1;
+	free( key );
+	unsigned char r[8];
+	uint64_t u = 0;
+	while( !err && u < res->candidates ){
+		put32( r, res->states[u] );
+		put32( r+4, res->scores[u] );
+		err = fwrite( r, 8, 1, fh ) != 1;
+		u++;
+	}
+	if( fclose(fh) != 0 || err || rename(tmp, path) != 0 ){
+		unlink( tmp );
+		return;
+	}
+	pthread_mutex_lock( &CACHELOCK );
+	if( CACHEDIR != NULL ){
+		CACHEBYTES += CACHEHEAD + len + 8*res->candidates;
+		if( CACHECAP && CACHEBYTES > CACHECAP ){
+			CACHEBYTES = cache_scan( CACHECAP );		//Also picks up other processes
+		}
+	}
+	pthread_mutex_unlock( &CACHELOCK );
+}
+
+/**############################################################################
+ **
+ **	JOB QUEUES
+ **
+ **#########################################################################**/
+struct JOB {
+	uint64_t id;			// Handle returned by brm_submit()
+	brm_plan* plan;			// Plan of the attack
+	int m;					// Search word length
+	int k;					// Allowed errors
+	int mode;				// Sweep mode, BRM_SWEEP_*
+	int workers;			// Workers inside the job
+	struct brm_done done;	// Outcome once run
+	struct JOB* next;
+};
+
+struct brm_queue {
+	int threads;				// Native workers
+	pthread_t* T;
+	struct JOB* head;			// Jobs waiting to run, oldest first
+	struct JOB* tail;
+	struct JOB* dhead;			// Completed jobs not yet collected
+	struct JOB* dtail;
+	uint64_t next;				// Next job handle
+	uint64_t pending;			// Jobs submitted and not yet collected
+	int stop;					// Set by brm_queue_destroy()
+	pthread_mutex_t lock;		// Guards everything above
+	pthread_cond_t work;		// Signalled on submit and stop
+	pthread_cond_t done;		// Signalled on completion
+};
+
+/*-----------------------------------------------------------------------------
+ * Native worker of a queue, runs jobs until the queue is destroyed
+-----------------------------------------------------------------------------*/
+static void* queue_worker( void* arg ){
+	brm_queue* Q = arg;
+	pthread_mutex_lock( &Q->lock );
+	while( 1 ){
+		while( Q->head == NULL && !Q->stop ){
+			pthread_cond_wait( &Q->work, &Q->lock );
+		}
+		if( Q->head == NULL ){
+			break;										//Stopped and drained
+		}
+		struct JOB* J = Q->head;
+		Q->head = J->next;
+		if( Q->head == NULL ){
+			Q->tail = NULL;
+		}
+		pthread_mutex_unlock( &Q->lock );
+
+		J->done.ret = brm_plan_stage_one( J->plan, J->m, J->k, J->mode, J->workers, &J->done.res );
+		J->next = NULL;
+
+		pthread_mutex_lock( &Q->lock );
+		if( Q->dtail != NULL ){
+			Q->dtail->next = J;
+		}
+		else{
+			Q->dhead = J;
+		}
+		Q->dtail = J;
+		pthread_cond_signal( &Q->done );
+	}
+	pthread_mutex_unlock( &Q->lock );
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Create a job queue served by threads native workers (0: one per core)
+-----------------------------------------------------------------------------*/
+brm_queue* brm_queue_create( int threads ){
+	brm_queue* Q = calloc( 1, sizeof(brm_queue) );
+	Q->threads = brm_workers( threads );
+	Q->next = 1;
+	pthread_mutex_init( &Q->lock, NULL );
+	pthread_cond_init( &Q->work, NULL );
+	pthread_cond_init( &Q->done, NULL );
+	Q->T = malloc( Q->threads * sizeof(pthread_t) );
+	int i = 0;
+	while( i < Q->threads ){
+		pthread_create( &Q->T[i], NULL, queue_worker, Q );
+		i++;
+	}
+	return Q;
+}
+
+/*-----------------------------------------------------------------------------
+ * Queue stage one for (m, k) on a plan and return at once.
+ *	workers is the number of threads inside the job, 0 means one since the
+ *	queue already runs a job per core. Returns the job handle, which comes
+ *	back in the brm_done of the job.
+-----------------------------------------------------------------------------*/
+uint64_t brm_submit( brm_queue* Q, brm_plan* plan, int m, int k, int mode, int workers ){
+	struct JOB* J = calloc( 1, sizeof(struct JOB) );
+	J->plan = plan;
+	J->m = m;
+	J->k = k;
+	J->mode = mode;
+	J->workers = workers > 0 ? workers : 1;
+	J->done.m = m;
+	J->done.k = k;
+	pthread_mutex_lock( &Q->lock );
+	J->id = Q->next++;
+	J->done.job = J->id;
+	if( Q->tail != NULL ){
+		Q->tail->next = J;
+	}
+	else{
+		Q->head = J;
+	}
+	Q->tail = J;
+	Q->pending++;
+	pthread_cond_signal( &Q->work );
+	pthread_mutex_unlock( &Q->lock );
+	return J->done.job;
+}
+
+/*-----------------------------------------------------------------------------
+ * Take the oldest completed job off the queue, the caller owns done->res.
+ *	Waits for one if block is set and jobs are still running. Returns 0 if
+ *	done was filled, 1 if no job is complete (or pending at all, when
+ *	blocking).
+-----------------------------------------------------------------------------*/
+static int queue_take( brm_queue* Q, struct brm_done* done, int block ){
+	pthread_mutex_lock( &Q->lock );
+	while( block && Q->dhead == NULL && Q->pending > 0 ){
+		pthread_cond_wait( &Q->done, &Q->lock );
+	}
+	struct JOB* J = Q->dhead;
+	if( J != NULL ){
+		Q->dhead = J->next;
+		if( Q->dhead == NULL ){
+			Q->dtail = NULL;
+		}
+		Q->pending--;
+	}
+	pthread_mutex_unlock( &Q->lock );
+	if( J == NULL ){
+		return 1;
+	}
+	*done = J->done;
+	free( J );
+	return 0;
+}
+
+int brm_poll( brm_queue* Q, struct brm_done* done ){
+	return queue_take( Q, done, 0 );
+}
+
+int brm_wait( brm_queue* Q, struct brm_done* done ){
+	return queue_take( Q, done, 1 );
+}
+
+/*-----------------------------------------------------------------------------
+ * Jobs submitted and not yet collected
+-----------------------------------------------------------------------------*/
+uint64_t brm_pending( brm_queue* Q ){
+	pthread_mutex_lock( &Q->lock );
+	uint64_t n = Q->pending;
+	pthread_mutex_unlock( &Q->lock );
+	return n;
+}
+
+/*-----------------------------------------------------------------------------
+ * Run the remaining jobs, stop the workers and free the queue along with
+ *	any results that were not collected
+-----------------------------------------------------------------------------*/
+void brm_queue_destroy( brm_queue* Q ){
+	pthread_mutex_lock( &Q->lock );
+	Q->stop = 1;
+	pthread_cond_broadcast( &Q->work );
+	pthread_mutex_unlock( &Q->lock );
+	int i = 0;
+	while( i < Q->threads ){
+		pthread_join( Q->T[i], NULL );
+		i++;
+	}
+	struct brm_done done;
+	while( brm_poll(Q, &done) == 0 ){
+		brm_result_clear( &done.res );
+	}
+	pthread_mutex_destroy( &Q->lock );
+	pthread_cond_destroy( &Q->work );
+	pthread_cond_destroy( &Q->done );
+	free( Q->T );
+	free( Q );
+}
+
+/**############################################################################
+ **
+ **	GRIDS
+ **
+ **#########################################################################**/
+struct GRID {
+	struct ATTACK* A;			// Attack for max_m and max_k
+	struct SEARCHCTX** S;		// Search context per worker
+	int min_m;					// Shortest word of the grid
+	uint_least64_t** H;			// Histogram of distances per worker and m
+	int* truth;					// Distance of the actual R2 state per m
+};
+
+/*-----------------------------------------------------------------------------
+ * Lowest number of errors of every prefix of the word in the text of a state.
+ *	The rows of a search for the full word hold the search for each of its
+ *	prefixes in their lower bits, since bit b only ever depends on bits
+ *	below it, and row j only on the rows below it. Bit m'-1 of row j at
+ *	text position pos thus tells if the m'-bit prefix ends a match there
+ *	with at most j errors. Only positions inside the window of 2m' bits
+ *	count for that prefix. D[m'-1] is set to the lowest such j, K if none.
+-----------------------------------------------------------------------------*/
+static void grid_state( struct ATTACK* A, struct SEARCHCTX* S, uint_least64_t state, int* D, mp_limb_t* G ){
+	int m = A->m;
+	int K = A->slen;
+	int W = (m + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+
+	if( A->seq != NULL ){
+		bits_window( S->TEXT, A->seq, A->idx[state], A->n );
+	}
+	else{
+		lfsrgen( S->TEXT, A->deg, A->n, A->pol, state, 0, NULL );
+	}
+	ctx_reset( S );
+	memset( G, 0, K * W * sizeof(mp_limb_t) );			//Prefixes settled per row
+	int b = 0;
+	while( b < m ){
+		D[b] = K;
+		b++;
+	}
+
+	int pos = 0;
+	while( pos < A->n ){
+		ctx_step( S, A->B, mpz_tstbit(S->TEXT, pos) );
+		int lo = pos >> 1;								//Prefixes longer than pos/2 bits
+		int j = 0;
+		while( j < K ){
+			int w = lo / GMP_NUMB_BITS;
+			while( w < W ){
+				mp_limb_t z = mpz_getlimbn( S->R[j], w );
+				#if defined SHIFTOR
+				z = ~z;											//Zero bits are matches
+				#endif
+				if( w == lo / GMP_NUMB_BITS ){
+					z &= ~(mp_limb_t)0 << (lo % GMP_NUMB_BITS);
+				}
+				if( w == W-1 && m % GMP_NUMB_BITS ){
+					z &= ((mp_limb_t)1 << (m % GMP_NUMB_BITS)) - 1;
+				}
+				z &= ~G[j*W + w];
+				while( z ){										//Prefixes first matched by row j
+					int bit = __builtin_ctzll( z );
+					D[w*GMP_NUMB_BITS + bit] = j;
+					int i = j;
+					while( i < K ){
+						G[i*W + w] |= (mp_limb_t)1 << bit;
+						i++;
+					}
+					z &= z - 1;
+				}
+				w++;
+			}
+			j++;
+		}
+		pos++;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Grid handler for a range of R2 states
+-----------------------------------------------------------------------------*/
+static void grid_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct GRID* O = arg;
+	struct ATTACK* A = O->A;
+	int K = A->slen;
+	int W = (A->m + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+	int* D = malloc( A->m * sizeof(int) );
+	mp_limb_t* G = malloc( K * W * sizeof(mp_limb_t) );
+
+	uint_least64_t i = from;
+	while( i < to ){
+		grid_state( A, O->S[w], i, D, G );
+		int m = O->min_m;
+		while( m <= A->m ){
+			O->H[w][(m - O->min_m)*(K+1) + D[m-1]]++;
+			if( i == (uint_least64_t)A->SSTATE ){
+				O->truth[m - O->min_m] = D[m-1];
+			}
+			m++;
+		}
+		i++;
+	}
+	free( D );
+	free( G );
+}
+
+/*-----------------------------------------------------------------------------
+ * Stage one for every m in [min_m, max_m] and k in [0, max_k] at once.
+ *	Runs a single search per R2 state with the longest word and max_k
+ *	errors and reads the result of every (m, k) off its rows, see
+ *	grid_state(). Fills grid, to be freed with brm_grid_clear(). Returns 0,
+ *	or -1 if the grid is out of range for the plan.
+-----------------------------------------------------------------------------*/
+int brm_plan_grid( brm_plan* plan, int min_m, int max_m, int max_k, int workers, struct brm_grid* grid ){
+	struct ATTACK A;
+	struct GRID O;
+	memset( grid, 0, sizeof(struct brm_grid) );
+	if( min_m < 1 || min_m > max_m || plan_attack(plan, max_m, max_k, &A, NULL) != 0 ){
+		return -1;
+	}
+	double begin = brm_clock();
+	workers = brm_workers( workers );
+	int ms = max_m - min_m + 1;
+	int K = A.slen;
+
+	O.A = &A;
+	O.min_m = min_m;
+	O.S = malloc( workers * sizeof(struct SEARCHCTX*) );
+	O.H = malloc( workers * sizeof(uint_least64_t*) );
+	O.truth = malloc( ms * sizeof(int) );
+	int w = 0;
+	while( w < workers ){
+		O.S[w] = ctx_get( &A );
+		O.H[w] = calloc( ms * (K+1), sizeof(uint_least64_t) );
+		w++;
+	}
+	uint_least64_t max = mpz_get_ui( A.max );
+	uint_least64_t chunk = (max-1) / (16*workers);
+	if( chunk > 256 )	chunk = 256;
+	if( chunk < 1 )		chunk = 1;
+	pool_run( workers, 1, max, chunk, grid_range, &O );
+
+	grid->min_m = min_m;
+	grid->max_m = max_m;
+	grid->max_k = max_k;
+	grid->candidates = calloc( ms * (max_k+1), sizeof(uint64_t) );
+	grid->found = calloc( ms * (max_k+1), sizeof(int) );
+	grid->distance = malloc( ms * sizeof(int) );
+	int m = 0;
+	while( m < ms ){
+		uint64_t ct = 0;
+		int k = 0;
+		while( k <= max_k ){
+			w = 0;
+			while( w < workers ){
+				ct += O.H[w][m*(K+1) + k];
+				w++;
+			}
+			grid->candidates[m*(max_k+1) + k] = ct;		//States within k errors
+			grid->found[m*(max_k+1) + k] = O.truth[m] <= k;
+			k++;
+		}
+		grid->distance[m] = O.truth[m];
+		m++;
+	}
+
+	w = 0;
+	while( w < workers ){
+		ctx_put( &A, O.S[w] );
+		free( O.H[w] );
+		w++;
+	}
+	free( O.S );	free( O.H );	free( O.truth );
+	grid->runtime = brm_clock() - begin;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the tables of a grid
+-----------------------------------------------------------------------------*/
+void brm_grid_clear( struct brm_grid* grid ){
+	free( grid->candidates );
+	free( grid->found );
+	free( grid->distance );
+	grid->candidates = NULL;
+	grid->found = NULL;
+	grid->distance = NULL;
+}
+
+/**############################################################################
+ **
+ **	ONLINE ATTACKS
+ **
+ **#########################################################################**/
+struct ONLINECAND {
+	int state;				// R2 initial state
+	int score;				// Lowest number of errors of the current word
+	mpz_t* R;				// Rows after the last text position
+	uint_least64_t* col;	// Top bit of every row per text position, bit i is row i
+};
+
+struct brm_online {
+	brm_plan* plan;			// Plan of the attack
+	int deg;				// Polynomial degree
+	uint_least64_t pol;		// Feedback polynomial
+	int m;					// Current word length
+	int K;					// Rows in the error table
+	int workers;			// Workers per extension
+	mpz_t B[2];				// Masks of the current word
+	struct ONLINECAND* C;	// Surviving candidates, ascending
+	uint_least64_t ct;		// Number of survivors
+	struct SEARCHCTX** S;	// Row temporaries per worker
+	int bit;				// Cipher bit being appended
+};
+
+/*-----------------------------------------------------------------------------
+ * Column b of the initial error table, bit i is row i
+-----------------------------------------------------------------------------*/
+static uint_least64_t online_column0( int b, int K ){
+	uint_least64_t rows = K < 64 ? ((uint_least64_t)1 << K) - 1 : ~(uint_least64_t)0;
+	uint_least64_t low = b+1 < 64 ? ((uint_least64_t)1 << (b+1)) - 1 : ~(uint_least64_t)0;
+	#if defined SHIFTOR
+	return low & rows;									//Row i starts with bits below i clear
+	#else
+	return ~low & rows;									//Row i starts with bits below i set
+	#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Rows of the current word that match at one text position, bit i is row i
+-----------------------------------------------------------------------------*/
+static uint_least64_t online_matches( uint_least64_t col, int K ){
+	uint_least64_t rows = K < 64 ? ((uint_least64_t)1 << K) - 1 : ~(uint_least64_t)0;
+	#if defined SHIFTOR
+	return ~col & rows;
+	#else
+	return col & rows;
+	#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Extend one candidate by the pattern bit O->bit.
+ *	A new bit b of the word only depends on bit b-1 of the rows one text
+ *	position earlier and on its own previous value, so the new top column is
+ *	computed from the stored one over the whole window without searching
+ *	again. The rows then get the new bit and the window grows by the two
+ *	text bits of the longer word, searched with the full rows. Sets the
+ *	score of the candidate, m+1 if it no longer matches.
+-----------------------------------------------------------------------------*/
+static void online_extend( struct brm_online* O, struct SEARCHCTX* S, struct ONLINECAND* C ){
+	int m = O->m;										//Bit being added
+	int K = O->K;
+	int n = 2*m;
+	uint_least64_t rows = K < 64 ? ((uint_least64_t)1 << K) - 1 : ~(uint_least64_t)0;
+	uint_least64_t a = online_column0( m-1, K );		//Column m-1 one position earlier
+	uint_least64_t c = online_column0( m, K );			//Column m one position earlier
+	uint_least64_t state = C->state;
+	int best = m+1;
+
+	C->col = realloc( C->col, (n+2) * sizeof(uint_least64_t) );
+	int t = 0;
+	while( t < n ){
+		int Ti;
+		state = lfsr_next( state, O->pol, O->deg, &Ti );
+		uint_least64_t d = C->col[t];					//Column m-1 at this position
+		#if defined SHIFTOR
+			uint_least64_t b = Ti != O->bit ? rows : 0;	//Mismatch sets the bit
+			uint_least64_t y = a << 1;
+			#if defined INC_INSERT
+				y &= c << 1;
+			#endif
+			c = (a | b) & (y | 1) & rows;
+		#else
+			uint_least64_t b = Ti == O->bit ? rows : 0;
+			uint_least64_t y = (a | d) << 1;
+			#if defined INC_INSERT
+				y |= c << 1;
+			#endif
+			c = ((a & b) | y) & rows;
+		#endif
+		a = d;
+		C->col[t] = c;
+		uint_least64_t x = online_matches( c, K );
+		if( (x >> (K-1)) & 1 && __builtin_ctzll(x) < best ){
+			best = __builtin_ctzll( x );
+		}
+		t++;
+	}
+
+	int i = 0;
+	while( i < K ){										//Append the new bit to the rows
+		if( (c >> i) & 1 ){
+			mpz_setbit( C->R[i], m );
+		}
+		else{
+			mpz_clrbit( C->R[i], m );
+		}
+		i++;
+	}
+
+	mpz_t* R = S->R;									//Search the two new text bits
+	S->R = C->R;
+	S->m = m+1;
+	while( t < n+2 ){
+		int Ti;
+		state = lfsr_next( state, O->pol, O->deg, &Ti );
+		int j = ctx_step( S, O->B, Ti );
+		if( j >= 0 && j < best ){
+			best = j;
+		}
+		uint_least64_t col = 0;
+		i = 0;
+		while( i < K ){
+			col |= (uint_least64_t)mpz_tstbit( C->R[i], m ) << i;
+			i++;
+		}
+		C->col[t] = col;
+		t++;
+	}
+	S->R = R;
+	C->score = best;
+}
+
+/*-----------------------------------------------------------------------------
+ * Online handler for a range of candidates
+-----------------------------------------------------------------------------*/
+static void online_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct brm_online* O = arg;
+	uint_least64_t u = from;
+	while( u < to ){
+		online_extend( O, O->S[w], &O->C[u] );
+		u++;
+	}
+}
+
+static void online_free( struct brm_online* O, struct ONLINECAND* C ){
+	int i = 0;
+	while( i < O->K ){
+		mpz_clear( C->R[i] );
+		i++;
+	}
+	free( C->R );
+	free( C->col );
+}
+
+/*-----------------------------------------------------------------------------
+ * Start an online attack with the first m cipher bits of the plan.
+ *	Runs stage one for (m, k) and keeps the rows and the top column of every
+ *	candidate, so that later cipher bits only update the survivors.
+ *	Returns NULL if (m, k) is out of range, k is limited to 63.
+-----------------------------------------------------------------------------*/
+brm_online* brm_online_create( brm_plan* plan, int m, int k, int workers ){
+	struct ATTACK A;
+	struct brm_result res;
+	if( k > 63 || plan_attack(plan, m, k, &A, NULL) != 0 ){
+		return NULL;
+	}
+	brm_plan_stage_one( plan, m, k, BRM_SWEEP_STATES, workers, &res );
+
+	brm_online* O = calloc( 1, sizeof(brm_online) );
+	O->plan = plan;
+	O->deg = A.deg;
+	O->pol = mpz_get_ui( A.pol );
+	O->m = m;
+	O->K = A.slen;
+	O->workers = brm_workers( workers );
+	mpz_init_set( O->B[0], A.B[0] );
+	mpz_init_set( O->B[1], A.B[1] );
+	O->S = malloc( O->workers * sizeof(struct SEARCHCTX*) );
+	int w = 0;
+	while( w < O->workers ){
+		O->S[w] = ctx_get( &A );
+		w++;
+	}
+
+	O->ct = res.candidates;
+	O->C = malloc( (O->ct ? O->ct : 1) * sizeof(struct ONLINECAND) );
+	struct SEARCHCTX* S = O->S[0];
+	uint_least64_t u = 0;
+	while( u < O->ct ){									//Rows and top column of every candidate
+		struct ONLINECAND* C = &O->C[u];
+		C->state = res.states[u];
+		C->score = res.scores[u];
+		C->col = malloc( A.n * sizeof(uint_least64_t) );
+		ctx_reset( S );
+		uint_least64_t state = C->state;
+		int t = 0;
+		while( t < A.n ){
+			int Ti;
+			state = lfsr_next( state, O->pol, O->deg, &Ti );
+			ctx_step( S, A.B, Ti );
+			uint_least64_t col = 0;
+			int i = 0;
+			while( i < O->K ){
+				col |= (uint_least64_t)mpz_tstbit( S->R[i], m-1 ) << i;
+				i++;
+			}
+			C->col[t] = col;
+			t++;
+		}
+		C->R = malloc( O->K * sizeof(mpz_t) );
+		int i = 0;
+		while( i < O->K ){
+			mpz_init_set( C->R[i], S->R[i] );
+			i++;
+		}
+		u++;
+	}
+	brm_result_clear( &res );
+	return O;
+}
+
+/*-----------------------------------------------------------------------------
+ * Append the next cipher bit to the word and drop the candidates that no
+ *	longer match it within k errors. Only the survivors are searched, over
+ *	the window of the longer word. Returns the number of survivors.
+-----------------------------------------------------------------------------*/
+uint64_t brm_online_push( brm_online* O, int bit ){
+	int m = O->m;
+	O->bit = bit & 1;
+	#if defined SHIFTOR
+	mpz_setbit( O->B[1 - O->bit], m );					//Mismatching character gets the bit
+	#else
+	mpz_setbit( O->B[O->bit], m );
+	#endif
+
+	pool_run( O->workers, 0, O->ct, 16, online_range, O );
+
+	uint_least64_t keep = 0;
+	uint_least64_t u = 0;
+	while( u < O->ct ){
+		if( O->C[u].score <= m ){
+			O->C[keep++] = O->C[u];
+		}
+		else{
+			online_free( O, &O->C[u] );
+		}
+		u++;
+	}
+	O->ct = keep;
+	O->m = m+1;
+	return keep;
+}
+
+/*-----------------------------------------------------------------------------
+ * Current word length and survivors of an online attack as a result
+-----------------------------------------------------------------------------*/
+int brm_online_result( brm_online* O, struct brm_result* res ){
+	memset( res, 0, sizeof(struct brm_result) );
+	res->candidates = O->ct;
+	res->states = malloc( (O->ct ? O->ct : 1) * sizeof(int) );
+	res->scores = malloc( (O->ct ? O->ct : 1) * sizeof(int) );
+	uint_least64_t u = 0;
+	while( u < O->ct ){
+		res->states[u] = O->C[u].state;
+		res->scores[u] = O->C[u].score;
+		if( O->C[u].state == O->plan->SSTATE ){
+			res->found = 1;
+		}
+		u++;
+	}
+	return O->m;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free an online attack
+-----------------------------------------------------------------------------*/
+void brm_online_destroy( brm_online* O ){
+	uint_least64_t u = 0;
+	while( u < O->ct ){
+		online_free( O, &O->C[u] );
+		u++;
+	}
+	int w = 0;
+	while( w < O->workers ){
+		ctx_clear( O->S[w] );
+		free( O->S[w] );
+		w++;
+	}
+	mpz_clear( O->B[0] );
+	mpz_clear( O->B[1] );
+	free( O->S );
+	free( O->C );
+	free( O );
+}
+
+/*-----------------------------------------------------------------------------
+ * Bit i of the intercepted cipher of a plan, i below the longest word
+-----------------------------------------------------------------------------*/
+int brm_plan_cipher_bit( brm_plan* plan, int i ){
+	if( i < 0 || i >= plan->max_m ){
+		return -1;
+	}
+	return mpz_tstbit( plan_masks(plan, plan->max_m, NULL)->CIPHER, i );
+}
+
+/**############################################################################
+ **
+ **	TRIALS
+ **
+ **#########################################################################**/
+struct TRIALS {
+	int deg;					// Polynomial degree
+	uint64_t seed;				// Seed of the batch
+	int min_m;					// Grid of every trial
+	int max_m;
+	int max_k;
+	int inner;					// Grid workers per trial
+	struct brm_trials* W;		// Accumulators per worker
+};
+
+/*-----------------------------------------------------------------------------
+ * SplitMix64, the key pair of a trial only depends on the seed and the
+ *	trial number, not on which worker runs it
+-----------------------------------------------------------------------------*/
+static uint64_t splitmix64( uint64_t x ){
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+/*-----------------------------------------------------------------------------
+ * Random nonzero initial states of R1 and R2 for trial t
+-----------------------------------------------------------------------------*/
+void brm_trial_keys( int deg, uint64_t seed, uint64_t t, int* R1, int* R2 ){
+	uint64_t period = ((uint64_t)1 << deg) - 1;
+	uint64_t x = splitmix64( seed ^ splitmix64(t) );
+	*R1 = 1 + x % period;
+	*R2 = 1 + splitmix64( x ) % period;
+}
+
+static int trials_alloc( struct brm_trials* T, int min_m, int max_m, int max_k ){
+	int cells = (max_m - min_m + 1) * (max_k + 1);
+	memset( T, 0, sizeof(struct brm_trials) );
+	T->min_m = min_m;
+	T->max_m = max_m;
+	T->max_k = max_k;
+	T->success = calloc( cells, sizeof(uint64_t) );
+	T->sum = calloc( cells, sizeof(uint64_t) );
+	T->sumsq = calloc( cells, sizeof(double) );
+	T->min = malloc( cells * sizeof(uint64_t) );
+	T->max = calloc( cells, sizeof(uint64_t) );
+	T->hist = calloc( cells * BRM_HISTBINS, sizeof(uint64_t) );
+	int c = 0;
+	while( c < cells ){
+		T->min[c] = UINT64_MAX;
+		c++;
+	}
+	return cells;
+}
+
+/*-----------------------------------------------------------------------------
+ * Trial handler: one plan and one grid pass per trial, counted into the
+ *	accumulators of the worker
+-----------------------------------------------------------------------------*/
+static void trials_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct TRIALS* O = arg;
+	struct brm_trials* T = &O->W[w];
+	int cells = (O->max_m - O->min_m + 1) * (O->max_k + 1);
+	uint_least64_t t = from;
+	while( t < to ){
+		int R1, R2;
+		struct brm_grid g;
+		brm_trial_keys( O->deg, O->seed, t, &R1, &R2 );
+		brm_plan* plan = brm_plan_create( O->deg, R1, R2, O->max_m );
+		brm_plan_grid( plan, O->min_m, O->max_m, O->max_k, O->inner, &g );
+		int c = 0;
+		while( c < cells ){
+			uint64_t ct = g.candidates[c];
+			int bin = 0;
+			while( bin < BRM_HISTBINS-1 && ct >> bin ){	//Bin b holds [2^(b-1), 2^b)
+				bin++;
+			}
+			T->success[c] += g.found[c];
+			T->sum[c] += ct;
+			T->sumsq[c] += (double)ct * ct;
+			if( ct < T->min[c] )	T->min[c] = ct;
+			if( ct > T->max[c] )	T->max[c] = ct;
+			T->hist[c*BRM_HISTBINS + bin]++;
+			c++;
+		}
+		brm_grid_clear( &g );
+		brm_plan_destroy( plan );
+		T->trials++;
+		t++;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Monte Carlo batch of trials random key pairs on the polynomial of deg.
+ *	Every trial runs stage one for the whole grid of m in [min_m, max_m] and
+ *	k in [0, max_k] in a single pass per state; the trials run in parallel
+ *	and share the polynomial tables. The key pairs follow from seed, so a
+ *	batch is reproducible whatever the number of workers. Fills T with the
+ *	success counts and candidate count statistics per (m, k), to be freed
+ *	with brm_trials_clear(). Returns -1 on an invalid degree or grid.
+-----------------------------------------------------------------------------*/
+int brm_trials_run( int deg, int trials, uint64_t seed, int min_m, int max_m, int max_k,
+		int workers, struct brm_trials* T ){
+	struct TRIALS O;
+	memset( T, 0, sizeof(struct brm_trials) );
+	brm_plan* probe = brm_plan_create( deg, 1, 1, max_m );
+	if( probe == NULL || trials < 1 || min_m < 1 || min_m > max_m || max_k < 0 ){
+		if( probe != NULL )	brm_plan_destroy( probe );
+		return -1;
+	}
+	double begin = brm_clock();
+	workers = brm_workers( workers );
+	O.deg = deg;
+	O.seed = seed;
+	O.min_m = min_m;
+	O.max_m = max_m;
+	O.max_k = max_k;
+	O.inner = workers > trials ? workers / trials : 1;	//Few trials: split the sweeps too
+	int pool = workers < trials ? workers : trials;
+	O.W = malloc( pool * sizeof(struct brm_trials) );
+	int w = 0;
+	while( w < pool ){
+		trials_alloc( &O.W[w], min_m, max_m, max_k );
+		w++;
+	}
+	pool_run( pool, 0, trials, 1, trials_range, &O );
+	brm_plan_destroy( probe );							//Tables stayed cached throughout
+
+	int cells = trials_alloc( T, min_m, max_m, max_k );
+	w = 0;
+	while( w < pool ){									//Merge the workers
+		int c = 0;
+		while( c < cells ){
+			T->success[c] += O.W[w].success[c];
+			T->sum[c] += O.W[w].sum[c];
+			T->sumsq[c] += O.W[w].sumsq[c];
+			if( O.W[w].min[c] < T->min[c] )	T->min[c] = O.W[w].min[c];
+			if( O.W[w].max[c] > T->max[c] )	T->max[c] = O.W[w].max[c];
+			int b = 0;
+			while( b < BRM_HISTBINS ){
+				T->hist[c*BRM_HISTBINS + b] += O.W[w].hist[c*BRM_HISTBINS + b];
+				b++;
+			}
+			c++;
+		}
+		T->trials += O.W[w].trials;
+		brm_trials_clear( &O.W[w] );
+		w++;
+	}
+	free( O.W );
+	T->runtime = brm_clock() - begin;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Free the tables of a trial batch
+-----------------------------------------------------------------------------*/
+void brm_trials_clear( struct brm_trials* T ){
+	free( T->success );
+	free( T->sum );
+	free( T->sumsq );
+	free( T->min );
+	free( T->max );
+	free( T->hist );
+	T->success = NULL;
+	T->sum = NULL;
+	T->sumsq = NULL;
+	T->min = NULL;
+	T->max = NULL;
+	T->hist = NULL;
+}
+
+/**############################################################################
+ **
+ **	ESTIMATES
+ **
+ **#########################################################################**/
+#define ESTIMATEZ		1.959963984540054				//Normal quantile of a 95% interval
+#define ESTIMATEFEW		1e-3							//Rate bound low enough for planning
+
+struct ESTIMATE {
+	struct ATTACK* A;			// Attack shared by all workers
+	struct SEARCHCTX** S;		// Search context per worker
+	uint_least64_t N;			// Number of R2 states, 2^deg - 1
+	uint_least64_t a;			// Sample i is the state 1 + (a*i + b) mod N
+	uint_least64_t b;
+	atomic_uint_least64_t hits;	// Sampled wrong states that are candidates
+	atomic_uint_least64_t skipped;	// Samples that hit the actual state
+	struct brm_metrics* W;		// Search CPU time and counters per worker
+};
+
+static uint_least64_t gcd( uint_least64_t a, uint_least64_t b ){
+	while( b ){
+		uint_least64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*-----------------------------------------------------------------------------
+ * Wilson score interval of h successes in n trials
+-----------------------------------------------------------------------------*/
+static void wilson( uint64_t h, uint64_t n, double* low, double* high ){
+	if( n == 0 ){
+		*low = 0;
+		*high = 1;
+		return;
+	}
+	double z2 = ESTIMATEZ * ESTIMATEZ;
+	double p = (double)h / n;
+	double d = 1 + z2 / n;
+	double c = (p + z2 / (2*n)) / d;
+	double w = ESTIMATEZ / d * sqrt( p*(1-p)/n + z2 / (4.0*n*n) );
+	*low = c - w > 0 ? c - w : 0;
+	*high = c + w < 1 ? c + w : 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Estimate handler for samples [from, to) on worker w
+-----------------------------------------------------------------------------*/
+static void estimate_range( void* arg, int w, uint_least64_t from, uint_least64_t to ){
+	struct ESTIMATE* O = arg;
+	struct TIMER T;
+	timer_start( &T );
+	uint_least64_t hits = 0;
+	uint_least64_t skipped = 0;
+	uint_least64_t i = from;
+	while( i < to ){
+		uint_least64_t state = 1 + (O->a * i + O->b) % O->N;
+		if( state == (uint_least64_t)O->A->SSTATE ){
+			skipped++;
+		}
+		else if( search_state(O->A, state, O->S[w]) ){
+			hits++;
+		}
+		i++;
+	}
+	atomic_fetch_add_explicit( &O->hits, hits, memory_order_relaxed );
+	atomic_fetch_add_explicit( &O->skipped, skipped, memory_order_relaxed );
+	timer_stop( &T, &O->W[w], BRM_PHASE_SEARCH );
+}
+
+/*-----------------------------------------------------------------------------
+ * Estimate the stage one candidates of (m, k) from a random sample of R2
+ *	states, without a full sweep.
+ *	The states are drawn without replacement in the order of a random
+ *	affine permutation of [1, 2^deg) from seed, in rounds that double in
+ *	size. Sampling stops once the 95% Wilson interval of the candidate rate
+ *	of the wrong states is within +-precision of the rate (relative), once
+ *	its upper end is below one candidate or ESTIMATEFEW of the states
+ *	(bounded: with few or no hits the relative rule would only stop after
+ *	a full sweep), or after max samples (0: no limit, the whole sweep at
+ *	most). The actual
+ *	state is searched once on its own. Returns 0, or -1 if m is out of
+ *	range for the plan.
+-----------------------------------------------------------------------------*/
+int brm_plan_estimate( brm_plan* plan, int m, int k, double precision, uint64_t max, uint64_t seed,
+		int workers, struct brm_estimate* E ){
+	struct ATTACK A;
+	struct ESTIMATE O;
+	struct brm_metrics run;
+	memset( E, 0, sizeof(struct brm_estimate) );
+	memset( &run, 0, sizeof(run) );
+	if( plan_attack(plan, m, k, &A, &run) != 0 ){
+		return -1;
+	}
+	double begin = brm_clock();
+	workers = brm_workers( workers );
+	if( precision <= 0 )	precision = 0.1;
+	O.A = &A;
+	O.N = ((uint_least64_t)1 << plan->deg) - 1;
+	if( max == 0 || max > O.N )	max = O.N;
+	seed = splitmix64( seed );
+	O.a = 1 + seed % (O.N > 1 ? O.N - 1 : 1);
+	while( gcd(O.a, O.N) != 1 ){						//A permutation needs a unit
+		O.a = O.a % (O.N - 1) + 1;
+	}
+	O.b = splitmix64( seed ) % O.N;
+	atomic_init( &O.hits, 0 );
+	atomic_init( &O.skipped, 0 );
+	O.S = malloc( workers * sizeof(struct SEARCHCTX*) );
+	O.W = calloc( workers, sizeof(struct brm_metrics) );
+	int w = 0;
+	while( w < workers ){
+		O.S[w] = ctx_get( &A );
+		O.S[w]->bits = 0;
+		O.S[w]->exits = 0;
+		w++;
+	}
+	E->found = search_state( &A, plan->SSTATE, O.S[0] );
+
+	uint_least64_t wrong = O.N - 1;						//Every state but the actual one
+	uint_least64_t done = 0;
+	uint_least64_t round = 256 * (uint_least64_t)workers;
+	while( done < max ){
+		uint_least64_t to = max - done > round ? done + round : max;
+		double wall = brm_clock();
+		pool_run( workers, done, to, 64, estimate_range, &O );
+		run.wall[BRM_PHASE_SEARCH] += brm_clock() - wall;
+		run.states += to - done;
+		done = to;
+		round *= 2;
+		E->sampled = done - atomic_load( &O.skipped );
+		E->hits = atomic_load( &O.hits );
+		wilson( E->hits, E->sampled, &E->rate_low, &E->rate_high );
+		E->rate = E->sampled ? (double)E->hits / E->sampled : 0;
+		if( E->hits > 0 && E->rate_high - E->rate_low <= 2 * precision * E->rate ){
+			break;										//Tight enough
+		}
+		if( done < O.N && (E->rate_high * wrong <= 1 || E->rate_high <= ESTIMATEFEW) ){
+			E->bounded = 1;								//Too few to pin down, the bound is the answer
+			break;
+		}
+	}
+	if( E->sampled == wrong ){							//Whole sweep
+		E->exact = 1;
+		E->rate_low = E->rate_high = E->rate;
+	}
+	w = 0;
+	while( w < workers ){
+		ctx_account( O.S[w], &run );
+		ctx_put( &A, O.S[w] );
+		w++;
+	}
+	metrics_workers( &run, O.W, workers );
+	plan_account( plan, &run );
+	free( O.S );
+	free( O.W );
+
+	double R1 = (double)((uint_least64_t)1 << plan->deg);	//R1 states stage two tries per candidate
+	E->candidates = E->rate * wrong + E->found;
+	E->candidates_low = E->rate_low * wrong + E->found;
+	E->candidates_high = E->rate_high * wrong + E->found;
+	E->stage_two = E->candidates * R1;
+	E->stage_two_low = E->candidates_low * R1;
+	E->stage_two_high = E->candidates_high * R1;
+	E->runtime = brm_clock() - begin;
+	return 0;
+}
+
+/**############################################################################
+ **
+ **	MULTI-WINDOW ATTACKS
+ **	Stage one on W windows of a long intercepted stream. Window w starts at
+ **	cipher bit o = w*stride. By then R1 has stepped o times and R2 between
+ **	o and 2o times, depending on clock bits nobody knows. So a candidate of
+ **	the window is stepped back over the whole range [o, 2o] to reach the
+ **	initial state: the window bitmap is dilated by o+1 positions on the
+ **	LFSR cycle. The bitmaps of all windows are then ANDed.
+ **
+ **#########################################################################**/
+
+/*-----------------------------------------------------------------------------
+ * Write the first bits of the cipher of the plan to a stream file, cipher
+ *	bit i in byte i/8 at bit i%8. Returns 1 if it could not be written.
+-----------------------------------------------------------------------------*/
+int brm_plan_stream_write( brm_plan* plan, const char* path, uint64_t bits ){
+	if( bits < 1 || bits > INT_MAX / 2 ){
+		return 1;
+	}
+	mpz_t LCLK;		mpz_init( LCLK );
+	mpz_t LDES;		mpz_init( LDES );
+	mpz_t CIPHER;	mpz_init( CIPHER );
+	lfsrgen( LCLK, plan->deg, bits, plan->pol, plan->CLKSTATE, 0, NULL );
+	lfsrgen( LDES, plan->deg, 2*bits, plan->pol, plan->SSTATE, 0, NULL );
+	genEncrypt( CIPHER, LCLK, LDES, plan->PLAINTEXT, bits );
+	size_t bytes = (bits + 7) / 8;
+	size_t count = 0;
+	unsigned char* buf = calloc( bytes, 1 );
+	mpz_export( buf, &count, -1, 1, 0, 0, CIPHER );	//Least significant byte first
+	mpz_clear( LCLK );
+	mpz_clear( LDES );
+	mpz_clear( CIPHER );
+	FILE* fh = fopen( path, "wb" );
+	int err = fh == NULL || fwrite( buf, 1, bytes, fh ) != bytes;
+	if( fh != NULL && fclose(fh) != 0 ){
+		err = 1;
+	}
+	free( buf );
+	return err;
+}
+
+/*-----------------------------------------------------------------------------
+ * Set len bits of a bitmap of N bits from position from on, wrapping at N
+-----------------------------------------------------------------------------*/
+static void bitmap_fill( uint_least64_t* bm, uint_least64_t N, uint_least64_t from, uint_least64_t len ){
+	while( len > 0 ){
+		uint_least64_t end = from + len < N ? from + len : N;
+		len -= end - from;
+		while( from < end && (from & 63) ){				//Head bits
+			bm[from >> 6] |= (uint_least64_t)1 << (from & 63);
+			from++;
+		}
+		while( from + 64 <= end ){						//Whole words
+			bm[from >> 6] = ~(uint_least64_t)0;
+			from += 64;
+		}
+		while( from < end ){							//Tail bits
+			bm[from >> 6] |= (uint_least64_t)1 << (from & 63);
+			from++;
+		}
+		from = 0;										//Wrap around the cycle
+	}
+}
+
+static int cmp_int( const void* a, const void* b ){
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
+
+/*-----------------------------------------------------------------------------
+ * Multi-window stage one for (m, k) on the stream file at path, which is
+ *	mapped into memory. Window w covers the cipher bits [w*stride,
+ *	w*stride + m) (stride 0: m). Every window sweeps all R2 states on the
+ *	shared plan tables. Its candidates are mapped back to initial states
+ *	as above and intersected with the windows before. survivors, if not
+ *	NULL, gets the states left after each window. The result holds the
+ *	surviving initial states, scored on window 0, and found tells if the
+ *	R2 state of the plan survived. Returns 0, -1 on invalid arguments and 1
+ *	if the stream cannot be read or is too short.
+-----------------------------------------------------------------------------*/
+int brm_plan_windows( brm_plan* plan, const char* path, int m, int k, int windows, uint64_t stride,
+		int workers, uint64_t* survivors, struct brm_result* res ){
+	memset( res, 0, sizeof(struct brm_result) );
+	if( m < 1 || m > plan->max_m || k < 0 || windows < 1 ){
+		return -1;
+	}
+	if( stride == 0 )	stride = m;
+	int fd = open( path, O_RDONLY );
+	struct stat st;
+	if( fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size * 8 < (windows-1) * stride + m ){
+		if( fd >= 0 )	close( fd );
+		return 1;
+	}
+	const unsigned char* bits = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( bits == MAP_FAILED ){
+		return 1;
+	}
+	double begin = brm_clock();
+	uint_least64_t N = plan->P->period;
+	uint_least64_t words = (N + 63) / 64;
+	uint_least64_t* acc = calloc( words, sizeof(uint_least64_t) );
+	uint_least64_t* win = malloc( words * sizeof(uint_least64_t) );
+	struct MASKS W0;									//Window 0, scores the survivors
+	struct ATTACK A0;
+
+	int w = 0;
+	while( w < windows ){
+		struct ATTACK A;
+		struct MASKS W;
+		struct CANDIDATE* C;
+		struct TIMER T;
+		int found;
+		plan_attack( plan, m, k, &A, &res->metrics );
+		timer_start( &T );
+		uint_least64_t o = w * stride;
+		mpz_init( W.CIPHER );
+		int i = 0;
+		while( i < m ){									//Cipher bits of the window
+			if( (bits[(o+i) >> 3] >> ((o+i) & 7)) & 1 ){
+				mpz_setbit( W.CIPHER, i );
+			}
+			i++;
+		}
+		W.B = genAlphabet( ALPHASIZE );
+		genPrefixes( W.B, W.CIPHER, m );
+		*A.CIPHER = *W.CIPHER;
+		A.B = W.B;
+		timer_stop( &T, &res->metrics, BRM_PHASE_PREFIX );
+
+		uint_least64_t ct = stage_one_parallel( &A, workers, 1, N + 1, &C, &found );
+
+		timer_start( &T );
+		memset( win, 0, words * sizeof(uint_least64_t) );
+		uint_least64_t u = 0;
+		while( u < ct ){								//Back to the initial states, R2 stepped o to 2o times
+			uint_least64_t q = plan->P->idx[C[u].istate];
+			if( o + 1 >= N ){
+				bitmap_fill( win, N, 0, N );
+			}
+			else{
+				bitmap_fill( win, N, (q + N - (2*o) % N) % N, o + 1 );
+			}
+			mpz_clear( C[u].X );
+			u++;
+		}
+		free( C );
+		uint_least64_t left;
+		if( w == 0 ){
+			uint_least64_t* t = acc;
+			acc = win;
+			win = t;
+			left = ct;
+			W0 = W;
+			A0 = A;
+		}
+		else{
+			left = KERNEL->and_count( acc, win, words );
+			mpz_clear( W.CIPHER );
+			mpz_clear( W.B[0] );
+			mpz_clear( W.B[1] );
+			free( W.B );
+		}
+		if( survivors != NULL ){
+			survivors[w] = left;
+		}
+		timer_stop( &T, &res->metrics, BRM_PHASE_STORE );
+		w++;
+	}
+	munmap( (void*)bits, st.st_size );
+
+	//-----------------------------------------------------------------------------
+	// Survivors as states, ascending, scored on window 0
+	//-----------------------------------------------------------------------------
+	struct TIMER T;
+	timer_start( &T );
+	uint32_t* state = malloc( N * sizeof(uint32_t) );	//State at every position of the cycle
+	uint_least64_t s = 1;
+	while( s <= N ){
+		state[plan->P->idx[s]] = s;
+		s++;
+	}
+	uint_least64_t ct = 0;
+	uint_least64_t i = 0;
+	while( i < words ){
+		ct += __builtin_popcountll( acc[i] );
+		i++;
+	}
+	res->candidates = ct;
+	res->states = malloc( (ct ? ct : 1) * sizeof(int) );
+	res->scores = malloc( (ct ? ct : 1) * sizeof(int) );
+	uint_least64_t u = 0;
+	uint_least64_t p = 0;
+	while( p < N ){
+		if( (acc[p >> 6] >> (p & 63)) & 1 ){
+			res->states[u++] = state[p];
+		}
+		p++;
+	}
+	qsort( res->states, ct, sizeof(int), cmp_int );
+	struct SEARCHCTX* S = ctx_get( &A0 );
+	S->bits = 0;
+	S->exits = 0;
+	u = 0;
+	while( u < ct ){
+		if( A0.seq != NULL ){
+			bits_window( S->TEXT, A0.seq, A0.idx[res->states[u]], A0.n );
+		}
+		else{
+			lfsrgen( S->TEXT, A0.deg, A0.n, A0.pol, res->states[u], 0, NULL );
+		}
+		ctx_search( S, A0.B, 0 );
+		res->scores[u] = S->best;
+		res->found |= res->states[u] == plan->SSTATE;
+		u++;
+	}
+	ctx_account( S, &res->metrics );
+	ctx_put( &A0, S );
+	mpz_clear( W0.CIPHER );
+	mpz_clear( W0.B[0] );
+	mpz_clear( W0.B[1] );
+	free( W0.B );
+	free( state );
+	free( acc );
+	free( win );
+	timer_stop( &T, &res->metrics, BRM_PHASE_STORE );
+	res->metrics.candidates = ct;
+	res->runtime = brm_clock() - begin;
+	plan_account( plan, &res->metrics );
+	return 0;
+}
+
+/**############################################################################
+ **
+ **	DISPATCH
+ **	One binary for every x86-64 machine: the kernels below are generic C
+ **	compiled once per tier with its target attributes (and vectorized in
+ **	optimized builds), so the compiler may use the vector units, popcnt and
+ **	the BMI2 shifts of that tier. The best
+ **	tier the CPU (and OS, for the wider registers) supports is bound when
+ **	the core is loaded. BRM_ISA=scalar|sse42|avx2|avx512 forces a lower
+ **	one; a tier the CPU lacks falls back to the best it has.
+ **
+ **#########################################################################**/
+
+/*-----------------------------------------------------------------------------
+ * words words of a bit array from bit sh of src on, src[words] included
+-----------------------------------------------------------------------------*/
+static inline __attribute__((always_inline)) void window_body( uint_least64_t* restrict W,
+		const uint_least64_t* restrict src, int sh, int words ){
+	int i = 0;
+	if( sh == 0 ){
+		while( i < words ){
+			W[i] = src[i];
+			i++;
+		}
+		return;
+	}
+	while( i < words ){
+		W[i] = (src[i] >> sh) | (src[i+1] << (64 - sh));
+		i++;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Decimate X with the clock bits of seq from pos on and compare the m bits
+ *	with T, stopping at the first that differs. See encrypt_match().
+-----------------------------------------------------------------------------*/
+static inline __attribute__((always_inline)) int decimate_body( const uint_least64_t* seq,
+		uint_least64_t pos, const uint_least64_t* X, const uint_least64_t* T, int m ){
+	int i = 0;
+	int j = 0;
+	while( i < m ){
+		j += (seq[(pos+i) >> 6] >> ((pos+i) & 63)) & 1;	//Decimate by skipping a bit
+		if( ((X[j >> 6] >> (j & 63)) ^ (T[i >> 6] >> (i & 63))) & 1 ){
+			return 0;
+		}
+		i++;
+		j++;
+	}
 	return 1;
 }
+
+/*-----------------------------------------------------------------------------
+ * acc &= win over whole words, returns the bits left
+-----------------------------------------------------------------------------*/
+static inline __attribute__((always_inline)) uint_least64_t and_count_body( uint_least64_t* restrict acc,
+		const uint_least64_t* restrict win, uint_least64_t words ){
+	uint_least64_t ct = 0;
+	uint_least64_t i = 0;
+	while( i < words ){
+		acc[i] &= win[i];
+		ct += __builtin_popcountll( acc[i] );
+		i++;
+	}
+	return ct;
+}
+
+#define KERNEL_TIER( tier, isa ) \
+	isa static void window_##tier( uint_least64_t* W, const uint_least64_t* src, int sh, int words ){ \
+		window_body( W, src, sh, words ); \
+	} \
+	isa static int decimate_##tier( const uint_least64_t* seq, uint_least64_t pos, const uint_least64_t* X, \
+			const uint_least64_t* T, int m ){ \
+		return decimate_body( seq, pos, X, T, m ); \
+	} \
+	isa static uint_least64_t and_count_##tier( uint_least64_t* acc, const uint_least64_t* win, \
+			uint_least64_t words ){ \
+		return and_count_body( acc, win, words ); \
+	} \
+	static const struct KERNELS KERNELS_##tier = { #tier, window_##tier, decimate_##tier, and_count_##tier };
+
+KERNEL_TIER( scalar, )
+#if defined __x86_64__
+KERNEL_TIER( sse42, __attribute__((target("sse4.2,popcnt"), optimize("tree-vectorize"))) )
+KERNEL_TIER( avx2, __attribute__((target("avx2,bmi,bmi2,popcnt"), optimize("tree-vectorize"))) )
+KERNEL_TIER( avx512, __attribute__((target("avx512f,avx512bw,avx512vl,avx512vpopcntdq,bmi,bmi2,popcnt"), optimize("tree-vectorize"))) )
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Bind the kernels when the core is loaded, before any thread can use them
+-----------------------------------------------------------------------------*/
+__attribute__((constructor)) static void kernels_bind( void ){
+	KERNEL = &KERNELS_scalar;
+#if defined __x86_64__
+	const struct KERNELS* tiers[] = { &KERNELS_scalar, &KERNELS_sse42, &KERNELS_avx2, &KERNELS_avx512 };
+	__builtin_cpu_init();
+	int best = 0;										//Best tier of the CPU
+	if( __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt") ){
+		best = 1;
+		if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") ){
+			best = 2;
+			if( __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+					__builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vpopcntdq") ){
+				best = 3;
+			}
+		}
+	}
+	const char* want = getenv( "BRM_ISA" );
+	int t = 0;
+	while( want != NULL && t < best && strcmp(want, tiers[t]->name) != 0 ){
+		t++;
+	}
+	KERNEL = tiers[want != NULL ? t : best];
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Kernel tier in use: scalar, sse42, avx2 or avx512
+-----------------------------------------------------------------------------*/
+const char* brm_isa( void ){
+	return KERNEL->name;
+}
+
+/**############################################################################
+ **
+ **	PLANNER
+ **	Picks the stage one engine of an attack from a cost model of the host.
+ **	The engines give the same candidates and differ only in speed:
+ **		states		per state search on a window of the period table
+ **		generate	per state search on a generated sequence, what the
+ **					state sweep does for 2m > SEQPAD
+ **		arcs		one stream per arc of the cycle, where a cheap filter
+ **					skips the windows that cannot align (the arc sweep)
+ **	How often the filter lets a window through depends on m and k/m far
+ **	more than the search cost does, so no closed formula fits all three.
+ **	The model is a grid of measured seconds per state over word lengths
+ **	and error ratios, interpolated in log time and log m. The grid comes
+ **	from a short calibration on this host and is stored as a small text
+ **	file, calibrated again only for another build variant or kernel tier.
+ **
+ **#########################################################################**/
+#define PROFILEVERSION	1
+#define CALDEG			16								//Degree of the calibration
+#define CALTIME			0.05							//Least seconds per grid point
+#define CALMS			5
+#define CALRS			4
+
+static const char* ENGINENAMES[BRM_ENGINES] = { "states", "generate", "arcs" };
+static const int CALM[CALMS] = { 16, 32, 64, 128, 256 };	//Word lengths of the grid
+static const double CALR[CALRS] = { 0.05, 0.1, 0.2, 0.3 };	//Error ratios k/m of the grid
+
+static pthread_mutex_t COSTLOCK = PTHREAD_MUTEX_INITIALIZER;	//Guards the grid
+static double COSTS[BRM_ENGINES][CALMS][CALRS];			//Seconds per state
+static int COSTED = 0;									//COSTS holds a calibration
+static int COSTFRESH = 0;								//Calibrated by this process
+
+/*-----------------------------------------------------------------------------
+ * Build variant, as in the cache keys
+-----------------------------------------------------------------------------*/
+static uint32_t profile_variant( void ){
+	uint32_t variant = 0;
+	#if defined SHIFTOR
+	variant |= 1;
+	#endif
+	#if defined INC_INSERT
+	variant |= 2;
+	#endif
+	return variant;
+}
+
+/*-----------------------------------------------------------------------------
+ * Seconds per state of an engine on a calibration plan, over as many states
+ *	as it takes to run CALTIME seconds
+-----------------------------------------------------------------------------*/
+static double profile_time( brm_plan* plan, int engine, int m, int k ){
+	struct ATTACK A;
+	plan_attack( plan, m, k, &A, NULL );
+	if( engine == BRM_ENGINE_GENERATE ){
+		A.seq = NULL;
+	}
+	uint_least64_t len = 64;
+	while( 1 ){
+		struct CANDIDATE* C;
+		int found;
+		uint_least64_t ct;
+		double begin = brm_clock();
+		if( engine == BRM_ENGINE_ARCS ){
+			ct = stage_one_arcs( &A, 1, 0, len, &C, &found );
+		}
+		else{
+			ct = stage_one_parallel( &A, 1, 1, 1 + len, &C, &found );
+		}
+		double t = brm_clock() - begin;
+		uint_least64_t u = 0;
+		while( u < ct ){
+			mpz_clear( C[u].X );
+			u++;
+		}
+		free( C );
+		if( t >= CALTIME || 2*len >= plan->P->period ){
+			return t / len;
+		}
+		len *= 2;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Measure the grid of every engine. Holds COSTLOCK.
+-----------------------------------------------------------------------------*/
+static void profile_calibrate( void ){
+	brm_plan* plan = brm_plan_create( CALDEG, 1234, 99, CALM[CALMS-1] );
+	int e = 0;
+	while( e < BRM_ENGINES ){
+		int i = 0;
+		while( i < CALMS ){
+			int j = 0;
+			while( j < CALRS ){
+				COSTS[e][i][j] = profile_time( plan, e, CALM[i], (int)(CALM[i] * CALR[j] + 0.5) );
+				j++;
+			}
+			i++;
+		}
+		e++;
+	}
+	brm_plan_destroy( plan );
+	COSTED = 1;
+	COSTFRESH = 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Read the profile at path if it was calibrated for this variant and
+ *	kernel tier. Returns 1 if there is none. Holds COSTLOCK.
+-----------------------------------------------------------------------------*/
+static int profile_read( const char* path ){
+	FILE* fh = fopen( path, "r" );
+	if( fh == NULL ){
+		return 1;
+	}
+	unsigned version, variant, ms, rs;
+	char isa[16];
+	double c[BRM_ENGINES][CALMS][CALRS];
+	int ok = fscanf( fh, "BRMPROFILE %u %u %15s %u %u", &version, &variant, isa, &ms, &rs ) == 5 &&
+		version == PROFILEVERSION && variant == profile_variant() && strcmp(isa, brm_isa()) == 0 &&
+		ms == CALMS && rs == CALRS;
+	int e = 0;
+	while( ok && e < BRM_ENGINES ){
+		char name[16];
+		ok = fscanf( fh, "%15s", name ) == 1 && strcmp(name, ENGINENAMES[e]) == 0;
+		int i = 0;
+		while( ok && i < CALMS * CALRS ){
+			ok = fscanf( fh, "%lg", &c[e][i / CALRS][i % CALRS] ) == 1 && c[e][i / CALRS][i % CALRS] > 0;
+			i++;
+		}
+		e++;
+	}
+	fclose( fh );
+	if( !ok ){
+		return 1;
+	}
+	memcpy( COSTS, c, sizeof(COSTS) );
+	COSTED = 1;
+	COSTFRESH = 0;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Load the cost profile from path, or calibrate the host (a few seconds)
+ *	and store it there. NULL keeps the profile in memory only. Returns 1 if
+ *	the new profile could not be written; it is still used.
+-----------------------------------------------------------------------------*/
+int brm_planner_open( const char* path ){
+	pthread_mutex_lock( &COSTLOCK );
+	if( path != NULL && profile_read(path) == 0 ){
+		pthread_mutex_unlock( &COSTLOCK );
+		return 0;
+	}
+	profile_calibrate();
+	int err = 0;
+	if( path != NULL ){
+		FILE* fh = fopen( path, "w" );
+		err = fh == NULL;
+		if( fh != NULL ){
+			fprintf( fh, "BRMPROFILE %d %u %s %d %d\n", PROFILEVERSION, profile_variant(), brm_isa(), CALMS, CALRS );
+			int e = 0;
+			while( e < BRM_ENGINES ){
+				fprintf( fh, "%s", ENGINENAMES[e] );		//Seconds per state, m by m, k/m by k/m
+				int i = 0;
+				while( i < CALMS * CALRS ){
+					fprintf( fh, " %.4e", COSTS[e][i / CALRS][i % CALRS] );
+					i++;
+				}
+				fprintf( fh, "\n" );
+				e++;
+			}
+			err = fclose( fh ) != 0;
+		}
+	}
+	pthread_mutex_unlock( &COSTLOCK );
+	return err;
+}
+
+/*-----------------------------------------------------------------------------
+ * Seconds per state of an engine for (m, k) from its grid. Bilinear in
+ *	log time over log m and k/m; m past the grid is extrapolated from the
+ *	nearest cell, k/m is clamped to the grid.
+-----------------------------------------------------------------------------*/
+static double profile_predict( double grid[CALMS][CALRS], int m, int k ){
+	double x = log2( m );
+	double r = (double)k / m;
+	int i = 0;
+	while( i < CALMS-2 && m > CALM[i+1] ){
+		i++;
+	}
+	int j = 0;
+	while( j < CALRS-2 && r > CALR[j+1] ){
+		j++;
+	}
+	if( r < CALR[0] )			r = CALR[0];
+	if( r > CALR[CALRS-1] )		r = CALR[CALRS-1];
+	double u = (x - log2(CALM[i])) / (log2(CALM[i+1]) - log2(CALM[i]));
+	double v = (r - CALR[j]) / (CALR[j+1] - CALR[j]);
+	double lo = (1-v) * log( grid[i][j] ) + v * log( grid[i][j+1] );
+	double hi = (1-v) * log( grid[i+1][j] ) + v * log( grid[i+1][j+1] );
+	return exp( (1-u) * lo + u * hi );
+}
+
+/*-----------------------------------------------------------------------------
+ * Predicted stage one time of every engine for (m, k) on workers threads
+ *	and the fastest applicable one. Calibrates first if no profile is open.
+ *	Returns -1 on invalid arguments.
+-----------------------------------------------------------------------------*/
+int brm_plan_choose( brm_plan* plan, int m, int k, int workers, struct brm_choice* choice ){
+	memset( choice, 0, sizeof(struct brm_choice) );
+	if( m < 1 || m > plan->max_m || k < 0 ){
+		return -1;
+	}
+	pthread_mutex_lock( &COSTLOCK );
+	if( !COSTED ){
+		profile_calibrate();
+	}
+	double c[BRM_ENGINES][CALMS][CALRS];
+	memcpy( c, COSTS, sizeof(COSTS) );
+	choice->calibrated = COSTFRESH;
+	pthread_mutex_unlock( &COSTLOCK );
+
+	choice->deg = plan->deg;
+	choice->m = m;
+	choice->k = k;
+	choice->workers = brm_workers( workers );
+	choice->isa = brm_isa();
+	choice->engine = -1;
+	int e = 0;
+	while( e < BRM_ENGINES ){
+		choice->per_state[e] = profile_predict( c[e], m, k );
+		choice->seconds[e] = choice->per_state[e] * plan->P->period / choice->workers;
+		if( e == BRM_ENGINE_STATES && 2*m > SEQPAD ){	//Longer windows are generated
+			choice->seconds[e] = -1;
+		}
+		if( e == BRM_ENGINE_GENERATE && 2*m <= SEQPAD ){	//The state sweep cuts table windows
+			choice->seconds[e] = -1;
+		}
+		if( choice->seconds[e] >= 0 && (choice->engine < 0 || choice->seconds[e] < choice->seconds[choice->engine]) ){
+			choice->engine = e;
+		}
+		e++;
+	}
+	choice->mode = choice->engine == BRM_ENGINE_ARCS ? BRM_SWEEP_ARCS : BRM_SWEEP_STATES;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Why the engine was chosen, one line of text in buf. Returns its length
+ *	as snprintf() does.
+-----------------------------------------------------------------------------*/
+int brm_choice_report( const struct brm_choice* choice, char* buf, size_t size ){
+	int len = snprintf( buf, size, "deg %d, m %d, k %d on %d workers (%s kernels): %s, predicted %.3g s.",
+		choice->deg, choice->m, choice->k, choice->workers, choice->isa, ENGINENAMES[choice->engine],
+		choice->seconds[choice->engine] );
+	int e = 0;
+	while( e < BRM_ENGINES ){
+		size_t at = (size_t)len < size ? (size_t)len : size;
+		if( choice->seconds[e] < 0 ){
+			len += snprintf( buf + at, size - at, " %s: n/a, 2m %s %d bits of table window;",
+				ENGINENAMES[e], e == BRM_ENGINE_STATES ? ">" : "<=", SEQPAD );
+		}
+		else{
+			len += snprintf( buf + at, size - at, " %s: %.3g us/state, %.3g s;", ENGINENAMES[e],
+				choice->per_state[e] * 1e6, choice->seconds[e] );
+		}
+		e++;
+	}
+	size_t at = (size_t)len < size ? (size_t)len : size;
+	double r = (double)choice->k / choice->m;
+	len += snprintf( buf + at, size - at, " profile %s at deg %d on this host%s",
+		choice->calibrated ? "calibrated now" : "read from file", CALDEG,
+		choice->m > CALM[CALMS-1] || r < CALR[0] || r > CALR[CALRS-1] ? ", (m, k) outside the calibrated grid" : "" );
+	return len;
+}
+
+/**############################################################################
+ **
+ **	GMP ARENA
+ **	Opt-in allocator behind mp_set_memory_functions(). The searches create
+ **	and drop GMP temporaries at a high rate (the legacy engine per row, per
+ **	shift and per bit), which from many threads contends in malloc. Blocks
+ **	up to 64 KB come in power of two classes from a free list of the
+ **	calling thread; larger ones go to malloc. A block freed by another
+ **	thread joins that thread's list. A 16 byte header keeps the class and
+ **	size, so the functions stay installed once set. Every call also updates
+ **	the counters the phase timers read.
+ **
+ **#########################################################################**/
+#define ARENAMIN		4								//Smallest class, 16 bytes
+#define ARENACLASSES	13								//Up to 64 KB
+#define ARENAKEEP		1024							//Blocks kept per class and thread
+#define ARENAHEAD		16								//Header before every block
+#define ARENALARGE		0xffffffffu						//Class of a malloc'd block
+
+struct ARENALIST {
+	void* head[ARENACLASSES];	// Free blocks per class, linked through their first word
+	uint32_t count[ARENACLASSES];
+};
+
+static _Thread_local struct ARENALIST* ARENA = NULL;	//Free lists of the calling thread
+static pthread_key_t ARENAKEY;
+static pthread_once_t ARENAONCE = PTHREAD_ONCE_INIT;
+
+/*-----------------------------------------------------------------------------
+ * A thread with free lists exits: return its blocks to malloc
+-----------------------------------------------------------------------------*/
+static void arena_exit( void* arg ){
+	struct ARENALIST* L = arg;
+	int c = 0;
+	while( c < ARENACLASSES ){
+		while( L->head[c] != NULL ){
+			void* b = L->head[c];
+			L->head[c] = *(void**)b;
+			free( b );
+		}
+		c++;
+	}
+	free( L );
+}
+
+static void arena_key( void ){
+	pthread_key_create( &ARENAKEY, arena_exit );
+}
+
+/*-----------------------------------------------------------------------------
+ * Count a change of the live bytes of the thread
+-----------------------------------------------------------------------------*/
+static inline void arena_count( size_t asked, int64_t change ){
+	ARENAALLOCS++;
+	ARENABYTES += asked;
+	ARENALIVE += change;
+	if( ARENALIVE > ARENAPEAK ){
+		ARENAPEAK = ARENALIVE;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Block of size bytes from the free list of its class, or from malloc
+-----------------------------------------------------------------------------*/
+static void* arena_alloc( size_t size ){
+	uint32_t c = 0;
+	while( c < ARENACLASSES && ((size_t)1 << (ARENAMIN + c)) < size ){
+		c++;
+	}
+	unsigned char* b;
+	if( c == ARENACLASSES ){
+		c = ARENALARGE;
+		b = malloc( ARENAHEAD + size );
+	}
+	else{
+		if( ARENA == NULL ){								//First block of the thread
+			pthread_once( &ARENAONCE, arena_key );
+			ARENA = calloc( 1, sizeof(struct ARENALIST) );
+			pthread_setspecific( ARENAKEY, ARENA );
+		}
+		b = ARENA->head[c];
+		if( b != NULL ){
+			ARENA->head[c] = *(void**)b;
+			ARENA->count[c]--;
+		}
+		else{
+			b = malloc( ARENAHEAD + ((size_t)1 << (ARENAMIN + c)) );
+		}
+	}
+	if( b == NULL ){
+		abort();										//GMP cannot handle a failed allocation either
+	}
+	memcpy( b, &c, sizeof(uint32_t) );
+	memcpy( b + 8, &size, sizeof(size_t) );
+	arena_count( size, size );
+	return b + ARENAHEAD;
+}
+
+/*-----------------------------------------------------------------------------
+ * Return a block to the free list of the calling thread, or to malloc
+-----------------------------------------------------------------------------*/
+static void arena_free( void* ptr, size_t size ){
+	(void)size;
+	unsigned char* b = (unsigned char*)ptr - ARENAHEAD;
+	uint32_t c;
+	size_t had;
+	memcpy( &c, b, sizeof(uint32_t) );
+	memcpy( &had, b + 8, sizeof(size_t) );
+	ARENALIVE -= had;
+	if( c == ARENALARGE || ARENA == NULL || ARENA->count[c] >= ARENAKEEP ){
+		free( b );
+		return;
+	}
+	*(void**)b = ARENA->head[c];
+	ARENA->head[c] = b;
+	ARENA->count[c]++;
+}
+
+/*-----------------------------------------------------------------------------
+ * Grow or shrink a block, in place while it fits its class
+-----------------------------------------------------------------------------*/
+static void* arena_realloc( void* ptr, size_t old, size_t size ){
+	unsigned char* b = (unsigned char*)ptr - ARENAHEAD;
+	uint32_t c;
+	size_t had;
+	memcpy( &c, b, sizeof(uint32_t) );
+	memcpy( &had, b + 8, sizeof(size_t) );
+	if( c != ARENALARGE && size <= ((size_t)1 << (ARENAMIN + c)) ){
+		memcpy( b + 8, &size, sizeof(size_t) );
+		arena_count( size, (int64_t)size - (int64_t)had );
+		return ptr;
+	}
+	void* p = arena_alloc( size );
+	memcpy( p, ptr, old < size ? old : size );
+	arena_free( ptr, old );
+	return p;
+}
+
+/*-----------------------------------------------------------------------------
+ * Route all GMP memory through the arena and count it per phase in the
+ *	metrics. Must come before any other libbrm or GMP call of the process,
+ *	blocks from before would lack the header. Stays on; returns 1 if it was
+ *	already on.
+-----------------------------------------------------------------------------*/
+int brm_arena( void ){
+	static atomic_int on = 0;
+	if( atomic_exchange(&on, 1) ){
+		return 1;
+	}
+	mp_set_memory_functions( arena_alloc, arena_realloc, arena_free );
+	return 0;
+}
@@ -0,0 +1,228 @@
+/**############################################################################
+ ** TITLE:		libbrm
+ ** AUTHOR:		Magnus Overbo
+ ** ABOUT:		Public interface of the BRM attack core. A plan is created once
+ **						per polynomial and cipher (R1, R2) and holds everything the
+ **						attacks share: the period sequence of the polynomial, the
+ **						position of every state in it, the ciphertext, the prefix
+ **						masks and search contexts for each (m, k) used so far.
+ **						A plan may be used from many threads at once.
+ **#########################################################################**/
+#ifndef BRM_H
+#define BRM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//-----------------------------------------------------------------------------
+// STRUCTs
+//-----------------------------------------------------------------------------
+typedef struct brm_plan brm_plan;	//Opaque attack plan
+typedef struct brm_queue brm_queue;	//Opaque job queue
+typedef struct brm_online brm_online;	//Opaque online attack
+
+// Phases of the metrics
+#define BRM_PHASE_SEQUENCE	0	// LFSR outputs and the period tables
+#define BRM_PHASE_PREFIX	1	// Ciphertext and prefix masks
+#define BRM_PHASE_SEARCH	2	// Stage one sweep, cutting the state windows included
+#define BRM_PHASE_STORE		3	// Merging, ordering and scoring the candidates
+#define BRM_PHASE_STAGE_TWO	4	// Decimating the candidates with the R1 states
+#define BRM_PHASE_OUTPUT	5	// Candidate logs
+#define BRM_PHASES			6
+
+// Hardware counters of brm_profile()
+#define BRM_PERF_CYCLES			0
+#define BRM_PERF_INSTRUCTIONS	1
+#define BRM_PERF_BRANCH_MISSES	2
+#define BRM_PERF_L1D_MISSES		3	// L1 data cache read misses
+#define BRM_PERF_LLC_MISSES		4	// Last level cache misses
+#define BRM_PERF_EVENTS			5
+
+struct brm_metrics {
+	double wall[BRM_PHASES];	// Wall time per phase in seconds
+	double cpu[BRM_PHASES];		// CPU time per phase in seconds, summed over the workers
+	uint64_t perf[BRM_PHASES][BRM_PERF_EVENTS];	// Hardware counters per phase while profiling
+	uint32_t perf_events;	// Bitmask of the counters in perf, 0 if not profiled
+	uint64_t states;		// R2 states scanned
+	uint64_t bits;			// Text bits searched
+	uint64_t rows;			// Error table rows updated
+	uint64_t exits;			// Searches ended at a match before the end of their text
+	uint64_t candidates;	// Candidates kept
+	uint64_t r1_states;		// (candidate, R1 state) pairs tried by stage two
+	uint64_t cached;		// Stage one runs answered from the result cache
+	uint64_t gmp_allocs[BRM_PHASES];	// GMP allocations and reallocations per phase, with brm_arena()
+	uint64_t gmp_bytes[BRM_PHASES];		// Bytes they asked for
+	uint64_t gmp_peak[BRM_PHASES];		// Highest rise of the live GMP bytes of one thread within the phase
+};
+
+// Trace events, decoded by brm_trace
+#define BRM_EV_STATE_START	1	// Search of an R2 state begins
+#define BRM_EV_STATE_END	2	// Search of a state ends after pos bits, level 1 if it matched
+#define BRM_EV_SATURATED	3	// Every prefix aligns within level errors at pos, the top row no longer filters
+#define BRM_EV_MATCH		4	// Match ending at pos with level errors
+#define BRM_EV_CANDIDATE	5	// State kept as a candidate
+
+struct brm_event {
+	uint64_t time;			// Nanoseconds since brm_trace_start()
+	uint32_t state;			// R2 state of the event
+	uint32_t pos;			// Text position
+	uint16_t level;			// Errors or row
+	uint8_t type;			// BRM_EV_*
+};
+
+struct brm_result {
+	int found;				// Actual R2 initial state is a candidate
+	uint64_t candidates;	// Number of R2 candidates
+	int* states;			// Candidate R2 initial states, ascending
+	int* scores;			// Lowest number of errors of a match per candidate
+	double runtime;			// Wall time of the run in seconds
+	struct brm_metrics metrics;	// Phases and counters of the run
+};
+
+struct brm_grid {
+	int min_m;				// Shortest word of the grid
+	int max_m;				// Longest word of the grid
+	int max_k;				// Most errors of the grid
+	uint64_t* candidates;	// Candidates of (m, k) at [(m-min_m)*(max_k+1) + k]
+	int* found;				// Actual R2 state is a candidate of (m, k), same layout
+	int* distance;			// Lowest errors of the actual R2 state per m, max_k+1 if more
+	double runtime;			// Wall time of the run in seconds
+};
+
+#define BRM_HISTBINS	33	// Bin 0: no candidates, bin b: [2^(b-1), 2^b)
+
+struct brm_trials {
+	int trials;				// Trials run
+	int min_m;				// Grid of the trials, cells laid out as in brm_grid
+	int max_m;
+	int max_k;
+	uint64_t* success;		// Trials with the actual R2 state among the candidates
+	uint64_t* sum;			// Sum of the candidate counts
+	double* sumsq;			// Sum of the squared candidate counts
+	uint64_t* min;			// Fewest candidates of a trial
+	uint64_t* max;			// Most candidates of a trial
+	uint64_t* hist;			// Candidate counts in BRM_HISTBINS log2 bins per cell
+	double runtime;			// Wall time of the batch in seconds
+};
+
+struct brm_estimate {
+	uint64_t sampled;		// Wrong R2 states searched
+	uint64_t hits;			// Sampled states that are candidates
+	int found;				// Actual R2 state is a candidate
+	int exact;				// Every wrong state was searched
+	int bounded;			// Stopped at an upper bound of the rate of 1e-3 or one candidate, see rate_high
+	double rate;			// Candidate rate of the wrong states
+	double rate_low;		// 95% Wilson interval of the rate
+	double rate_high;
+	double candidates;		// Expected candidates of the full sweep, actual state included
+	double candidates_low;
+	double candidates_high;
+	double stage_two;		// Expected (candidate, R1 state) pairs stage two tries
+	double stage_two_low;
+	double stage_two_high;
+	double runtime;			// Wall time in seconds
+};
+
+struct brm_done {
+	uint64_t job;			// Handle returned by brm_submit()
+	int m;					// Search word length of the job
+	int k;					// Allowed errors of the job
+	int ret;				// Return value of brm_plan_stage_one()
+	struct brm_result res;	// Result, freed with brm_result_clear()
+};
+
+struct brm_shard {
+	int deg;				// Polynomial degree
+	int m;					// Search word length
+	int k;					// Allowed errors
+	int R1;					// Initial state of R1 of the cipher
+	int R2;					// Initial state of R2 of the cipher
+	int mode;				// Sweep mode, BRM_SWEEP_*
+	int ranges;				// Number of swept ranges
+	uint64_t* range;		// Swept ranges as from/to pairs
+	uint64_t entries;		// Number of candidates
+	int* states;			// Candidate R2 initial states
+	int* scores;			// Lowest number of errors per candidate
+};
+
+// Stage one sweep modes
+#define BRM_SWEEP_STATES	0	// Work-stealing over R2 state ranges
+#define BRM_SWEEP_ARCS		1	// Streaming over arcs of the LFSR cycle
+
+// Stage one engines of the planner
+#define BRM_ENGINE_STATES	0	// Per state, windows of the period table
+#define BRM_ENGINE_GENERATE	1	// Per state, generated sequences
+#define BRM_ENGINE_ARCS		2	// Streaming over arcs, skipping windows that cannot align
+#define BRM_ENGINES			3
+
+struct brm_choice {
+	int engine;				// Fastest applicable engine, BRM_ENGINE_*
+	int mode;				// Sweep mode that runs it, BRM_SWEEP_*
+	double per_state[BRM_ENGINES];	// Predicted seconds per R2 state and worker
+	double seconds[BRM_ENGINES];	// Predicted stage one wall time, -1 if not applicable
+	int deg;				// Attack the choice is for
+	int m;
+	int k;
+	int workers;
+	const char* isa;		// Kernel tier, see brm_isa()
+	int calibrated;			// Profile calibrated by this process, not read from a file
+};
+
+//-----------------------------------------------------------------------------
+// FUNCTION DECLARATIONs
+//-----------------------------------------------------------------------------
+brm_plan* brm_plan_create( int, int, int, int );		//Plan for deg, R1, R2 and m up to max_m
+void brm_plan_destroy( brm_plan* );
+int brm_plan_stage_one( brm_plan*, int, int, int, int, struct brm_result* );	//Stage one for (m, k)
+int brm_plan_stage_one_range( brm_plan*, int, int, int, int, uint64_t, uint64_t, struct brm_result* );	//Part of stage one
+int brm_plan_stage_two( brm_plan*, int, const struct brm_result*, int, int*, int* );	//Stage two on stage one candidates
+int brm_plan_stage_one_checkpoint( brm_plan*, int, int, int, int, uint64_t, uint64_t, const char*, double, int, struct brm_result* );	//Resumable stage one
+int brm_plan_stage_two_checkpoint( brm_plan*, int, const struct brm_result*, int, const char*, double, int, int*, int* );	//Resumable stage two
+int brm_plan_grid( brm_plan*, int, int, int, int, struct brm_grid* );	//Stage one for a whole (m, k) grid
+int brm_plan_estimate( brm_plan*, int, int, double, uint64_t, uint64_t, int, struct brm_estimate* );	//Sampled candidate rate
+int brm_plan_stream_write( brm_plan*, const char*, uint64_t );	//Cipher of the plan as a bit stream file
+int brm_plan_windows( brm_plan*, const char*, int, int, int, uint64_t, int, uint64_t*, struct brm_result* );	//Stage one over stream windows
+int brm_planner_open( const char* );			//Load or calibrate the cost profile
+int brm_plan_choose( brm_plan*, int, int, int, struct brm_choice* );	//Fastest engine for (m, k)
+int brm_choice_report( const struct brm_choice*, char*, size_t );	//Why it was chosen
+int brm_plan_pipeline( brm_plan*, int, int, int, int, int*, int* );	//Pipelined stage one -> two
+int brm_plan_write( brm_plan*, int, const struct brm_result*, const char* );	//Candidate log
+void brm_result_clear( struct brm_result* );
+void brm_grid_clear( struct brm_grid* );
+void brm_plan_metrics( brm_plan*, struct brm_metrics* );	//Totals of every run on the plan
+int brm_metrics_write( const char*, const char*, const struct brm_metrics* );	//Append as a JSON line
+int brm_trace_start( const char* );			//Binary event trace, needs BRM_TRACE
+int brm_trace_stop( void );
+int brm_cache_open( const char*, uint64_t );		//Result cache of stage one, NULL closes it
+const char* brm_isa( void );						//Kernel tier bound at load time, BRM_ISA overrides
+int brm_arena( void );							//GMP memory from per-thread free lists, call before anything else
+int brm_profile( int );							//Hardware counters per phase, returns the events available
+
+void brm_shard_range( int, int, int, int, uint64_t*, uint64_t* );	//Part i of N of a sweep
+int brm_shard_write( const struct brm_shard*, const char* );	//Self-describing result file
+int brm_shard_read( struct brm_shard*, const char* );
+void brm_shard_rank( struct brm_shard* );				//Best candidates first
+void brm_shard_clear( struct brm_shard* );
+
+int brm_trials_run( int, int, uint64_t, int, int, int, int, struct brm_trials* );	//Monte Carlo batch
+void brm_trial_keys( int, uint64_t, uint64_t, int*, int* );	//Key pair of a trial
+void brm_trials_clear( struct brm_trials* );
+
+int brm_plan_cipher_bit( brm_plan*, int );		//Bit of the intercepted cipher
+
+brm_online* brm_online_create( brm_plan*, int, int, int );	//Online attack from the first m cipher bits
+uint64_t brm_online_push( brm_online*, int );	//Next cipher bit, returns the survivors
+int brm_online_result( brm_online*, struct brm_result* );	//Survivors, returns the word length
+void brm_online_destroy( brm_online* );
+
+brm_queue* brm_queue_create( int );			//Native worker pool, 0: one per core
+uint64_t brm_submit( brm_queue*, brm_plan*, int, int, int, int );	//Queue stage one, returns the handle
+int brm_poll( brm_queue*, struct brm_done* );	//Completed job if any, never blocks
+int brm_wait( brm_queue*, struct brm_done* );	//Next completed job, blocks
+uint64_t brm_pending( brm_queue* );				//Jobs not yet collected
+void brm_queue_destroy( brm_queue* );
+
+int brm( int, int, int, int, int );						//Legacy one-shot stage one
+int brm_pipeline( int, int, int, int, int, int, int, int*, int* );	//Legacy one-shot pipeline
+
+#endif
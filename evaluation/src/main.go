@@ -7,29 +7,40 @@
 
 package main
 
-// #cgo LDFLAGS: -lgmp
-// #cgo CFLAGS: -DSHIFTOR -DINC_INSERT
-// #include "brm.c"
+// #cgo LDFLAGS: -lgmp -lpthread -lm
+// #cgo CFLAGS: -DSHIFTOR -DINC_INSERT -DBRM_TRACE
+// #include <stdlib.h>
+// #include "brm.h"
 import "C"
 
 import (
+	"bufio"
+	"flag"
 	"fmt"
 	"time"
+	"net"
 	"os"
-	"os/exec"
-	"strconv"
+	"runtime"
+	"sort"
+	"strings"
 	"sync"
 	"math"
 	"math/rand"
+	"unsafe"
     "github.com/schollz/progressbar/v3"
 )
 
-func getCands3(pol int, m int, k int, i1 int, i2 int, c chan string, wg *sync.WaitGroup, bar *progressbar.ProgressBar) { // Not in use! For legacy use with old binary.
-	err := exec.Command("../../main", strconv.Itoa(pol), strconv.Itoa(m), strconv.Itoa(k), strconv.Itoa(i1), strconv.Itoa(i2)).Run()
+func getCands3(pol int, m int, k int, i1 int, i2 int, c chan string, wg *sync.WaitGroup, bar *progressbar.ProgressBar) { // Not in use! For legacy use with a daemon started as ../../main --socket /tmp/brm.sock
+	conn, err := net.Dial("unix", "/tmp/brm.sock")
     var ret string
     var s int
 	//score := float64(m)/float64(k)
-    if err != nil { // No match found
+    if err == nil {
+    	fmt.Fprintf(conn, "%d_%d one %d %d %d %d %d 1\n", m, k, pol, m, k, i1, i2)
+    	ret, err = bufio.NewReader(conn).ReadString('\n')
+    	conn.Close()
+    }
+    if err != nil || !strings.Contains(ret, " found=1 ") { // No match found
     	s = 1
     	//fmt.Println(err)
     } else {
@@ -42,17 +53,308 @@ func getCands3(pol int, m int, k int, i1 int, i2 int, c chan string, wg *sync.Wa
     defer wg.Done()
 }
 
-func getCandidates(pol int, m int, k int, i1 int, i2 int, c chan string, wg *sync.WaitGroup, bar *progressbar.ProgressBar) {
-    r :=  C.brm(C.int(pol), C.int(m), C.int(k), C.int(i1), C.int(i2))
-    var ret string
+type job struct {
+	m         int       // Search word length
+	k         int       // Allowed errors
+	cost      int       // Estimated cost, text length times rows or predicted us with -auto
+	mode      int       // Sweep mode, BRM_SWEEP_*
+	submitted time.Time // When the job was queued
+}
 
-	if r == 0 { // Match found
-    	ret = fmt.Sprintf("%d,%d,%d,%d", pol, m, k, r)
-    	c <- ret
-	} 
+type result struct {
+	pol        int     // LFSR polynomial degree
+	m          int     // Search word length
+	k          int     // Allowed errors
+	r1         int     // Initial state of R1
+	r2         int     // Initial state of R2
+	found      int     // 1 if R2 is among the candidates
+	candidates uint64  // Number of R2 candidates
+	stageOne   float64 // Stage one seconds
+	queued     float64 // Seconds waiting in the job queue
+	write      float64 // Seconds writing the candidate log
+	search     float64 // Wall seconds of the stage one sweep
+	searchCPU  float64 // CPU seconds of the sweep over all workers
+	store      float64 // Seconds merging and scoring the candidates
+	bits       uint64  // Text bits searched
+	rows       uint64  // Error table rows updated
+	exits      uint64  // Searches ended at an early match
+	cached     uint64  // 1 if stage one came from the result cache
+}
+
+const resultHeader = "pol,m,k,r1,r2,found,candidates,stage_one_s,queue_s,write_s,search_s,search_cpu_s,store_s,bits,rows,exits,cached\n"
+
+// metricsPath is where -metrics appends the native metrics of every job.
+var metricsPath string
+
+func getCandidates(plan *C.brm_plan, pol int, i1 int, i2 int, done *C.struct_brm_done, wall time.Duration, c chan result, bar *progressbar.ProgressBar) {
+	m := int(done.m)
+	k := int(done.k)
+	res := &done.res // Stage one ran on the native pool of the job queue
+
+	begin := time.Now()
+	fname := C.CString(fmt.Sprintf("./data/%d_%d_%d_%d_%d_candidates.log", pol, m, k, i1, i2))
+	C.brm_plan_write(plan, C.int(m), res, fname)
+	C.free(unsafe.Pointer(fname))
+
+	mt := &res.metrics
+	r := result{pol: pol, m: m, k: k, r1: i1, r2: i2, found: int(res.found), candidates: uint64(res.candidates),
+		stageOne: float64(res.runtime), queued: wall.Seconds() - float64(res.runtime), write: time.Since(begin).Seconds(),
+		search: float64(mt.wall[C.BRM_PHASE_SEARCH]), searchCPU: float64(mt.cpu[C.BRM_PHASE_SEARCH]),
+		store: float64(mt.wall[C.BRM_PHASE_STORE]), bits: uint64(mt.bits), rows: uint64(mt.rows), exits: uint64(mt.exits),
+		cached: uint64(mt.cached)}
+	if r.cached != 0 {
+		r.queued = wall.Seconds() // The stored runtime is that of the original search
+	}
+	if metricsPath != "" {
+		writeMetrics(fmt.Sprintf("%d_%d_%d_%d_%d", pol, m, k, i1, i2), mt)
+	}
+	C.brm_result_clear(res)
+	c <- r
 
 	bar.Add(1)
-	defer wg.Done()
+}
+
+// getGrid runs stage one for every (m, k) of the sweep in a single pass per
+// R2 state. There are no candidate logs; every row shares the time of the pass.
+func getGrid(plan *C.brm_plan, pol int, min_m int, max_m int, err_ratio int, i1 int, i2 int, workers int, c chan result, bar *progressbar.ProgressBar) {
+	var g C.struct_brm_grid
+	max_k := max_m / err_ratio
+	if C.brm_plan_grid(plan, C.int(min_m), C.int(max_m), C.int(max_k), C.int(workers), &g) != 0 {
+		panic("invalid grid")
+	}
+	cells := (max_m - min_m + 1) * (max_k + 1)
+	candidates := (*[1 << 30]C.uint64_t)(unsafe.Pointer(g.candidates))[:cells:cells]
+	found := (*[1 << 30]C.int)(unsafe.Pointer(g.found))[:cells:cells]
+	for i := min_m; i <= max_m; i++ {
+		for j := 1; j <= (i / err_ratio); j++ {
+			cell := (i-min_m)*(max_k+1) + j
+			c <- result{pol: pol, m: i, k: j, r1: i1, r2: i2, found: int(found[cell]),
+				candidates: uint64(candidates[cell]), stageOne: float64(g.runtime)}
+			bar.Add(1)
+		}
+	}
+	C.brm_grid_clear(&g)
+}
+
+// getTrials runs a Monte Carlo batch of random key pairs natively, every
+// trial sweeping the whole (m, k) grid, and writes one row per (m, k) with
+// the success count and the distribution of the candidate counts. The log2
+// histogram of the counts goes to hname, one row per non-empty bin.
+func getTrials(fname string, hname string, pol int, min_m int, max_m int, err_ratio int, trials int, seed uint64, workers int) int {
+	var t C.struct_brm_trials
+	max_k := max_m / err_ratio
+	if C.brm_trials_run(C.int(pol), C.int(trials), C.uint64_t(seed), C.int(min_m), C.int(max_m), C.int(max_k), C.int(workers), &t) != 0 {
+		panic("invalid trial batch")
+	}
+	defer C.brm_trials_clear(&t)
+	cells := (max_m - min_m + 1) * (max_k + 1)
+	success := (*[1 << 30]C.uint64_t)(unsafe.Pointer(t.success))[:cells:cells]
+	sum := (*[1 << 30]C.uint64_t)(unsafe.Pointer(t.sum))[:cells:cells]
+	sumsq := (*[1 << 30]C.double)(unsafe.Pointer(t.sumsq))[:cells:cells]
+	lo := (*[1 << 30]C.uint64_t)(unsafe.Pointer(t.min))[:cells:cells]
+	hi := (*[1 << 30]C.uint64_t)(unsafe.Pointer(t.max))[:cells:cells]
+	bins := cells * C.BRM_HISTBINS
+	hist := (*[1 << 30]C.uint64_t)(unsafe.Pointer(t.hist))[:bins:bins]
+
+	f, err := os.Create(fname)
+	if err != nil {
+		panic(err)
+	}
+	defer f.Close()
+	w := bufio.NewWriter(f)
+	defer w.Flush()
+	w.WriteString("pol,m,k,trials,success,p_success,mean_candidates,sd_candidates,min_candidates,max_candidates\n")
+	hf, err := os.Create(hname)
+	if err != nil {
+		panic(err)
+	}
+	defer hf.Close()
+	hw := bufio.NewWriter(hf)
+	defer hw.Flush()
+	hw.WriteString("pol,m,k,bin,from_candidates,to_candidates,count\n") // Bin b holds [from, to]
+	n := float64(t.trials)
+	found := 0
+	for i := min_m; i <= max_m; i++ {
+		for j := 1; j <= (i / err_ratio); j++ {
+			cell := (i-min_m)*(max_k+1) + j
+			mean := float64(sum[cell]) / n
+			sd := math.Sqrt(math.Max(0, float64(sumsq[cell])/n-mean*mean))
+			fmt.Fprintf(w, "%d,%d,%d,%d,%d,%.6f,%.3f,%.3f,%d,%d\n", pol, i, j, int(t.trials),
+				uint64(success[cell]), float64(success[cell])/n, mean, sd, uint64(lo[cell]), uint64(hi[cell]))
+			if uint64(success[cell]) == uint64(t.trials) {
+				found++
+			}
+			for b := 0; b < C.BRM_HISTBINS; b++ {
+				ct := uint64(hist[cell*C.BRM_HISTBINS+b])
+				if ct == 0 {
+					continue
+				}
+				from, to := uint64(0), uint64(0) // Bin 0: no candidates
+				if b > 0 {
+					from, to = uint64(1)<<(b-1), uint64(1)<<b-1
+				}
+				fmt.Fprintf(hw, "%d,%d,%d,%d,%d,%d,%d\n", pol, i, j, b, from, to, ct)
+			}
+		}
+	}
+	fmt.Printf("%d trials in %.3f s.\n", int(t.trials), float64(t.runtime))
+	return found
+}
+
+// writeMetrics appends the metrics of a run as one JSON line to metricsPath.
+func writeMetrics(run string, mt *C.struct_brm_metrics) {
+	path := C.CString(metricsPath)
+	name := C.CString(run)
+	if C.brm_metrics_write(path, name, mt) != 0 {
+		fmt.Printf("Could not write %s\n", metricsPath)
+	}
+	C.free(unsafe.Pointer(name))
+	C.free(unsafe.Pointer(path))
+}
+
+// collect streams results to f as they arrive, in batches flushed every
+// flushRows rows or flushEvery, so memory stays constant and a crash loses
+// at most one batch. It sends the number of matches on count when c closes.
+func collect(f *os.File, c chan result, count chan int) {
+	const flushRows = 256
+	const flushEvery = 2 * time.Second
+	w := bufio.NewWriterSize(f, 1<<16)
+	if st, err := f.Stat(); err == nil && st.Size() == 0 {
+		w.WriteString(resultHeader)
+	}
+	tick := time.NewTicker(flushEvery)
+	defer tick.Stop()
+	rows, found := 0, 0
+	for {
+		select {
+		case r, ok := <-c:
+			if !ok {
+				w.Flush()
+				count <- found
+				return
+			}
+			fmt.Fprintf(w, "%d,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%d,%d,%d,%d\n", r.pol, r.m, r.k, r.r1, r.r2,
+				r.found, r.candidates, r.stageOne, r.queued, r.write, r.search, r.searchCPU, r.store, r.bits, r.rows, r.exits, r.cached)
+			found += r.found
+			rows++
+			if rows%flushRows == 0 {
+				w.Flush()
+			}
+		case <-tick.C:
+			w.Flush()
+		}
+	}
+}
+
+// getEstimates estimates the candidates of every (m, k) of the sweep from a
+// random sample of R2 states instead of full sweeps, and writes one row per
+// (m, k) with the candidate rate, its 95% interval and the stage two cost.
+func getEstimates(fname string, plan *C.brm_plan, pol int, min_m int, max_m int, err_ratio int, precision float64, samples uint64, seed uint64, workers int) {
+	f, err := os.Create(fname)
+	if err != nil {
+		panic(err)
+	}
+	defer f.Close()
+	w := bufio.NewWriter(f)
+	defer w.Flush()
+	w.WriteString("pol,m,k,sampled,hits,rate,rate_low,rate_high,candidates,candidates_low,candidates_high,stage_two,found,exact,bounded,seconds\n")
+	for i := min_m; i <= max_m; i++ {
+		for j := 1; j <= (i / err_ratio); j++ {
+			var e C.struct_brm_estimate
+			if C.brm_plan_estimate(plan, C.int(i), C.int(j), C.double(precision), C.uint64_t(samples), C.uint64_t(seed), C.int(workers), &e) != 0 {
+				panic("invalid estimate")
+			}
+			fmt.Fprintf(w, "%d,%d,%d,%d,%d,%.6g,%.6g,%.6g,%.1f,%.1f,%.1f,%.4g,%d,%d,%d,%.6f\n", pol, i, j,
+				uint64(e.sampled), uint64(e.hits), float64(e.rate), float64(e.rate_low), float64(e.rate_high),
+				float64(e.candidates), float64(e.candidates_low), float64(e.candidates_high), float64(e.stage_two),
+				int(e.found), int(e.exact), int(e.bounded), float64(e.runtime))
+		}
+	}
+}
+
+// probe is the stage one outcome of one (m, k), kept so no (m, k) is searched twice.
+type probe struct {
+	found      bool    // Actual R2 state is a candidate
+	candidates uint64  // Number of R2 candidates
+	runtime    float64 // Stage one seconds
+}
+
+// getAdaptive finds for every k of the sweep the smallest m at which the
+// actual R2 state is a candidate and at most target candidates remain, and
+// writes one row per k: that m, its candidates and whether the actual state
+// is among them. The candidates shrink as m grows, so the smallest m with
+// few enough of them is found by binary search, starting from the answer of
+// the previous k since they grow with k. The actual state only drops out as
+// m grows, so if it is not a candidate at that m no longer m works for this
+// k. Once even max_m leaves too many, every larger k gets m = -1 without a
+// search (candidates -1 where none was run). That is O(k log m) stage one
+// runs instead of the whole grid. Returns the number of k with a workable m
+// and the number of stage one runs.
+func getAdaptive(fname string, plan *C.brm_plan, pol int, min_m int, max_m int, err_ratio int, target uint64, workers int) (int, int) {
+	memo := make(map[[2]int]probe)
+	run := func(m int, k int) probe {
+		if p, ok := memo[[2]int{m, k}]; ok {
+			return p
+		}
+		var res C.struct_brm_result
+		C.brm_plan_stage_one(plan, C.int(m), C.int(k), C.BRM_SWEEP_STATES, C.int(workers), &res)
+		p := probe{found: res.found != 0, candidates: uint64(res.candidates), runtime: float64(res.runtime)}
+		C.brm_result_clear(&res)
+		memo[[2]int{m, k}] = p
+		return p
+	}
+
+	f, err := os.Create(fname)
+	if err != nil {
+		panic(err)
+	}
+	defer f.Close()
+	w := bufio.NewWriter(f)
+	defer w.Flush()
+	w.WriteString("pol,k,m,candidates,found,probes\n")
+	workable := 0
+	lo := min_m
+	for k := 1; k <= max_m/err_ratio; k++ {
+		before := len(memo)
+		l := lo
+		if l < k*err_ratio {
+			l = k * err_ratio // k may be at most m / err_ratio
+		}
+		if l > max_m || run(max_m, k).candidates > target {
+			n := int64(-1)
+			if p, ok := memo[[2]int{max_m, k}]; ok {
+				n = int64(p.candidates)
+			}
+			fmt.Fprintf(w, "%d,%d,-1,%d,0,%d\n", pol, k, n, len(memo)-before)
+			for k++; k <= max_m/err_ratio; k++ { // Too many even at max_m, more k only adds to them
+				fmt.Fprintf(w, "%d,%d,-1,-1,0,0\n", pol, k)
+			}
+			break
+		}
+		h := max_m
+		for l < h { // Invariant: h has few enough candidates
+			mid := (l + h) / 2
+			if run(mid, k).candidates <= target {
+				h = mid
+			} else {
+				l = mid + 1
+			}
+		}
+		lo = h
+		p := run(h, k)
+		if p.found {
+			workable++
+		}
+		fmt.Fprintf(w, "%d,%d,%d,%d,%d,%d\n", pol, k, h, p.candidates, btoi(p.found), len(memo)-before)
+	}
+	return workable, len(memo)
+}
+
+func btoi(b bool) int {
+	if b {
+		return 1
+	}
+	return 0
 }
 
 func getTotal(min int, max int, err_ratio int) int {
@@ -70,6 +372,49 @@ func checkCollisions() {
 }
 
 func main() {
+	workers := flag.Int("workers", runtime.NumCPU(), "native workers running stage one")
+	inflight := flag.Int("inflight", 0, "most jobs queued at once (0: 2 x workers)")
+	grid := flag.Bool("grid", false, "one search pass per state for the whole (m, k) grid, no candidate logs")
+	trials := flag.Int("trials", 0, "Monte Carlo batch of random key pairs instead of a single sweep")
+	seed := flag.Uint64("seed", uint64(time.Now().UnixNano()), "seed of the -trials key pairs and the -estimate samples")
+	adaptive := flag.Uint64("adaptive", 0, "smallest m per k with the actual R2 state kept and at most this many candidates, by binary search")
+	samples := flag.Uint64("samples", 0, "most R2 states one -estimate samples (0: up to a full sweep)")
+	estimate := flag.Float64("estimate", 0, "estimate the candidates of every (m, k) from R2 samples until the 95% interval is within +-this of the rate")
+	flag.StringVar(&metricsPath, "metrics", "", "append the phase times and counters of every job and the plan totals as JSON lines")
+	perf := flag.Bool("perf", false, "hardware counters per phase in the -metrics output")
+	trace := flag.String("trace", "", "binary event trace of the native searches, decoded by brm_trace")
+	cache := flag.String("cache", "", "directory of the stage one result cache, reruns of a job are read from it")
+	cacheSize := flag.Float64("cachesize", 1024, "cap of the result cache in MB, least recently used results go first")
+	arena := flag.Bool("arena", false, "GMP memory of the native core from per-thread free lists, counted per phase in -metrics")
+	auto := flag.Bool("auto", false, "run every job on the stage one engine the cost profile of the host predicts to be fastest")
+	profile := flag.String("profile", os.Getenv("HOME")+"/.brm_profile", "cost profile of -auto, calibrated on first use")
+	flag.Parse()
+	if *arena {
+		C.brm_arena() // Before the first plan takes any GMP memory
+	}
+	if *cache != "" {
+		dir := C.CString(*cache)
+		if C.brm_cache_open(dir, C.uint64_t(*cacheSize*1048576)) != 0 {
+			fmt.Printf("Could not use %s as the result cache\n", *cache)
+		}
+		C.free(unsafe.Pointer(dir))
+	}
+	if *perf && C.brm_profile(1) == 0 {
+		fmt.Println("Hardware counters unavailable, profiling off")
+	}
+	if *trace != "" {
+		path := C.CString(*trace)
+		if C.brm_trace_start(path) != 0 {
+			fmt.Printf("Could not trace to %s\n", *trace)
+		} else {
+			defer C.brm_trace_stop()
+		}
+		C.free(unsafe.Pointer(path))
+	}
+	if *inflight <= 0 {
+		*inflight = 2 * *workers
+	}
+
 	pol := 11													// LFSR Polynomial
 	min_m := 10													// Minimal m-length for search word
 	max_m := 30													// Maximal m-length for search word
@@ -82,12 +427,20 @@ func main() {
 	scp_upload := 0												// SCP Upload to remote destination
 
 	data_path := "./data"										// System path to store data files				
-	fname := fmt.Sprintf("%s/%d_%d_%d_%d_%d_%d.log", 			// Logfile name
+	fname := fmt.Sprintf("%s/%d_%d_%d_%d_%d_%d.csv", 			// Result file name
 		data_path, pol, min_m, max_m, err_ratio, r1_init, r2_init)					
 	if _, err := os.Stat(data_path); os.IsNotExist(err) {		// Check if path already exist
 		os.Mkdir(data_path, 0666)								// Create folder if not 
 	}
 
+	if *trials > 0 {
+		tname := fmt.Sprintf("%s/%d_%d_%d_%d_trials_%d_%d.csv", data_path, pol, min_m, max_m, err_ratio, *trials, *seed)
+		hname := fmt.Sprintf("%s/%d_%d_%d_%d_trials_%d_%d_hist.csv", data_path, pol, min_m, max_m, err_ratio, *trials, *seed)
+		n := getTrials(tname, hname, pol, min_m, max_m, err_ratio, *trials, *seed, *workers)
+		fmt.Printf("%d of %d sets found the key in every trial, see %s.\n", n, getTotal(min_m, max_m, err_ratio), tname)
+		return
+	}
+
 	if scp_upload == 1 {
 
 	} else {
@@ -95,11 +448,32 @@ func main() {
 	}
 	// fname := 
 
+	plan := C.brm_plan_create(C.int(pol), C.int(r1_init), C.int(r2_init), C.int(max_m)) // Shared by all (m, k)
+	if plan == nil {
+		panic("invalid polynomial degree")
+	}
+	defer C.brm_plan_destroy(plan)
+
+	if *adaptive > 0 {
+		aname := fmt.Sprintf("%s/%d_%d_%d_%d_%d_%d_adaptive_%d.csv", data_path, pol, min_m, max_m, err_ratio, r1_init, r2_init, *adaptive)
+		n, runs := getAdaptive(aname, plan, pol, min_m, max_m, err_ratio, *adaptive, *workers)
+		fmt.Printf("%d values of k have a workable m, %d stage one runs instead of %d, see %s.\n", n, runs, getTotal(min_m, max_m, err_ratio), aname)
+		return
+	}
+
+	if *estimate > 0 {
+		ename := fmt.Sprintf("%s/%d_%d_%d_%d_%d_%d_estimate_%d.csv", data_path, pol, min_m, max_m, err_ratio, r1_init, r2_init, *seed)
+		getEstimates(ename, plan, pol, min_m, max_m, err_ratio, *estimate, *samples, *seed, *workers)
+		fmt.Printf("Estimates written to %s.\n", ename)
+		return
+	}
+
 	total := getTotal(min_m, max_m, err_ratio) // Get total amount of iterations
 	bar := progressbar.Default(int64(total)) // Initialize progressbar
 
-	var wg sync.WaitGroup 
-	c := make(chan string, 1000)
+	queue := C.brm_queue_create(C.int(*workers)) // Fixed native pool, however many jobs there are
+	defer C.brm_queue_destroy(queue)
+	c := make(chan result, 64) // Drained by the collector while the sweep runs
 	//var result []string 
 
 	//for u := 1; u <= 1; u++ {
@@ -115,22 +489,73 @@ func main() {
              panic(err)
     }
     defer f.Close()
+	matches := make(chan int)
+	go collect(f, c, matches)
+
+	if *grid {
+		getGrid(plan, pol, min_m, max_m, err_ratio, r1_init, r2_init, *workers, c, bar)
+	}
 
 	// Iterate with increasing search word lengths.
-	for i := min_m; i <= max_m; i++ {
+	var jobs []job
+	for i := min_m; i <= max_m && !*grid; i++ {
 		// Iterate through increasing error levels, k until we reach the current m / 2
 		for j := 1; j <= (i / 3); j++ {
-			wg.Add(1)
-			go getCandidates(pol, i, j, r1_init, r2_init, c, &wg, bar)
+			jobs = append(jobs, job{m: i, k: j, cost: 2 * i * (j + 1), mode: C.BRM_SWEEP_STATES})
+		}
+	}
+	if *auto && len(jobs) > 0 {
+		path := C.CString(*profile)
+		if C.brm_planner_open(path) != 0 {
+			fmt.Printf("Could not write the profile %s\n", *profile)
+		}
+		C.free(unsafe.Pointer(path))
+		var choice C.struct_brm_choice
+		engines := make(map[int]int)
+		for i := range jobs {
+			C.brm_plan_choose(plan, C.int(jobs[i].m), C.int(jobs[i].k), 1, &choice)
+			jobs[i].mode = int(choice.mode)
+			jobs[i].cost = int(choice.seconds[choice.engine]*1e6) + 1
+			engines[int(choice.engine)]++
 		}
+		why := make([]byte, 512)
+		C.brm_choice_report(&choice, (*C.char)(unsafe.Pointer(&why[0])), C.size_t(len(why)))
+		fmt.Printf("Planner: %d jobs on states, %d on generate, %d on arcs. Last: %s\n", engines[C.BRM_ENGINE_STATES],
+			engines[C.BRM_ENGINE_GENERATE], engines[C.BRM_ENGINE_ARCS], C.GoString((*C.char)(unsafe.Pointer(&why[0]))))
 	}
+	// Most expensive first, so no long job starts at the end of the sweep.
+	sort.SliceStable(jobs, func(a, b int) bool {
+		if jobs[a].cost != jobs[b].cost {
+			return jobs[a].cost > jobs[b].cost
+		}
+		return jobs[a].m > jobs[b].m
+	})
 
-	wg.Wait()
+	// Keep at most inflight jobs queued and collect them as they complete,
+	// a single cgo call waits at a time.
+	running := make(map[uint64]job)
+	next := 0
+	var done C.struct_brm_done
+	for next < len(jobs) || len(running) > 0 {
+		for next < len(jobs) && len(running) < *inflight {
+			jobs[next].submitted = time.Now()
+			h := C.brm_submit(queue, plan, C.int(jobs[next].m), C.int(jobs[next].k), C.int(jobs[next].mode), 1)
+			running[uint64(h)] = jobs[next]
+			next++
+		}
+		if C.brm_wait(queue, &done) != 0 {
+			break
+		}
+		j := running[uint64(done.job)]
+		delete(running, uint64(done.job))
+		getCandidates(plan, pol, r1_init, r2_init, &done, time.Since(j.submitted), c, bar)
+	}
 	close(c)
-
-	for res := range c {
-	    f.WriteString(res+"\n")
-	    count++
+	count = <-matches
+	if metricsPath != "" {
+		var mt C.struct_brm_metrics
+		C.brm_plan_metrics(plan, &mt)
+		writeMetrics(fmt.Sprintf("%d_%d_%d_%d_%d_total", pol, min_m, max_m, r1_init, r2_init), &mt)
 	}
 
 	fmt.Printf("%d of %d potentially valid sets found.\n", count, total)
@@ -17,947 +17,768 @@
 // INCLUDES
 //-----------------------------------------------------------------------------
 #include <stdio.h>
-#include <time.h>
-#include <assert.h>
 #include <stdlib.h>
-#include <string.h>     //strlen
-#include <stdint.h>     //64b Int
-#include <inttypes.h>   //64b int
-#include <gmp.h>        //arbitrary integer size
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "evaluation/src/brm.h"		//Attack core (libbrm)
 
 
-//-----------------------------------------------------------------------------
-// GLOBAL VARIABLES
-//-----------------------------------------------------------------------------
-char* FNAME;				//Output filename
-const int ALPHASIZE = 2;	//Alphabet size, 0 & 1
-int m;		 				//Size of search word
-int n;						//Size of text
-int slen;					//K value
-int deg;					//Polynomial degree
-int SSTATE;		 			//Initial state of R2
-int CLKSTATE;				//Initial state of R1
-int CSTATE;					//Current state holder
-mpz_t PLAINTEXT;			//Message to encipher
-mpz_t TEXT;					//Search text
-mpz_t max;					//Maximum value of the LFSR (all 1's)
-mpz_t pol;		
-
-
-//-----------------------------------------------------------------------------
-// STRUCTs
-//-----------------------------------------------------------------------------
-struct LFSR {
-	mpz_t POLYNOMIAL; //Polynomial definition
-	mpz_t STATE;	  //LFSR state
-	int DEGREE;	  //Polynomial degree
-};
-
-struct CANDIDATE {
-	int istate;		// R2 initial state
-	mpz_t X;		// Undecimated output
+/**############################################################################
+ **
+ **	DAEMON
+ **
+ **	./main --daemon reads jobs from stdin, ./main --socket <path> from every
+ **	connection to a Unix domain socket. One job per line:
+ **
+ **		<id> <op> <deg> <m> <k> <R1> <R2> [threads]
+ **
+ **	op is one (stage one), arcs (stage one over arcs), cands (stage one with
+ **	the candidate states), recover (stage one and two) or pipe (pipelined).
+ **	Each job is answered by one line starting with its id, as soon as it is
+ **	done. "stats" reports the plan cache, "quit" ends the session and
+ **	"shutdown" stops a socket daemon. Plans stay cached between jobs, so the
+ **	polynomial tables, ciphers, masks and search contexts are built once.
+ **#########################################################################**/
+#define PLANCACHE	32									//Most plans kept resident
+
+struct PLANENTRY {
+	int deg;				// Polynomial degree
+	int R1;					// Initial state of R1
+	int R2;					// Initial state of R2
+	int max_m;				// Longest word of the plan
+	brm_plan* plan;			// Cached plan
+	int refs;				// Jobs using the plan
+	unsigned long used;		// Last use, for eviction
+	struct PLANENTRY* next;
 };
 
-//-----------------------------------------------------------------------------
-// FUNCTION DECLARATIONs
-//-----------------------------------------------------------------------------
-mpz_t* genAlphabet( int );					   	//Gen array of the alphabet
-int lfsr_iterate( struct LFSR*);				//Gen next state & output
-void lfsrgen(mpz_t, int, int, mpz_t, uint_least64_t, int, mpz_t*); //Gen LFRS
-mpz_t* arbp_search( mpz_t*, int );              //Main search function
-mpz_t* genError(int);  						   	//Gen init error table
-void genPrefixes( mpz_t*, mpz_t );				//Generate the prefixes
-void genEncrypt( mpz_t, mpz_t, mpz_t );	        //Encrypt the plaintext
-void mpz_lshift( mpz_t, int );					//Left shift bin seq by 1
-int match_R1( struct CANDIDATE*, struct CANDIDATE*, mpz_t*);			//Exact match for the output of genEncrypt
-char* pb( mpz_t, int, int );					//Print prepending zeros
-
-//-----------------------------------------------------------------------------
-//	MAIN FUNCTION
-//-----------------------------------------------------------------------------
-int main(int argc, char *argv[]){
-//int mainrun(int deg, int m, int k, int CLKSTATE, int SSTATE, char* filename) {
-	//-----------------------------------------------------------------------------
-	// We start by creating the target cryptosystem and generating the ciphertext.
-	// After the ciphertext has been created we forget the initial variables. 
-	//-----------------------------------------------------------------------------
+static struct PLANENTRY* PLANS = NULL;
+static int NPLANS = 0;
+static unsigned long TICK = 0;
+static unsigned long HITS = 0;
+static unsigned long MISSES = 0;
+static pthread_mutex_t PLANLOCK = PTHREAD_MUTEX_INITIALIZER;
+static volatile int STOP = 0;
+static int LISTENFD = -1;								//Socket of the daemon
 
-	if( argc != 6 ){	      							//Check required input parameters
-		printf("Incorrect number of arguments\nUsage: ./main <polynomial> <search word length> <errors> <init state R1> <init state R2>\n");
-		return 1;
+/*-----------------------------------------------------------------------------
+ * Cached plan for a cipher that covers m, created if there is none.
+ *	Beyond PLANCACHE plans the least recently used idle one is evicted.
+-----------------------------------------------------------------------------*/
+static struct PLANENTRY* plan_acquire( int deg, int R1, int R2, int m ){
+	pthread_mutex_lock( &PLANLOCK );
+	struct PLANENTRY* e = PLANS;
+	while( e != NULL && !(e->deg == deg && e->R1 == R1 && e->R2 == R2 && e->max_m >= m) ){
+		e = e->next;
 	}
-	double runtime = 0.0;
-	clock_t begin = clock();
-
-	deg = atoi( argv[1] );								//Polynomial degree
-	m		= atoi( argv[2] );							//Search word length
-	slen = atoi( argv[3] ) + 1 ;							//Allowed errors
-	n		= 2*m;										//Search text length 2m
-	CLKSTATE = atoi( argv[4] );							//Set initial state of R1
-	SSTATE = atoi( argv[5] );							//Set initial state of R2
-
-	#if defined DEBUG
-	printf("Degree:\t%d\n", deg);
-	printf("Search word:\t%d\n", m);
-	printf("Search text:\t%d\n", n);
-	printf("Allowed errors:\t%d + 1\n\n", slen-1);
-	#endif
-
-	//FNAME = malloc(60*sizeof(char));					//Filename allocation
-	//sprintf(FNAME, "ciphersearch_L%dM%dK%dI%d_%s.log", deg, m, slen-1, SSTATE, argv[6]);
-
-	
-	mpz_init( max );
-	mpz_setbit(max, deg);								//Set max val, eg 2048 in 2^11
-	
-	mpz_init( pol );
-	char* t = pb(pol,deg, 0);							//Char array for padding bits
-	
-	if( deg == 11 ){									//Set polynomial based on degree
-		mpz_set_ui(pol, 1209);							//2^11 irreducible polynomial
-		#if defined DEBUG
-		printf( "POL: 1209\n" );
-		#endif
-	} 
-	else if( deg == 16 ){								
-		mpz_set_ui(pol, 33262);							//2^16 irreducible polynomial
-		#if defined DEBUG
-		printf( "POL: 33262\n" );
-		#endif
+	if( e != NULL ){
+		HITS++;
 	}
 	else{
-		printf("Invalid polynomial degree\n");
-		return 0;
-	}
-
-	//#if defined DEBUG
-	//printf("START:\t%s\n",  CLKSTATE);					//Debug
-	//#endif
-
-	mpz_init(PLAINTEXT);	
-	mpz_set_ui(PLAINTEXT, 0);							//Default value is 0
-
-	mpz_t*	B	= genAlphabet( ALPHASIZE );				//Generate alphabet
-
-	#if defined DEBUG
-		printf("Generating clocking LFSR (R1) output sequence: \n");
-	#endif
-
-	mpz_t LCLK;		mpz_init(LCLK);						//LFSR for dessimating
-	lfsrgen(LCLK, deg, m, pol, CLKSTATE, 0, NULL);		//Clocking LFSR
-
-	#if defined DEBUG
-		printf("Generating clocked LFSR (R2) output sequence: \n");
-	#endif
-
-	mpz_t LDES;		mpz_init(LDES);						//LFSR to be dessimated
-	lfsrgen(LDES, deg, n, pol, SSTATE, 0, NULL);		//Dessimated LFSR
-
-	#if defined DEBUG
-		printf("Calculating the Decimated bitsequence and creating ciphertext:\n\n");
-	#endif
-	mpz_t CIPHER;	mpz_init( CIPHER );					//Gen intercepted ciphertext
-	genEncrypt(	CIPHER, LCLK, LDES );
-
-	mpz_clear( LCLK );									//Cleanup LFSRs
-	mpz_clear( LDES );
-
-	#if defined DEBUG
-	printf( "Setup:" );
-	printf( "\n\tPOLYNOMIAL:\t%s", t);		mpz_out_str(stdout, 2, pol);
-	free(t);	t = pb(PLAINTEXT, m, 0);
-	printf( "\n\tPLAINTEXT:\t%s", t);	mpz_out_str(stdout, 2, PLAINTEXT);
-	free(t);	t = pb(LCLK, m, 0);
-	printf( "\n\tLFSR R1 SEQ:\t%s", t);	mpz_out_str(stdout, 2, LCLK);
-	free(t);	t = pb(LDES, n, 0);
-	printf( "\n\tLFSR R2 SEQ:\t%s", t);	mpz_out_str(stdout, 2, LDES);
-	free(t);	t = pb(CIPHER,m, 0);
-	printf( "\n\tCIPHERTEXT:\t%s", t);	mpz_out_str(stdout, 2, CIPHER);
-	free(t);	t = pb(B[0], m, 0);
-	#endif
-
-	//-----------------------------------------------------------------------------
-	// At this point, the target (CIPHER) has been created. 
-	// The known-plaintext attack starts here.
-	// TODO; Separate this from main function to enable multithreading.
-	//
-	// Step ONE: Generate prefixes and run ARBP search and choose candidates for R2
-	// Candidates are stored in an array in memory in the form:
-	// <initial state>, <R2 undeciamted output sequence of length n>
-	//-----------------------------------------------------------------------------
-
-	#if defined DEBUG
-		printf("Generating prefixes\n");
-	#endif
-	genPrefixes( B, CIPHER);							//Generate prefixes for the alphabet
-
-	//Output generated data
-	#if defined DEBUG
-		printf( "\n\tB[0]:\t\t%s", t); mpz_out_str(stdout, 2, B[0]);
-		free(t);	t = pb(B[1], m, 0);
-		printf( "\n\tB[1]:\t\t%s", t);	mpz_out_str(stdout, 2, B[1]);
-		free(t);
-		printf( "\n\n" );
-	#endif
-
-
-	mpz_t tmp;		
-	mpz_init( tmp );									// Geneate tmp variable
-	
-	uint_least64_t i = 1;								// initial state counter.
-	uint_least64_t ci = 0;								// Candidate indicator.
-	uint_least64_t ct = 0;								// Total candidate counter.
-	int found = 0;										// Indicator to show if the actual intial state was added to the set
-
-	//struct CANDIDATE C[mpz_get_ui(max)]; 				// Create array for storing candidates.
-
-	struct CANDIDATE* C = malloc( mpz_get_ui(max) * sizeof(struct CANDIDATE) );
-	//struct CANDIDATE C[mpz_get_ui(max)]; 				// Create array for storing candidates.
-
-	//FILE* fh = fopen(FNAME, "w");						// Open output file for writing
-
-	while( mpz_cmp_ui( max, i ) > 0 ){					// Iterate through all initial states of R2
-		CSTATE = i;										// Current state
-		mpz_set_ui( tmp, i);							// For binary display
-		t = pb(tmp, deg, 0);							// Pad tmp with up to deg amount of 0's
-
-		#if defined DEBUG_SEARCH
-			printf("\nINITIAL STATE\t%"PRIu64"\t%s", i, t);
-			mpz_out_str( stdout, 2, tmp);		printf("\n");
-		#endif
-
-		//lfsrgen( TEXT, deg, n, pol, i, 1, B );		// Generate undecimated bitseq TEXT for current initial state
-		lfsrgen( TEXT, deg, n, pol, i, 0, NULL );		// Generate undecimated bitseq TEXT for current initial state
-
-		#if defined DEBUG_SEARCH
-			free(t); t = pb(CIPHER,m,0);
-			printf( "\tCIPHER:\t\t%s", t); mpz_out_str(stdout, 2, CIPHER);
-			printf( "\n\n" );
-			printf( "Perform ARBP search\n" );
-		#endif
-
-		mpz_t*	MATCH = arbp_search(B, slen);			// Run the ARBP search on TEXT with slen errors allowed and return matches with CLD and position. 
-														// TODO; Pass TEXT variable instead of global var. For scalability.
-		free(t);	t = pb(tmp, deg,0);
-
-		//Print initial state and all matches to screen and file
-		#if defined DEBUG_SEARCH
-			printf( "INITSTATE\t%"PRIu64"\n", i);
-			printf("\nMATCH\t" );
-		#endif
-		//fprintf( fh, "INITSTATE\t%"PRIu64"\t\t%s", i, t );
-		//mpz_out_str(fh, 2, tmp);
-		//fprintf( fh, "\nMATCH\t" );
-		free( t );
-
-		int j = 0;
-		// int k = 0;
-		while(j < n){											//For each position
-			if( mpz_cmp_ui(MATCH[j], m) < 0 ){					//If match is less than m
-				// if( k > 0 && (k%15)==0 ){					//Decoration of stdout
-				// 	printf("\n\t");
-					
-				// }
-				// printf( "\t%d:", j); mpz_out_str(stdout, 10, MATCH[j] );
-				// fprintf( fh, " %d:", j);	mpz_out_str( fh, 10, MATCH[j] );
-				mpz_clear( MATCH[j] );
-				// k++;
-				ci++;											//increment counter for print
-			}
-			j++;												//Next position
+		brm_plan* plan = brm_plan_create( deg, R1, R2, m < 256 ? 256 : m );
+		if( plan == NULL ){
+			pthread_mutex_unlock( &PLANLOCK );
+			return NULL;
 		}
-		if (ci > 0) {											//If matches exist, add state to Candidate matrix.
-			if ( CSTATE == SSTATE ) {							//Indicate that actual init state was added as candidate.
-				found = 1;	
+		MISSES++;
+		e = calloc( 1, sizeof(struct PLANENTRY) );
+		e->deg = deg;	e->R1 = R1;	e->R2 = R2;
+		e->max_m = m < 256 ? 256 : m;
+		e->plan = plan;
+		e->next = PLANS;
+		PLANS = e;
+		NPLANS++;
+		while( NPLANS > PLANCACHE ){					//Evict the oldest idle plan
+			struct PLANENTRY** p = &PLANS;
+			struct PLANENTRY** old = NULL;
+			while( *p != NULL ){
+				if( (*p)->refs == 0 && *p != e && (old == NULL || (*p)->used < (*old)->used) ){
+					old = p;
+				}
+				p = &(*p)->next;
 			}
-			C[ct].istate = CSTATE;
-			mpz_init(C[ct].X); mpz_set(C[ct].X, TEXT);
-			ct++;
-			ci = 0;
-		}
-		else {													//No CLD within error limit found.
-			C[ct].istate = 0;
-		}
-
-		// printf( "\n\n" );
-		//fprintf( fh, "\n");
-		//fprintf( fh, "\n" );
-		//fflush( fh );
-
-		i++;													//Next initial state
-		free(MATCH);
-	}
-
-
-	int u=0;
-	struct CANDIDATE* ptr = C;
-	struct CANDIDATE* endPtr = C + (sizeof(*C)/sizeof(struct CANDIDATE) * mpz_get_ui(max));
-	while ( ptr < endPtr ) {
-		if (ptr->istate == 0){
-			break;
+			if( old == NULL ){
+				break;									//All in use
+			}
+			struct PLANENTRY* d = *old;
+			*old = d->next;
+			brm_plan_destroy( d->plan );
+			free( d );
+			NPLANS--;
 		}
-		//fprintf(fh, "\n%i,", ptr->istate); mpz_out_str(fh, 2, ptr->X);
-		u++;
-		ptr++;
 	}
-	//fclose( fh );												//Close data file
-
-	clock_t end = clock();										//Stop runtime timer
-	runtime += (double)(end - begin) / CLOCKS_PER_SEC;
-	//printf("\nRuntime: %f seconds", runtime);	
-	//printf("\nFound %"PRIu64" candidates\n", ct);
-	
-
-
-	//-----------------------------------------------------------------------------
-	// At this point we have created the set of candidates C.
-	// The candidates persist in memory and has been written to file.
-	//
-	// Step TWO: For every candidate in C
-	// 1. Decimate its output and encrypt (add noise)
-	// 2. Compare the ciphertext against the target cipher.
-	//
-	// TODO; The whole string doesn't need to be compared. The bits can be compared
-	// iteratively or in lesser blocks (e.g. 8 bits) to eliminate non-matches quicker
-	//-----------------------------------------------------------------------------
-
-	//match_R1(C, endPtr, &CIPHER);
-
-	// printf("\n");
-	
-	mpz_clear( TEXT );											//Clear variables
-	mpz_clear( PLAINTEXT );
-	mpz_clear( CIPHER );
-	mpz_clear( B[0] );
-	mpz_clear( B[1] );
-	free( B );													//Free up memory
-	// end = clock();												//Stop runtime timer
-	// runtime += (double)(end - begin) / CLOCKS_PER_SEC;
-	// printf("\nRuntime: %f seconds\n", runtime);
-	if (found==1) { 											//Determine if the actual initial state was included in the chosen set
-	// 	printf("The actual initial state (%i) is within the set\n", SSTATE);
-		exit(0);
-	} 
-	else {
-	// 	printf("The actual initial state (%i) is NOT within the set\n", SSTATE);
-	 	exit(1);
-	}
-	exit(0);
+	e->refs++;
+	e->used = ++TICK;
+	pthread_mutex_unlock( &PLANLOCK );
+	return e;
 }
 
+static void plan_release( struct PLANENTRY* e ){
+	pthread_mutex_lock( &PLANLOCK );
+	e->refs--;
+	pthread_mutex_unlock( &PLANLOCK );
+}
 
-/**############################################################################
- **
- **	FUNCTIONS
- **
- **#########################################################################**/
 /*-----------------------------------------------------------------------------
- * Prepend bits to a binary representation of a number.
- *	returns a char pointer to an array filled with missing bits 
- * or nothing if it is already full.
+ * Run one job line and write its answer. Returns 1 when the session ends.
 -----------------------------------------------------------------------------*/
+static int daemon_job( char* line, FILE* out ){
+	char id[64], op[16];
+	int deg, m, k, R1, R2;
+	int threads = 0;
 
+	line[strcspn(line, "\r\n")] = 0;
+	if( line[0] == 0 || line[0] == '#' ){
+		return 0;
+	}
+	if( strcmp(line, "quit") == 0 ){
+		return 1;
+	}
+	if( strcmp(line, "shutdown") == 0 ){
+		STOP = 1;
+		if( LISTENFD >= 0 ){
+			shutdown( LISTENFD, SHUT_RDWR );			//Wake up accept()
+		}
+		return 1;
+	}
+	if( strcmp(line, "stats") == 0 ){
+		pthread_mutex_lock( &PLANLOCK );
+		fprintf(out, "stats plans=%d hits=%lu misses=%lu\n", NPLANS, HITS, MISSES);
+		pthread_mutex_unlock( &PLANLOCK );
+		fflush( out );
+		return 0;
+	}
+	int n = sscanf(line, "%63s %15s %d %d %d %d %d %d", id, op, &deg, &m, &k, &R1, &R2, &threads);
+	if( n < 7 ){
+		fprintf(out, "%.63s error expected <id> <op> <deg> <m> <k> <R1> <R2> [threads]\n", n > 0 ? id : "-");
+		fflush( out );
+		return 0;
+	}
 
-char* pb( mpz_t num, int len, int b ){
-	size_t plen = len+1 - mpz_sizeinbase( num, 2 );
-	if( plen == 0 )
-		return "";
-	char* pre = malloc( plen * sizeof(char) );			//Allocate plen length array
-	int i = 0;
-	while( i < plen-1 ){
-		if( b == 1){
-			pre[i++] = '1';
+	struct PLANENTRY* e = m < 1 || k < 0 ? NULL : plan_acquire( deg, R1, R2, m );
+	if( e == NULL ){
+		fprintf(out, "%s error invalid attack\n", id);
+		fflush( out );
+		return 0;
+	}
+	if( strcmp(op, "one") == 0 || strcmp(op, "arcs") == 0 || strcmp(op, "cands") == 0 ){
+		struct brm_result res;
+		brm_plan_stage_one(e->plan, m, k, strcmp(op, "arcs") == 0 ? BRM_SWEEP_ARCS : BRM_SWEEP_STATES, threads, &res);
+		fprintf(out, "%s %s found=%d candidates=%llu runtime=%f", id, op, res.found,
+			(unsigned long long)res.candidates, res.runtime);
+		if( strcmp(op, "cands") == 0 ){
+			fprintf(out, " states=");
+			uint64_t u = 0;
+			while( u < res.candidates ){
+				fprintf(out, u ? ",%d" : "%d", res.states[u]);
+				u++;
+			}
+		}
+		fprintf(out, "\n");
+		brm_result_clear( &res );
+	}
+	else if( strcmp(op, "recover") == 0 || strcmp(op, "pipe") == 0 ){
+		int r1 = -1;
+		int r2 = -1;
+		if( strcmp(op, "pipe") == 0 ){
+			brm_plan_pipeline(e->plan, m, k, threads, threads, &r1, &r2);
 		}
 		else{
-			pre[i++] = '0';
+			struct brm_result res;
+			brm_plan_stage_one(e->plan, m, k, BRM_SWEEP_ARCS, threads, &res);
+			brm_plan_stage_two(e->plan, m, &res, threads, &r1, &r2);
+			brm_result_clear( &res );
 		}
+		fprintf(out, "%s %s R1=%d R2=%d\n", id, op, r1, r2);
 	}
-	pre[i]='\0';
-	return pre;
+	else{
+		fprintf(out, "%s error unknown op %s\n", id, op);
+	}
+	fflush( out );
+	plan_release( e );
+	return 0;
 }
 
 /*-----------------------------------------------------------------------------
- *	Left shift MPZ_T variable to the left
- *		n number of shift
- *		rop is mpz_t value to shift
+ * Answer the jobs of one session until it ends
 -----------------------------------------------------------------------------*/
-void mpz_lshift( mpz_t rop, int len ) {
-	mpz_t	tmp;	
-	mpz_init( tmp );	//temp variable
-	int i = len-1;
-	while( i > 0 ){
-		if(mpz_tstbit(rop, i-1) == 1){
-			mpz_setbit( tmp, i );		//set bit if it
-		}
-		i--;
-	}
-	mpz_set(rop, tmp);					//Set original var to tmp
-	mpz_clear(tmp);
+static void daemon_session( FILE* in, FILE* out ){
+	char line[256];
+	while( !STOP && fgets(line, sizeof(line), in) != NULL ){
+		if( daemon_job(line, out) ){
+			break;
+		}
+	}
+}
+
+static void* daemon_connection( void* arg ){
+	int fd = (int)(intptr_t)arg;
+	FILE* in = fdopen( fd, "r" );
+	FILE* out = fdopen( dup(fd), "w" );
+	daemon_session( in, out );
+	fclose( in );
+	fclose( out );
+	return NULL;
 }
 
 /*-----------------------------------------------------------------------------
- * Generates the cipher which then becomes the prefix.
- *	Y is the clocking LFSR
- *	X is the encrypting LFSR
- *	Implementation of the BRM
+ * Serve jobs on a Unix domain socket, one thread per connection, until a
+ *	client sends shutdown. Returns 1 if the socket could not be set up.
 -----------------------------------------------------------------------------*/
-void genEncrypt(mpz_t rop, mpz_t CLK, mpz_t DES){
-	int i =	0;
-	int	j = 0;
-	int x, y;
-	char* t;
-	mpz_t CIPHER; mpz_init(CIPHER);
-
-	while( i < m ){						//Counter for clocking lfsr 
-		x = 0;		
-		y = 0;
-		#if defined DEBUG
-			printf("\tCLK(%d)=%d	", i, mpz_tstbit(CLK, i) );
-		#endif
-
-		if( mpz_tstbit(CLK, i) == 1 ){
-				j++;					//Decimate LFSR by skipping a bit
-				#if defined DEBUG
-					printf("\tDES(%d)=%d --> \tDES(%d)=%d", j-1, mpz_tstbit(DES, j-1), j, mpz_tstbit(DES, j) );
-				#endif
-		}
-		#if defined DEBUG
-		else{
-			printf("\t\t\tDES(%d)=%d", j, mpz_tstbit(DES,j));
+static int daemon_socket( const char* path ){
+	struct sockaddr_un addr;
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	if( fd < 0 || strlen(path) >= sizeof(addr.sun_path) ){
+		printf("Could not create socket %s\n", path);
+		return 1;
+	}
+	strcpy( addr.sun_path, path );
+	unlink( path );
+	if( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0 ){
+		printf("Could not listen on %s\n", path);
+		close( fd );
+		return 1;
+	}
+	signal( SIGPIPE, SIG_IGN );							//Clients may hang up early
+	LISTENFD = fd;
+	while( !STOP ){
+		int c = accept( fd, NULL, NULL );
+		if( c < 0 ){
+			continue;
 		}
-		#endif
-
-		//Val of dessimated LFSR output
-		if( mpz_tstbit(DES, j) == 1 )	x = 1;	//grab value of bit
-		if( mpz_tstbit(PLAINTEXT, i) == 1 )		y = 1;	//Grab value of bit
-		if( (y^x) == 1 )	mpz_setbit(CIPHER, i);			//Xor to get CIPHER
-
-		#if defined DEBUG
-		printf(" ^ P(%d)=%d == C(%d)=%d\n", i, mpz_tstbit(PLAINTEXT, i), i, mpz_tstbit(CIPHER, i) );
-		#endif
-		i++;		
-		j++;	//Increment counters
+		pthread_t t;
+		pthread_create( &t, NULL, daemon_connection, (void*)(intptr_t)c );
+		pthread_detach( t );
 	}
-	#if defined DEBUG
-		printf("\n");
-		t = pb(CIPHER, m, 0);
-		printf("\tCIPHERTEXT: %s", t); mpz_out_str(stdout, 2, CIPHER);
-		free(t);
-		printf("\n\n");
-	#endif
-	mpz_set(rop, CIPHER);								//Set var to generated cipher
-	mpz_clear( CIPHER );
+	close( fd );
+	unlink( path );
+	return 0;
 }
 
+
 /*-----------------------------------------------------------------------------
- *	Generate initial m-bitmasks for the alphabet of ALPHASIZE
- *	Shift-OR Complements 1
+ * Append the metrics of every run on the plan to path, named after the
+ *	attack <deg>_<m>_<k>_<R1>_<R2>
 -----------------------------------------------------------------------------*/
-mpz_t* genAlphabet( int ALPHASIZE ){
-	mpz_t* B = malloc((ALPHASIZE)*sizeof( mpz_t ));
-	#if defined DEBUG
-		printf( "Generating masks for the alphabet\n" );
-	#endif
-
-	int i=0;
-	while( i < ALPHASIZE ){
-		mpz_init( B[i] );
-		mpz_set_ui( B[i], 0 );
-		
-		#if defined DEBUG
-			printf("\tB[%d] ",i);
-			mpz_out_str(stdout, 2, B[i]);
-			printf("\n");
-		#endif
-		i++;
+static void write_metrics( brm_plan* plan, const char* path, char* argv[] ){
+	struct brm_metrics M;
+	char run[80];
+	if( path == NULL ){
+		return;
+	}
+	brm_plan_metrics( plan, &M );
+	snprintf( run, sizeof(run), "%s_%s_%s_%s_%s", argv[1], argv[2], argv[3], argv[4], argv[5] );
+	if( brm_metrics_write(path, run, &M) != 0 ){
+		printf("Could not write %s\n", path);
 	}
-	#if defined DEBUG
-		printf( "\tDone\n\n" );
-	#endif
-	return B;
 }
 
 /*-----------------------------------------------------------------------------
- * LFSR iteration function
- *		Calculates the next state of the LFSR by first grabbing the MSB as output
- *		value.  Then it calculates the AND of cur state and the polynomial before
- *		running an XOR on all bits that are set in the temp var to generate the
- *		feedback value.
- *
- *		Finally it left shifts the entire original state and sets the LSB to the
- *		value of the feedback polynomial.
- *
- *		The feedback value is then set
+ * Stage one on [from, to), checkpointed to path unless it is NULL.
+ *	Returns 1 if the run could not be done.
 -----------------------------------------------------------------------------*/
-int lfsr_iterate( struct LFSR* lfsr) {
-	int	i = 0;											//Counter
-	int	fbck = 0;										//XOR calculated value
-	int	ret	= mpz_tstbit( lfsr->STATE, lfsr->DEGREE-1 );
-
-	mpz_t tmp;		
-	mpz_init( tmp );
-	mpz_and(tmp, lfsr->STATE, lfsr->POLYNOMIAL); //AND taps the LFSR according to the given POLYNOMIAL
-
-	while( i < lfsr->DEGREE ){				//Calc feedback
-		fbck = fbck + mpz_tstbit( tmp, i );
-		i++;
+static int stage_one( brm_plan* plan, int m, int k, int mode, int threads, uint64_t from, uint64_t to,
+		const char* path, double every, int resume, struct brm_result* res ){
+	if( path == NULL ){
+		return brm_plan_stage_one_range(plan, m, k, mode, threads, from, to, res) != 0;
 	}
-
-	fbck = fbck % 2; // XOR the feedback bits
-	mpz_lshift(lfsr->STATE, lfsr->DEGREE);	//Left shift
-	if( fbck == 1 )	mpz_setbit( lfsr->STATE, 0 );
-	mpz_clear( tmp );
-	return ret;											//Return output character
+	int ret = brm_plan_stage_one_checkpoint(plan, m, k, mode, threads, from, to, path, every, resume, res);
+	if( ret < 0 ){
+		printf("Invalid run, or %s belongs to another run\n", path);
+		return 1;
+	}
+	if( ret == 1 ){
+		printf("Could not write %s\n", path);
+	}
+	return 0;
 }
 
-
 /*-----------------------------------------------------------------------------
- * Generate LFSR and output an n-length bitsequence
- * With all arbitrary skips until first prefix is met
+ * Write the event trace of -T on every way out of main
 -----------------------------------------------------------------------------*/
-void lfsrgen(mpz_t rop, int psize, int olen, mpz_t p,
-	 					uint_least64_t iv, int skip, mpz_t* B){
-	int i;											//Counter var
-	int initmatch = 0;								//Check if first prefix is found
-	struct LFSR lfsr;								//Create struct variable
-	char* t;
+static void stop_trace( void ){
+	brm_trace_stop();
+}
 
-	lfsr.DEGREE = psize;							//Set polynomial degree
+//-----------------------------------------------------------------------------
+//	MAIN FUNCTION
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[]){
+	//-----------------------------------------------------------------------------
+	// We start by creating the target cryptosystem and generating the ciphertext.
+	// After the ciphertext has been created we forget the initial variables. 
+	//
+	// Options after the initial states:
+	//	-p			Pipelined attack, stage two runs while stage one is searching
+	//	-a			Stream stage one over arcs of the LFSR cycle
+	//	-r			Recover the key pair, stage two runs after stage one
+	//	-t <n>		Worker threads per stage (default: cores)
+	//	-g <min m>	Stage one for every m from min m and k from 0 in one pass
+	//	-e <p>		Estimate the candidates from a sample of R2 states until the
+	//				95% interval is within +-p of the rate or bounds it below
+	//				0.1%, --seed <n> picks it, --samples <n> caps it
+	//	-i <max m>	Online: stage one for m, then refine the candidates as the
+	//				cipher grows bit by bit up to max m
+	//	--shard i/N	Sweep only part i of N of stage one and write a shard file
+	//	-o <file>	Shard file (default: <deg>_<m>_<k>_<R1>_<R2>_<i>of<N>.brm)
+	//	-j <file>	Append the phase times and counters of the run as JSON
+	//	-P			Profile: hardware counters per phase in the -j output
+	//	-T <file>	Binary event trace of the searches, decoded by brm_trace
+	//	--checkpoint <file>	Checkpoint stage one (and stage two in <file>.two)
+	//				every few seconds, see --every
+	//	--resume <file>	Continue from the checkpoint and keep checkpointing to it
+	//	--every <s>	Seconds between checkpoints (default: 60)
+	//	--cache <dir>	Reuse stage one results of earlier runs stored in dir
+	//	--cache-size <MB>	Cap of the cache, least recently used go first (default: 1024)
+	//	--arena		GMP memory from per-thread free lists, counted per phase in -j
+	//	--auto		Pick the stage one engine from the cost profile of the host
+	//				and print why, --profile <file> (default: ~/.brm_profile)
+	//	--stream <file>	Stage one over --windows <W> windows of the cipher bit
+	//				stream in file, --stride <s> bits apart (default: m)
+	//	--make-stream <bits>	First write that many cipher bits to the stream file
+	//
+	// Or run as a daemon: ./main --daemon | --socket <path>
+	//-----------------------------------------------------------------------------
 
-	mpz_init( lfsr.POLYNOMIAL );
-	mpz_set(lfsr.POLYNOMIAL, p);					//Set polynomial
+	if( argc == 2 && strcmp(argv[1], "--daemon") == 0 ){
+		daemon_session( stdin, stdout );
+		return 0;
+	}
+	if( argc == 3 && strcmp(argv[1], "--socket") == 0 ){
+		return daemon_socket( argv[2] );
+	}
 
-	mpz_init( lfsr.STATE );
-	mpz_set_ui(lfsr.STATE, iv);						//Set initial vector (seed)
-	
-	#if defined DEBUG
-		t = pb(lfsr.STATE, psize, 0);
-		printf("\n\tINIT STT:\t%s",t); mpz_out_str( stdout, 2, lfsr.STATE );
-		printf("\n");
-		free(t);
-	#endif
-	
-	mpz_t OUTPUT;
-	mpz_init( OUTPUT );
-	int	tmpOUT	= 0;								//temp char holder
-	i = 0;											//Zero out counter
-	while( i < olen ){								//Iterate the LFSR for the set output length
-		tmpOUT = lfsr_iterate(&lfsr);
-		if( initmatch == 0 && skip == 1) {			// Iterate until we match the first bit of the sequence
-
-			#if defined SHIFTOR
-			if( mpz_tstbit(B[tmpOUT], 0) == 0 ) {
-			//Set output to tmpvar
-			#else
-			if( mpz_tstbit(B[tmpOUT], 0) == 1 ) {
-			#endif
-				initmatch = 1;						//Set state to found
-				if( tmpOUT == 1 )
-					mpz_setbit(OUTPUT, i);			//Set output to tmpvar
-
-				i++;								//inc counter
-
-				// #if defined DEBUG
-				// 	t = pb(B[0],m);
-				// 	printf("\tinitmatch found\t\t%d |\t0: %s", tmpOUT, t);
-				// 	mpz_out_str( stdout, 2, B[0] );
-				// 	free(t); t = pb(B[1],m);
-				// 	printf("\n\t\t\t\t\t1: %s", t);		
-				// 	mpz_out_str( stdout, 2, B[1] );
-				// 	printf("\n");
-				// 	free(t);
-				// #endif
-			}
+	if( argc < 6 ){	      								//Check required input parameters
+		printf("Incorrect number of arguments\nUsage: ./main <polynomial> <search word length> <errors> <init state R1> <init state R2> [-p] [-a] [-r] [-g min_m] [-e precision [--seed n] [--samples n]] [-i max_m] [-t threads] [-j metrics.json [-P]] [-T trace.bin] [--shard i/N [-o file]] [--checkpoint file | --resume file [--every s]] [--cache dir [--cache-size MB]] [--arena] [--auto [--profile file]] [--stream file [--windows W] [--stride s] [--make-stream bits]]\n");
+		return 1;
+	}
 
-			// #if defined DEBUG
-			// else{
-			// 	t = pb(B[0],m);
-			// 	printf("\tinitmatch not found\t%d |\t0: %s", tmpOUT, t);
-			// 	mpz_out_str( stdout, 2, B[0] );
-			// 	free(t); t = pb(B[1],m);
-			// 	printf("\n\t\t\t\t\t1: %s", t);			
-			// 	mpz_out_str( stdout, 2, B[1]);
-			// 	printf("\n");
-			// 	free(t);
-			// }
-			// #endif
+	int deg		= atoi( argv[1] );						//Polynomial degree
+	int m		= atoi( argv[2] );						//Search word length
+	int k		= atoi( argv[3] );						//Allowed errors
+	int CLKSTATE = atoi( argv[4] );						//Set initial state of R1
+	int SSTATE	= atoi( argv[5] );						//Set initial state of R2
+	int pipeline = 0;
+	int arcs	= 0;
+	int recover	= 0;
+	int threads	= 0;
+	int shard	= -1;
+	int shards	= 0;
+	char* out	= NULL;
+	int grid	= 0;
+	int online	= 0;
+	char* metrics = NULL;
+	char* checkpoint = NULL;
+	int resume	= 0;
+	double every = 60;
+	char* cache	= NULL;
+	double estimate = 0;
+	uint64_t seed = 1;
+	uint64_t samples = 0;
+	double cache_mb = 1024;
+	int arena	= 0;
+	int autopick = 0;
+	char* profile = NULL;
+	char* stream = NULL;
+	int windows	= 1;
+	uint64_t stride = 0;
+	uint64_t stream_bits = 0;
+
+	int a = 6;
+	while( a < argc ){
+		if( strcmp(argv[a], "-p") == 0 ){
+			pipeline = 1;
+		}
+		else if( strcmp(argv[a], "-a") == 0 ){
+			arcs = 1;
+		}
+		else if( strcmp(argv[a], "-r") == 0 ){
+			recover = 1;
+		}
+		else if( strcmp(argv[a], "-t") == 0 && a+1 < argc ){
+			threads = atoi( argv[++a] );
 		}
-		else {
-			if( tmpOUT == 1)	mpz_setbit(OUTPUT, i);
-			i++;															//Next bit
+		else if( strcmp(argv[a], "--shard") == 0 && a+1 < argc ){
+			if( sscanf(argv[++a], "%d/%d", &shard, &shards) != 2 || shards < 1 || shard < 0 || shard >= shards ){
+				printf("Invalid shard %s, expected i/N with 0 <= i < N\n", argv[a]);
+				return 1;
+			}
+		}
+		else if( strcmp(argv[a], "-g") == 0 && a+1 < argc ){
+			grid = atoi( argv[++a] );
+		}
+		else if( strcmp(argv[a], "-e") == 0 && a+1 < argc ){
+			estimate = atof( argv[++a] );
+			if( estimate <= 0 ){
+				printf("Invalid precision %s\n", argv[a]);
+				return 1;
+			}
+		}
+		else if( strcmp(argv[a], "--samples") == 0 && a+1 < argc ){
+			samples = strtoull( argv[++a], NULL, 10 );
+		}
+		else if( strcmp(argv[a], "--seed") == 0 && a+1 < argc ){
+			seed = strtoull( argv[++a], NULL, 10 );
 		}
+		else if( strcmp(argv[a], "-i") == 0 && a+1 < argc ){
+			online = atoi( argv[++a] );
+		}
+		else if( strcmp(argv[a], "-P") == 0 ){
+			if( brm_profile(1) == 0 ){
+				printf("Hardware counters unavailable, profiling off\n");
+			}
+		}
+		else if( strcmp(argv[a], "-j") == 0 && a+1 < argc ){
+			metrics = argv[++a];
+		}
+		else if( strcmp(argv[a], "-T") == 0 && a+1 < argc ){
+			if( brm_trace_start(argv[++a]) != 0 ){
+				printf("Could not trace to %s, needs a BRM_TRACE build\n", argv[a]);
+				return 1;
+			}
+			atexit( stop_trace );
+		}
+		else if( (strcmp(argv[a], "--checkpoint") == 0 || strcmp(argv[a], "--resume") == 0) && a+1 < argc ){
+			resume = strcmp(argv[a], "--resume") == 0;
+			checkpoint = argv[++a];
+		}
+		else if( strcmp(argv[a], "--every") == 0 && a+1 < argc ){
+			every = atof( argv[++a] );
+		}
+		else if( strcmp(argv[a], "--cache") == 0 && a+1 < argc ){
+			cache = argv[++a];
+		}
+		else if( strcmp(argv[a], "--cache-size") == 0 && a+1 < argc ){
+			cache_mb = atof( argv[++a] );
+		}
+		else if( strcmp(argv[a], "--arena") == 0 ){
+			arena = 1;
+		}
+		else if( strcmp(argv[a], "--auto") == 0 ){
+			autopick = 1;
+		}
+		else if( strcmp(argv[a], "--profile") == 0 && a+1 < argc ){
+			profile = argv[++a];
+		}
+		else if( strcmp(argv[a], "--stream") == 0 && a+1 < argc ){
+			stream = argv[++a];
+		}
+		else if( strcmp(argv[a], "--windows") == 0 && a+1 < argc ){
+			windows = atoi( argv[++a] );
+		}
+		else if( strcmp(argv[a], "--stride") == 0 && a+1 < argc ){
+			stride = strtoull( argv[++a], NULL, 10 );
+		}
+		else if( strcmp(argv[a], "--make-stream") == 0 && a+1 < argc ){
+			stream_bits = strtoull( argv[++a], NULL, 10 );
+		}
+		else if( strcmp(argv[a], "-o") == 0 && a+1 < argc ){
+			out = argv[++a];
+		}
+		else{
+			printf("Unknown option %s\n", argv[a]);
+			return 1;
+		}
+		a++;
 	}
 
-	//Print LFSR information
-	#if defined DEBUG
-	printf("\tDEGREE:\t\t%d\n", psize);
-	printf("\tLENGTH:\t\t%d\n", olen);
-	printf("\tPOLYNOMIAL:\t"); mpz_out_str( stdout, 2, lfsr.POLYNOMIAL );
-	t = pb(lfsr.STATE, psize, 0);
-	printf("\n\tFINAL STT:\t%s", t); mpz_out_str( stdout, 2, lfsr.STATE );
-	free(t); t = pb(OUTPUT, olen, 0);
-	printf("\n\tSEQUENCE:\t%s", t); mpz_out_str( stdout, 2, OUTPUT);
-	free(t);
-	printf("\n\n");
-	#endif
-	mpz_set(rop, OUTPUT);
-	mpz_clear(OUTPUT);
-	mpz_clear( lfsr.POLYNOMIAL );
-	mpz_clear( lfsr.STATE );
-	//free( lfsr.DEGREE );
-	//free( lfsr ); 
-}
-
-
-
-/*-----------------------------------------------------------------------------
- * Creates the prefixes
------------------------------------------------------------------------------*/
-void genPrefixes( mpz_t* B, mpz_t P ){
-	int	 j = 0;
-
-	mpz_t tmp;  
-	mpz_init(tmp); 
-	mpz_set_ui( tmp, 1);
-
-	while( j<m ){
-		int ci = mpz_tstbit(P, j);				//Char value 0/1
+	if( arena ){										//Before any GMP memory is taken
+		brm_arena();
+	}
 
-		#if defined DEBUG
-			printf("\tj=%d\tB[%d] |\t%s", j, mpz_tstbit(P,j), pb(B[ci],m,0) );
-			mpz_out_str(stdout, 2, B[ci]);
-		#endif
+	if( shards > 0 && (pipeline || recover) ){
+		printf("--shard only applies to stage one\n");
+		return 1;
+	}
+	if( grid > 0 && (pipeline || recover) ){
+		printf("-g only applies to stage one\n");
+		return 1;
+	}
+	if( checkpoint != NULL && (pipeline || grid || online || estimate > 0) ){
+		printf("--checkpoint only applies to stage one and two\n");
+		return 1;
+	}
 
-		mpz_ior( B[ci], B[ci], tmp );			//current value or-ed with 10^(j-1)
-		mpz_lshift( tmp, m );
+	if( stream != NULL && (pipeline || recover || grid || online || estimate > 0 || shards > 0 || checkpoint != NULL) ){
+		printf("--stream only applies to stage one\n");
+		return 1;
+	}
 
-		#if defined DEBUG
-			printf( "\n\t\t\t%s", pb(B[ci],m,0));
-			mpz_out_str( stdout, 2, B[ci]);		printf( "\n" );
-		#endif
+	if( cache != NULL && brm_cache_open(cache, (uint64_t)(cache_mb * 1048576)) != 0 ){
+		printf("Could not use %s as the result cache\n", cache);
+		return 1;
+	}
 
-		j++;									//Next pattern character
+	brm_plan* plan = brm_plan_create(deg, CLKSTATE, SSTATE, online > m ? online : m);
+	if( plan == NULL ){
+		printf("Invalid polynomial degree\n");
+		return 1;
 	}
 
-	// Invert prefixes for Shift-OR mode
-	#if defined SHIFTOR
-		int i = 0;
-		mpz_t mask;
-		mpz_init(mask);
-		mpz_ui_pow_ui(mask, ALPHASIZE, m);
-		mpz_sub_ui(mask, mask, 1);
-		while( i<ALPHASIZE ){
-			mpz_xor( B[i], B[i], mask );
-			i++;
+	//-----------------------------------------------------------------------------
+	// Planner: stage one runs on the engine the cost model of the host
+	// predicts to be fastest for (m, k), calibrated once and kept in a file.
+	//-----------------------------------------------------------------------------
+	if( autopick ){
+		char path[4096];
+		if( profile == NULL && getenv("HOME") != NULL ){
+			snprintf(path, sizeof(path), "%s/.brm_profile", getenv("HOME"));
+			profile = path;
 		}
-	#endif
-
-	mpz_clear( tmp );
-
-}
-
-
+		if( brm_planner_open(profile) != 0 ){
+			printf("Could not write the profile %s\n", profile);
+		}
+		struct brm_choice choice;
+		char why[512];
+		brm_plan_choose(plan, m, k, threads, &choice);
+		brm_choice_report(&choice, why, sizeof(why));
+		printf("Planner: %s\n", why);
+		arcs = choice.mode == BRM_SWEEP_ARCS;
+	}
 
-/*-----------------------------------------------------------------------------
- * Creates the error list of K-size
------------------------------------------------------------------------------*/
-mpz_t* genError(int K) {
-	mpz_t*	R	= malloc( K*sizeof(mpz_t) );		//Allocate memory for array
-	#if defined DEBUG_SEARCH
-		printf("Gen error R[%d..%d]\n", 0, K-1);
-	#endif
-	int k = 0;																//Set counter
-	while( k<K ){
-		int i = 0;
-		mpz_init( R[k] );
-		while( i < k ){
-			mpz_setbit( R[k], i );
+	//-----------------------------------------------------------------------------
+	// Online mode: the cipher arrives bit by bit, only the candidates that
+	// still match are searched again. One line per word length.
+	//-----------------------------------------------------------------------------
+	if( online > 0 ){
+		brm_online* O = brm_online_create(plan, m, k, threads);
+		if( O == NULL ){
+			printf("Invalid online attack\n");
+			brm_plan_destroy( plan );
+			return 1;
+		}
+		struct brm_result res;
+		printf("m,survivors,found\n");
+		int i = m;
+		while( 1 ){
+			brm_online_result(O, &res);
+			printf("%d,%llu,%d\n", i, (unsigned long long)res.candidates, res.found);
+			brm_result_clear( &res );
+			if( i >= online ){
+				break;
+			}
+			brm_online_push(O, brm_plan_cipher_bit(plan, i));
 			i++;
 		}
-		#if defined SHIFTOR
-		mpz_t mask;
-		mpz_init(mask);
-		mpz_ui_pow_ui(mask, ALPHASIZE, m);
-		mpz_sub_ui(mask, mask, 1);
-		mpz_xor( R[k], R[k], mask );
-		#endif
-
-		#if defined DEBUG_SEARCH
-		char* t;
-		t = pb(R[i],m,0);
-		printf("\tR[%d]\t= %s", k, t);
-		mpz_out_str( stdout, 2, R[k]);
-		printf( "\n" );
-		#endif
-		k++;
+		brm_online_result(O, &res);
+		int found = res.found;
+		brm_result_clear( &res );
+		brm_online_destroy( O );
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return found == 1 ? 0 : 1;
 	}
 
-	return R;
-}
-
-/*-----------------------------------------------------------------------------
- * Perform search on TEXT and PREFIX
------------------------------------------------------------------------------*/
-mpz_t* arbp_search(mpz_t* B, int K) {
-	mpz_t tmp1;	
-	mpz_init( tmp1 );									//Tmp variables
-	mpz_t tmp2;		
-	mpz_init( tmp2 );
-	mpz_t tmp3;		
-	mpz_init( tmp3 );
-														//Match for each position in text
-	mpz_t* R = genError( K );							//Gen error-table
-	mpz_t* MATCHES = malloc( n * sizeof(mpz_t) );
-
-	mpz_t oldR, newR;									//Create and init variables
-	mpz_init( oldR );
-	mpz_init( newR );
-
-	char* t;
-	char* b;
-
-	#if defined DEBUG_SEARCH
-		printf( "\nBeginning search\n");					//Debug
-	#endif
-
-	uint_least64_t pos	= 0;							//Start search from char 1
-
-	while( pos < n ){									//Search entire TEXT
-		
-		#if defined DEBUG_SEARCH
-			printf("-------------- %llu", pos);
-		#endif
-
-		int Ti	= mpz_tstbit( TEXT, pos );				//Grab current chars int value
-
-		mpz_clear( oldR );	mpz_init( oldR );			//Reset variables
-		mpz_clear( newR );	mpz_init( newR );
-
-		mpz_set( oldR, R[0] );							//Init oldR to cur R[0] (R[i])
-		mpz_set( tmp1, R[0] );
-
-		#if defined SHIFTOR
-			mpz_lshift( tmp1, m );						//lshift
-			//b = pb(tmp1,m,0); printf("\nLSHFT: \t%s", b); mpz_out_str(stdout, 2, tmp1);
-			mpz_ior( tmp1, tmp1, B[Ti] );				//OR with B[Ti]
-			//b = pb(tmp1,m,0); printf("\nORWB: \t%s", b); mpz_out_str(stdout, 2, tmp1);
-
-		#else
-			mpz_lshift( tmp1, m );						//lshift
-			//b = pb(tmp1,m,0); printf("\nLSHFT: \t%s", b); mpz_out_str(stdout, 2, tmp1);
-			mpz_setbit( tmp1, 0 );						//OR with 1
-			//b = pb(tmp1,m,0); printf("\nORW1: \t%s", b); mpz_out_str(stdout, 2, tmp1);
-			mpz_and( tmp1, tmp1, B[Ti] );				//AND with B[Ti]
-			//b = pb(tmp1,m,0); printf("\nANDWB: \t%s", b); mpz_out_str(stdout, 2, tmp1);
-		#endif
-
-
-		#if defined DEBUG_SEARCH
-			b = pb(B[Ti],m,0);
-			printf("\n\nB[%d]: %s", Ti, b);
-			mpz_out_str(stdout, 2, B[Ti]);		
-		#endif
+	//-----------------------------------------------------------------------------
+	// Estimate mode: candidate rate of a random sample of R2 states, the
+	// expected candidates of a full sweep and the cost of stage two.
+	//-----------------------------------------------------------------------------
+	if( estimate > 0 ){
+		struct brm_estimate e;
+		if( brm_plan_estimate(plan, m, k, estimate, samples, seed, threads, &e) != 0 ){
+			printf("Invalid estimate\n");
+			brm_plan_destroy( plan );
+			return 1;
+		}
+		printf("m,k,sampled,hits,rate,rate_low,rate_high,candidates,candidates_low,candidates_high,"
+			"stage_two,found,exact,bounded,seconds\n");
+		printf("%d,%d,%llu,%llu,%.6g,%.6g,%.6g,%.1f,%.1f,%.1f,%.4g,%d,%d,%d,%f\n", m, k,
+			(unsigned long long)e.sampled, (unsigned long long)e.hits, e.rate, e.rate_low, e.rate_high,
+			e.candidates, e.candidates_low, e.candidates_high, e.stage_two, e.found, e.exact, e.bounded, e.runtime);
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return 0;
+	}
 
-		mpz_set( newR, tmp1 );							//Set newR to tmp
-		mpz_set(R[0], newR);							//Set R[0] to R'[i]
+	//-----------------------------------------------------------------------------
+	// Stream mode: stage one on several windows of a long cipher stream, the
+	// initial states left after each window, then the survivors.
+	//-----------------------------------------------------------------------------
+	if( stream != NULL ){
+		if( stream_bits > 0 && brm_plan_stream_write(plan, stream, stream_bits) != 0 ){
+			printf("Could not write %s\n", stream);
+			brm_plan_destroy( plan );
+			return 1;
+		}
+		struct brm_result res;
+		uint64_t* left = malloc( (windows > 0 ? windows : 1) * sizeof(uint64_t) );
+		int ret = brm_plan_windows(plan, stream, m, k, windows, stride, threads, left, &res);
+		if( ret != 0 ){
+			if( ret < 0 )	printf("Invalid windows\n");
+			else			printf("%s: could not read the stream or it is too short\n", stream);
+			free( left );
+			brm_plan_destroy( plan );
+			return 1;
+		}
+		printf("window,survivors\n");
+		int w = 0;
+		while( w < windows ){
+			printf("%d,%llu\n", w, (unsigned long long)left[w]);
+			w++;
+		}
+		printf("Survivors: %llu, actual R2 state %s, %f seconds\n", (unsigned long long)res.candidates,
+			res.found ? "found" : "not found", res.runtime);
+		int found = res.found;
+		free( left );
+		brm_result_clear( &res );
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return found == 1 ? 0 : 1;
+	}
 
-		#if defined (DEBUG_SEARCH) && defined (SHIFTOR)
-			if(mpz_tstbit(R[0], m-1) > 0){ 
-				t = pb(R[0],m,1);
-			}
-			else{
-				t = pb(R[0],m,0);
+	//-----------------------------------------------------------------------------
+	// Grid mode: candidates of every (m, k) up to the given ones from a single
+	// search per state, one line per cell.
+	//-----------------------------------------------------------------------------
+	if( grid > 0 ){
+		struct brm_grid g;
+		if( brm_plan_grid(plan, grid, m, k, threads, &g) != 0 ){
+			printf("Invalid grid\n");
+			brm_plan_destroy( plan );
+			return 1;
+		}
+		printf("m,k,candidates,found\n");
+		int i = grid;
+		while( i <= m ){
+			int j = 0;
+			while( j <= k ){
+				int c = (i - grid)*(k+1) + j;
+				printf("%d,%d,%llu,%d\n", i, j, (unsigned long long)g.candidates[c], g.found[c]);
+				j++;
 			}
-			printf("\nR[0]: %s", t);
-			mpz_out_str(stdout, 2, R[0]);
-			if( mpz_tstbit(R[0], m-1) == 0 ) printf(" [!]"); // Print indicator if match
-			printf("\n");
-		#elif defined DEBUG_SEARCH
-			t = pb(R[0],m,0);
-			printf("\nR[0]: %s", t);
-			mpz_out_str(stdout, 2, R[0]);
-			if( mpz_tstbit(R[0], m-1) == 1 ) printf(" [!]"); // Print indicator if match
-			printf("\n");
+			i++;
+		}
+		#if defined DEBUG
+		printf("Grid in %f seconds\n", g.runtime);
 		#endif
+		brm_grid_clear( &g );
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return 0;
+	}
 
+	//-----------------------------------------------------------------------------
+	// Shard mode: stage one over part of the sweep only, the ranked candidates
+	// go to a shard file for brm_merge.
+	//-----------------------------------------------------------------------------
+	if( shards > 0 ){
+		int mode = arcs ? BRM_SWEEP_ARCS : BRM_SWEEP_STATES;
+		struct brm_result res;
+		struct brm_shard sh;
+		uint64_t range[2];
+		char name[80];
+		brm_shard_range(deg, mode, shard, shards, &range[0], &range[1]);
+		if( stage_one(plan, m, k, mode, threads, range[0], range[1], checkpoint, every, resume, &res) != 0 ){
+			brm_plan_destroy( plan );
+			return 1;
+		}
 
-		uint_least64_t i = 1;								//Calc matches with K allowed errors
-		while( i < K ) {
-			mpz_clear( tmp1 );mpz_clear(tmp2); mpz_clear(tmp3);
-			mpz_init(tmp1);	mpz_init(tmp2);	mpz_init(tmp3);	//reset and initialise temp variables
-
-															//Substitute and deletion
-			#if defined SHIFTOR
-				mpz_set(tmp3, oldR);						//tmp3 = oldR
-				mpz_lshift(tmp3, m);						//tmp3 = <tmp3> << 1
-				mpz_ior(tmp2, tmp3, B[Ti]);
-
-				mpz_and(tmp2, tmp2, tmp3);
-
-				#if defined INC_INSERT						//Insertion
-					mpz_and(tmp2, oldR, tmp2);					//tmp2 = oldR | <tmp2>
-				#endif
-
-				mpz_set(tmp1, R[i]);						//Copy value
-				mpz_lshift(tmp1, m);						//tmp1 = R[i]<<1
-				mpz_ior(tmp1, tmp1, B[Ti]);					//tmp1 = <tmp1> & B[Ti]
-
-				mpz_and(tmp1, tmp1, tmp2);					//tmp1 = <tmp1> | <tmp2>
-
-				mpz_set(newR, tmp1);						//newR = <tmp1>
-				mpz_set(oldR, R[i]);						//Store R[i] for next error
-				mpz_set(R[i], newR);						//R[i] == R'[i]
-
-			#else											// Shift-AND
-				mpz_ior(tmp2, oldR, newR);					//tmp2 = (oldR|newR)
-				mpz_lshift(tmp2, m);						//tmp2 = <tmp2> << 1
-				mpz_setbit( tmp2, 0 );
-
-				#if defined INC_INSERT						//Insertion
-					mpz_ior(tmp2, oldR, tmp2);					//tmp2 = oldR | <tmp2>
-				#endif
-
-				mpz_set(tmp1, R[i]);						//Copy value
-				mpz_lshift(tmp1, m);						//tmp1 = R[i]<<1
-				mpz_and(tmp1, tmp1, B[Ti]);					//tmp1 = <tmp1> & B[Ti]
-
-				mpz_ior(tmp1, tmp1, tmp2);					//tmp1 = <tmp1> | <tmp2>
-
-				mpz_set(newR, tmp1);						//newR = <tmp1>
-				mpz_set(oldR, R[i]);						//Store R[i] for next error
-				mpz_set(R[i], newR);						//R[i] == R'[i]
-			#endif
-
-
-			
-			#if defined (DEBUG_SEARCH) && defined (SHIFTOR)
-				if(mpz_tstbit(R[i], m-1) > 0){ 
-					t = pb(R[i],m,1);
-				}
-				else{
-					t = pb(R[i],m,0);
-				}
-				//t = pb(R[i],m,1);
-				printf("R[%llu]: %s", i, t );
-				mpz_out_str(stdout, 2, R[i]);
-				if( mpz_tstbit(newR, m-1) == 0 ) printf(" [!]");
-				printf("\n");	
-
-			#elif defined DEBUG_SEARCH
-				t = pb(R[i],m,0);
-				printf("R[%llu]: %s", i, t );
-				mpz_out_str(stdout, 2, R[i]);
-				if( mpz_tstbit(newR, m-1) == 1 ) printf(" [!]"); // Print indicator if match
-				printf("\n");	
-
-			#endif
-
-			i++;										//Next error
-		}
-
-		// #if !defined DEBUG
-		// if( CSTATE == SSTATE ){
-		// #endif
-		mpz_init( MATCHES[pos] );
-		mpz_set_ui( MATCHES[pos], m );				//Init val of match at cur pos
-		int j	= 0;								//Init counter
-		#if defined SHIFTOR
-		if( mpz_tstbit(newR, m-1) == 0 ){			//Check if R-table has a match
-		#else				
-		if( mpz_tstbit(newR, m-1) == 1 ){			//Check if R-table has a match
-		#endif
+		sh.deg = deg;	sh.m = m;	sh.k = k;
+		sh.R1 = CLKSTATE;	sh.R2 = SSTATE;	sh.mode = mode;
+		sh.ranges = 1;
+		sh.range = range;
+		sh.entries = res.candidates;
+		sh.states = res.states;
+		sh.scores = res.scores;
+		brm_shard_rank( &sh );
+		if( out == NULL ){
+			sprintf(name, "%d_%d_%d_%d_%d_%dof%d.brm", deg, m, k, CLKSTATE, SSTATE, shard, shards);
+			out = name;
+		}
+		int err = brm_shard_write( &sh, out );
+		if( err ){
+			printf("Could not write %s\n", out);
+		}
+		else{
+			printf("Shard %d/%d: [%llu, %llu) %llu candidates in %f seconds -> %s\n", shard, shards,
+				(unsigned long long)range[0], (unsigned long long)range[1],
+				(unsigned long long)res.candidates, res.runtime, out);
+		}
+		brm_result_clear( &res );
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return err;
+	}
 
-		while( j<K ){							//Loop R-table for matches (MSB set)
-				#if defined SHIFTOR
-				if(mpz_tstbit(R[j], m-1) == 0){		//Check if MSB zero
-				#else
-				if(mpz_tstbit(R[j], m-1) == 1){		//Check if MSB set
-				#endif
-					mpz_set_ui(MATCHES[pos], j);	//Set match to the R-level (0-K)
-					j = K;												//Skip to end
-				}
-				j++;														//Next error value
-			}
+	//-----------------------------------------------------------------------------
+	// Pipelined mode: recover the full key pair, stage two consumes candidates
+	// while stage one is still sweeping R2.
+	//-----------------------------------------------------------------------------
+	if( pipeline ){
+		int r1, r2;
+		int ret = brm_plan_pipeline(plan, m, k, threads, threads, &r1, &r2);
+		if( ret == 0 ){
+			printf("Match found for R1 init state %i and R2 init state %i\n", r1, r2);
+		}
+		else if( ret == 1 ){
+			printf("No match found\n");
 		}
+		write_metrics( plan, metrics, argv );
+		brm_plan_destroy( plan );
+		return ret == 0 && r1 == CLKSTATE && r2 == SSTATE ? 0 : 1;
+	}
 
-		// #if !defined DEBUG
-		// }
-		// #endif
-		#if defined DEBUG_SEARCH
-		printf("\n");
-		#endif
-		pos += 1;															//Next position in search text
+	//-----------------------------------------------------------------------------
+	// Step ONE only: the exit status tells if the actual initial state of R2
+	// is within the set of candidates.
+	//-----------------------------------------------------------------------------
+	struct brm_result res;
+	int mode = arcs ? BRM_SWEEP_ARCS : BRM_SWEEP_STATES;
+	uint64_t from, to;
+	brm_shard_range(deg, mode, 0, 1, &from, &to);
+	if( stage_one(plan, m, k, mode, threads, from, to, checkpoint, every, resume, &res) != 0 ){
+		brm_plan_destroy( plan );
+		return 1;
 	}
 
-	#if defined DEBUG_SEARCH
-		printf("Search done.\n");
+	#if defined DEBUG
+	printf("Found %llu candidates in %f seconds\n", (unsigned long long)res.candidates, res.runtime);
 	#endif
-	mpz_clear( oldR );
-	mpz_clear( newR );
-	free(R);
-
-	//#if defined DEBUG
-	return MATCHES;
-	//#else
-	//	if( CSTATE == SSTATE )	return MATCHES;
-	//	else return NULL;
-	//#endif
-}
 
-int match_R1( struct CANDIDATE* candidates, struct CANDIDATE* endCandidates, mpz_t* tgt_cipher ) {
-	printf("Cracking...");
-	mpz_t LDES; mpz_init(LDES);
-	mpz_t LCLK;	mpz_init(LCLK);						//LFSR for dessimating
-	mpz_t CIPHER2;	mpz_init( CIPHER2 );					//Gen intercepted ciphertext
-	mpz_init(LDES);
-	mpz_init(LCLK);	
-	mpz_init(CIPHER2);
-
-	while ( candidates < endCandidates ) {
-		if (candidates->istate == 0){
-			break;
-		}
-		//printf("\n%i,", candidates->istate); mpz_out_str(stdout, 2, candidates->X); 
-
-
-		mpz_set(LDES, candidates->X);	// Get the current candidate
-		//x = mpz_get_ui(candidates->istate);
-		//lfsrgen(LDES, deg, n, pol, candidates->istate, 0, NULL);				//Clocking LFSR
-
-		int i = 0;
-		while (i<mpz_get_ui(max)) {
-			#if defined DEBUG
-				printf("Generating clocking LFSR (R1) output sequence: \n");
-			#endif
-	
-			lfsrgen(LCLK, deg, m, pol, i, 0, NULL);				//Clocking LFSR
-			
-			// Perhaps we should save the corresponding CIPHER output from the LDES so we save some time.
-
-			#if defined DEBUG
-				printf("Calculating the Decimated bitsequence and creating ciphertext:\n\n");
-			#endif
-
-			genEncrypt(	CIPHER2, LCLK, LDES );
-			//printf("\n");
-			//mpz_out_str(stdout, 10, CIPHER2); printf(" "); mpz_out_str(stdout, 10, *tgt_cipher );
-			//mpz_out_str(stdout, 10, CIPHER2);
-			if ( mpz_get_ui( CIPHER2 ) == mpz_get_ui( *tgt_cipher ) ) {
-				printf("\nMatch found for R1 init state %i and R2 init state %i", i, candidates->istate);
-				return 0;
+	//-----------------------------------------------------------------------------
+	// Step TWO: test every candidate against all R1 states, the exit status
+	// tells if the actual key pair was recovered.
+	//-----------------------------------------------------------------------------
+	if( recover ){
+		int r1, r2;
+		int ret;
+		if( checkpoint != NULL ){
+			char* two = malloc( strlen(checkpoint) + 5 );
+			sprintf(two, "%s.two", checkpoint);
+			ret = brm_plan_stage_two_checkpoint(plan, m, &res, threads, two, every, resume, &r1, &r2);
+			if( ret < 0 ){
+				printf("%s belongs to another run\n", two);
 			}
-
-			i++;
+			else if( ret & 2 ){							//The outcome of stage two stands
+				printf("Could not write %s\n", two);
+				ret &= 1;
+			}
+			free( two );
 		}
-
-
-
-		candidates++;
+		else{
+			ret = brm_plan_stage_two(plan, m, &res, threads, &r1, &r2);
+		}
+		if( ret == 0 ){
+			printf("Match found for R1 init state %i and R2 init state %i\n", r1, r2);
+		}
+		else if( ret == 1 ){
+			printf("No match found\n");
+		}
+		write_metrics( plan, metrics, argv );
+		brm_result_clear( &res );
+		brm_plan_destroy( plan );
+		return ret == 0 && r1 == CLKSTATE && r2 == SSTATE ? 0 : 1;
 	}
-	mpz_clear(LCLK);
-	mpz_clear(CIPHER2);
-	mpz_clear(LDES);
 
-	printf("\nNo match found... exiting.");
-	return 1;
+	int found = res.found;
+	write_metrics( plan, metrics, argv );
+	brm_result_clear( &res );
+	brm_plan_destroy( plan );
+	return found == 1 ? 0 : 1;
 }